@@ -0,0 +1,291 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include <util.h>
+#include <bufpool.h>
+
+/**
+ * @file   bufpool.c
+ * @brief  Contiene il pool dei buffer dei messaggi: buffer riusabili divisi
+ *           in classi di dimensione (potenze di 2), con una cache per thread
+ *           e un pool condiviso per i buffer liberati da un altro thread
+ * @author Michele Zoncheddu 545227
+ *
+ * Si dichiara che il contenuto di questo file e'
+ *   in ogni sua parte opera originale dell'autore
+ */
+
+/**
+ * @struct bufhdr_t
+ * @brief  intestazione di un buffer, subito prima dei dati
+ *
+ * @var next   nella lista dei buffer liberi
+ * @var cls    classe di dimensione (BUF_CLASSES se fuori dal pool)
+ * @var refs   riferimenti al buffer
+ * @var aux    buffer ausiliario (vedi bufSetAux), liberato insieme al buffer
+ * @var auxlen lunghezza associata al buffer ausiliario (0 se non associato,
+ *               AUX_BUSY mentre viene associato)
+ */
+typedef struct bufhdr {
+	struct bufhdr *next;
+	unsigned int   cls;
+	unsigned int   refs;
+	char          *aux;
+	unsigned int   auxlen;
+} bufhdr_t;
+
+#define AUX_BUSY 0xffffffffu
+
+/**
+ * @struct buflist_t
+ * @brief  lista dei buffer liberi di una classe
+ *
+ * @var head primo buffer libero
+ * @var n    numero di buffer liberi
+ */
+typedef struct {
+	bufhdr_t *head;
+	int       n;
+} buflist_t;
+
+// i listener allocano i buffer e i worker li liberano: la cache di chi libera
+//   restituisce al pool condiviso i buffer in eccesso, a gruppi
+static __thread buflist_t cache[BUF_CLASSES];  // buffer liberi del thread
+static __thread int       registered = 0;      // 1 se la cache ha il distruttore
+static buflist_t          shared[BUF_CLASSES]; // buffer liberi in comune
+static pthread_mutex_t    mutex[BUF_CLASSES];  // una mutex per classe
+static pthread_key_t      key;                 // per svuotare la cache alla terminazione
+static pthread_once_t     once = PTHREAD_ONCE_INIT;
+
+/**
+ * @function moveBufs
+ * @brief    sposta fino a n buffer da una lista ad un'altra
+ *
+ * @param from lista di partenza
+ * @param to   lista di arrivo
+ * @param n    numero massimo di buffer da spostare
+ */
+static void moveBufs(buflist_t *from, buflist_t *to, int n) {
+	bufhdr_t *h;
+	for (; n > 0 && from->head; --n) {
+		h          = from->head;
+		from->head = h->next;
+		from->n--;
+		h->next  = to->head;
+		to->head = h;
+		to->n++;
+	}
+}
+
+/**
+ * @function flushCache
+ * @brief    restituisce al pool condiviso i buffer di una cache
+ *             (distruttore della chiave, alla terminazione del thread)
+ *
+ * @param arg puntatore alla cache
+ */
+static void flushCache(void *arg) {
+	buflist_t *c = arg;
+	for (int i = 0; i < BUF_CLASSES; ++i) {
+		pthread_mutex_lock(&mutex[i]);
+		moveBufs(&c[i], &shared[i], c[i].n);
+		pthread_mutex_unlock(&mutex[i]);
+	}
+}
+
+/**
+ * @function initShared
+ * @brief    inizializza il pool condiviso (una sola volta)
+ */
+static void initShared(void) {
+	int notused;
+	for (int i = 0; i < BUF_CLASSES; ++i)
+		LIBCALL(notused, pthread_mutex_init(&mutex[i], NULL), "pthread_mutex_init");
+	LIBCALL(notused, pthread_key_create(&key, flushCache), "pthread_key_create");
+}
+
+/**
+ * @function localCache
+ * @brief    restituisce la cache del thread chiamante, registrandone
+ *             il distruttore al primo uso
+ *
+ * @return il puntatore alla cache
+ */
+static buflist_t *localCache(void) {
+	if (!registered) {
+		pthread_once(&once, initShared);
+		pthread_setspecific(key, cache);
+		registered = 1;
+	}
+	return cache;
+}
+
+/**
+ * @function classOf
+ * @brief    restituisce la classe piu' piccola che contiene size byte
+ *
+ * @param size dimensione richiesta
+ *
+ * @return la classe (BUF_CLASSES se nessuna classe e' abbastanza grande)
+ */
+static unsigned int classOf(size_t size) {
+	unsigned int c = 0;
+	while (c < BUF_CLASSES && ((size_t)1 << (c + BUF_MINSHIFT)) < size)
+		c++;
+	return c;
+}
+
+/**
+ * @function bufAlloc
+ * @brief    restituisce un buffer di almeno size byte, dalla cache del
+ *             thread o dal pool condiviso se possibile
+ *
+ * @param size dimensione richiesta
+ *
+ * @return il puntatore al buffer (con un riferimento)
+ */
+char *bufAlloc(size_t size) {
+	unsigned int c = classOf(size);
+	buflist_t   *l;
+	bufhdr_t    *h;
+
+	if (c == BUF_CLASSES) { // troppo grande per il pool
+		MALLOC(h, malloc(sizeof(bufhdr_t) + size), "h bufAlloc");
+	}
+	else {
+		l = &localCache()[c];
+		if (!l->head) { // cache vuota: prendo un gruppo dal pool condiviso
+			pthread_mutex_lock(&mutex[c]);
+			moveBufs(&shared[c], l, BUF_BATCH);
+			pthread_mutex_unlock(&mutex[c]);
+		}
+		if ((h = l->head) != NULL) {
+			l->head = h->next;
+			l->n--;
+		}
+		else {
+			MALLOC(h, malloc(sizeof(bufhdr_t) + ((size_t)1 << (c + BUF_MINSHIFT))), "h bufAlloc");
+		}
+	}
+	h->cls    = c;
+	h->refs   = 1;
+	h->aux    = NULL;
+	h->auxlen = 0;
+	return (char*)(h + 1);
+}
+
+/**
+ * @function bufShare
+ * @brief    aggiunge un riferimento ad un buffer, che viene restituito
+ *             al pool solo dopo l'ultima bufFree
+ *
+ * @param buf puntatore al buffer
+ *
+ * @return il puntatore al buffer
+ */
+char *bufShare(char *buf) {
+	if (buf)
+		__atomic_add_fetch(&((bufhdr_t*)buf - 1)->refs, 1, __ATOMIC_RELAXED);
+	return buf;
+}
+
+/**
+ * @function bufAux
+ * @brief    restituisce il buffer ausiliario associato ad un buffer
+ *             (per esempio la sua forma compressa), senza acquisire lock
+ *
+ * @param buf puntatore al buffer
+ * @param aux puntatore al buffer ausiliario da scrivere
+ * @param len puntatore alla lunghezza associata da scrivere
+ *
+ * @return 0 se non e' (ancora) associato niente
+ *         1 altrimenti: *len e' quella passata a bufSetAux e il buffer
+ *           ausiliario (anche NULL) resta valido finche' buf ha riferimenti
+ */
+int bufAux(char *buf, char **aux, unsigned int *len) {
+	bufhdr_t *h = (bufhdr_t*)buf - 1;
+	*len = __atomic_load_n(&h->auxlen, __ATOMIC_ACQUIRE);
+	if (*len == 0 || *len == AUX_BUSY)
+		return 0;
+	*aux = h->aux; // scritto prima di auxlen
+	return 1;
+}
+
+/**
+ * @function bufSetAux
+ * @brief    associa ad un buffer un buffer ausiliario del pool, che viene
+ *             rilasciato con l'ultima bufFree del buffer
+ *
+ * @param buf puntatore al buffer
+ * @param aux puntatore al buffer ausiliario (NULL per associare solo len)
+ * @param len lunghezza da associare (diversa da 0 e da AUX_BUSY)
+ *
+ * @return 1 se l'associazione e' avvenuta (aux appartiene al buffer)
+ *         0 se un altro thread ha gia' associato qualcosa (aux resta al chiamante)
+ */
+int bufSetAux(char *buf, char *aux, unsigned int len) {
+	bufhdr_t    *h = (bufhdr_t*)buf - 1;
+	unsigned int none = 0;
+
+	if (!__atomic_compare_exchange_n(&h->auxlen, &none, AUX_BUSY, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return 0;
+	h->aux = aux;
+	__atomic_store_n(&h->auxlen, len, __ATOMIC_RELEASE); // pubblico aux
+	return 1;
+}
+
+/**
+ * @function bufFree
+ * @brief    rilascia un riferimento ad un buffer e, se era l'ultimo,
+ *             lo restituisce alla cache del thread
+ *
+ * @param buf puntatore al buffer (NULL non fa niente)
+ */
+void bufFree(char *buf) {
+	bufhdr_t    *h;
+	buflist_t   *l;
+	unsigned int c;
+
+	if (!buf)
+		return;
+	h = (bufhdr_t*)buf - 1;
+	if (__atomic_sub_fetch(&h->refs, 1, __ATOMIC_ACQ_REL) > 0) // altri riferimenti
+		return;
+	bufFree(h->aux);
+	if ((c = h->cls) == BUF_CLASSES) {
+		free(h);
+		return;
+	}
+	l = &localCache()[c];
+	h->next = l->head;
+	l->head = h;
+	if (++l->n > BUF_CACHE) { // cache piena: restituisco un gruppo al pool condiviso
+		pthread_mutex_lock(&mutex[c]);
+		moveBufs(l, &shared[c], BUF_BATCH);
+		pthread_mutex_unlock(&mutex[c]);
+	}
+}
+
+/**
+ * @function freeBufPool
+ * @brief    libera i buffer del pool condiviso e della cache del thread
+ *             chiamante (le cache degli altri thread tornano al pool
+ *             condiviso alla loro terminazione)
+ */
+void freeBufPool(void) {
+	bufhdr_t *h;
+
+	if (registered)
+		flushCache(cache);
+	pthread_once(&once, initShared);
+	for (int i = 0; i < BUF_CLASSES; ++i) {
+		pthread_mutex_lock(&mutex[i]);
+		while ((h = shared[i].head) != NULL) {
+			shared[i].head = h->next;
+			free(h);
+		}
+		shared[i].n = 0;
+		pthread_mutex_unlock(&mutex[i]);
+	}
+}
@@ -0,0 +1,93 @@
+#ifndef BUFPOOL_H_
+#define BUFPOOL_H_
+
+#include <stddef.h>
+
+/**
+ * @file   bufpool.h
+ * @brief  Contiene il pool dei buffer dei messaggi: buffer riusabili divisi
+ *           in classi di dimensione (potenze di 2), con una cache per thread
+ *           e un pool condiviso per i buffer liberati da un altro thread
+ * @author Michele Zoncheddu 545227
+ *
+ * Si dichiara che il contenuto di questo file e'
+ *   in ogni sua parte opera originale dell'autore
+ *
+ * I buffer del pool vanno liberati solo con bufFree. Quelli piu' grandi
+ *   dell'ultima classe vengono allocati e liberati con malloc e free
+ */
+
+#define BUF_MINSHIFT 6  // la classe piu' piccola e' di 64 byte
+#define BUF_CLASSES  11 // classi da 64 byte a 64KB
+#define BUF_CACHE    64 // buffer liberi al piu' per classe nella cache di un thread
+#define BUF_BATCH    32 // buffer spostati insieme tra una cache e il pool condiviso
+
+/**
+ * @function bufAlloc
+ * @brief    restituisce un buffer di almeno size byte, dalla cache del
+ *             thread o dal pool condiviso se possibile
+ *
+ * @param size dimensione richiesta
+ *
+ * @return il puntatore al buffer (con un riferimento)
+ */
+char *bufAlloc(size_t size);
+
+/**
+ * @function bufShare
+ * @brief    aggiunge un riferimento ad un buffer, che viene restituito
+ *             al pool solo dopo l'ultima bufFree
+ *
+ * @param buf puntatore al buffer
+ *
+ * @return il puntatore al buffer
+ */
+char *bufShare(char *buf);
+
+/**
+ * @function bufAux
+ * @brief    restituisce il buffer ausiliario associato ad un buffer
+ *             (per esempio la sua forma compressa), senza acquisire lock
+ *
+ * @param buf puntatore al buffer
+ * @param aux puntatore al buffer ausiliario da scrivere
+ * @param len puntatore alla lunghezza associata da scrivere
+ *
+ * @return 0 se non e' (ancora) associato niente
+ *         1 altrimenti: *len e' quella passata a bufSetAux e il buffer
+ *           ausiliario (anche NULL) resta valido finche' buf ha riferimenti
+ */
+int bufAux(char *buf, char **aux, unsigned int *len);
+
+/**
+ * @function bufSetAux
+ * @brief    associa ad un buffer un buffer ausiliario del pool, che viene
+ *             rilasciato con l'ultima bufFree del buffer
+ *
+ * @param buf puntatore al buffer
+ * @param aux puntatore al buffer ausiliario (NULL per associare solo len)
+ * @param len lunghezza da associare (diversa da 0 e da 0xffffffff)
+ *
+ * @return 1 se l'associazione e' avvenuta (aux appartiene al buffer)
+ *         0 se un altro thread ha gia' associato qualcosa (aux resta al chiamante)
+ */
+int bufSetAux(char *buf, char *aux, unsigned int len);
+
+/**
+ * @function bufFree
+ * @brief    rilascia un riferimento ad un buffer e, se era l'ultimo,
+ *             lo restituisce alla cache del thread
+ *
+ * @param buf puntatore al buffer (NULL non fa niente)
+ */
+void bufFree(char *buf);
+
+/**
+ * @function freeBufPool
+ * @brief    libera i buffer del pool condiviso e della cache del thread
+ *             chiamante (le cache degli altri thread tornano al pool
+ *             condiviso alla loro terminazione)
+ */
+void freeBufPool(void);
+
+#endif /* BUFPOOL_H_ */
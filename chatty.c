@@ -30,6 +30,11 @@
 #include <sys/wait.h>
 #include <sys/un.h>
 #include <sys/time.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+#include <poll.h>
 #include <fcntl.h>
 #include <pthread.h>
 
@@ -42,26 +47,102 @@
 #include <groups.h>
 #include <message.h>
 #include <connections.h>
+#include <conn.h>
+#include <uring.h>
+#include <numa.h>
+#include <bufpool.h>
+#include <names.h>
 
 /**
  * @struct thArgs_t
  * @brief  parametri per i thread del pool e per il listener
  * 
- * @var q     puntatore alla coda
- * @var pipe  array di due posizioni per la pipe di ritorno
+ * @var q     puntatore alle code locali dei worker
+ * @var id    indice del listener o del worker (all'interno del suo pool)
  * @var table tabella per gli utenti
+ * @var file  1 se il worker appartiene al pool dei trasferimenti di file
  */
 typedef struct {
-	queue_t *q;
-	int     *pipe;
-	hash_t   table;
+	wsqueue_t *q;
+	int        id;
+	hash_t     table;
+	int        file;
 } thArgs_t;
 
+/**
+ * @struct pool_t
+ * @brief  stato dei thread worker: il pool generale cresce da ThreadsInPool
+ *           a MaxThreadsInPool in base al carico e si riduce quando
+ *           i worker in piu' restano inattivi
+ * 
+ * @var mutex    lock per lo stato del pool
+ * @var done     segnalata quando termina l'ultimo worker
+ * @var live     worker in vita (di entrambi i pool)
+ * @var active   worker attivi del pool generale (indici 0..active-1)
+ * @var stopping 1 se e' iniziata la terminazione (il pool non cambia piu')
+ * @var grown    istante (in microsecondi) dell'ultima crescita
+ * @var args     parametri dei worker: prima il pool generale, poi quello dei file
+ */
+typedef struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t  done;
+	int             live;
+	int             active;
+	int             stopping;
+	uint64_t        grown;
+	thArgs_t       *args;
+} pool_t;
+
+/**
+ * @struct batch_t
+ * @brief  client pronti raccolti dal listener in un giro del ciclo di ascolto,
+ *           passati ai worker con un solo inserimento per ogni coda
+ * 
+ * @var n  numero di client raccolti
+ * @var fd fd dei client
+ */
+typedef struct {
+	int n;
+	int fd[MAX_EVENTS];
+} batch_t;
+
+/**
+ * @struct wstats_t
+ * @brief  misure di un worker, scritte solo dal worker e lette
+ *           alla stampa delle statistiche (allineate e in linee di cache
+ *           intere, per non condividerle con un altro worker)
+ * 
+ * @var maxlen  massimo di client in coda al worker osservato ad un'estrazione
+ * @var wait    attesa in coda di ogni turno, per operazione della prima richiesta
+ * @var service durata di ogni richiesta, per operazione
+ */
+typedef struct {
+	size_t      maxlen;
+	histogram_t wait[STATS_OPS];
+	histogram_t service[STATS_OPS];
+	char        pad[CACHE_LINE - (sizeof(size_t) + 2 * STATS_OPS * sizeof(histogram_t)) % CACHE_LINE];
+} wstats_t;
+
 // variabili globali
-static volatile sig_atomic_t stop  = 0; // flag di interruzione
-static volatile sig_atomic_t stats = 0; // flag di stampa statistiche
-config                       conf;      // definita in config.h
-static int                   notused;
+static int    fd_signal;  // signalfd dei segnali gestiti (letto dal listener 0)
+static int    fd_stop;    // eventfd di terminazione, presente in ogni listener
+static int   *epolls;     // insiemi epoll dei listener (condivisi con i worker)
+static wsqueue_t *fileq = NULL; // code del pool dei trasferimenti di file (NULL se disabilitato)
+static pool_t pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0, 0, 0, NULL };
+static wstats_t *wstats;  // misure dei worker, con gli stessi indici di pool.args
+config        conf;       // definita in config.h
+static int    notused;
+static cpu_set_t listenerCpus; // CPU dei listener (vuoto se non vincolati)
+static cpu_set_t workerCpus;   // CPU dei worker (vuoto se non vincolati)
+
+#if defined(USE_IO_URING)
+#define ACCEPT_TAG ((uint64_t)-1)   // user_data dei completamenti di accept
+#define SIGNAL_TAG ((uint64_t)-2)   // user_data dei completamenti sul signalfd
+#define STOP_TAG   ((uint64_t)-3)   // user_data dei completamenti sull'eventfd di terminazione
+#define LINGER_TAG ((uint64_t)-4)   // user_data dei completamenti sul timerfd delle notifiche ritardate
+#define WRITE_BIT  ((uint64_t)1 << 32) // user_data degli invii, in OR con il fd
+static uring_t *rings = NULL; // anelli io_uring, uno per listener (NULL se uso epoll)
+#endif
 
 // parametri di configurazione
 unsigned int MaxUsers;
@@ -83,225 +164,1004 @@ static void usage(const char *progname) {
 }
 
 /**
- * @function updateMax
- * @brief    trova il massimo file descriptor nel set
+ * @function epollOf
+ * @brief    restituisce l'insieme epoll del listener che possiede un client,
+ *             le connessioni sono distribuite tra i listener in base al fd
  * 
- * @param set   l'insieme di fd
- * @param fdmax il massimo fd corrente
+ * @param fd il fd del client
  * 
- * @return il nuovo massimo nel set
+ * @return il fd dell'insieme epoll che contiene il client
  */
-static int updateMax(fd_set set, int fdmax) {
-	for (int i = (fdmax-1); i >= 0; --i)
-		if (FD_ISSET(i, &set))
-			return i;
-	return -1;
+static inline int epollOf(int fd) {
+	return epolls[fd % conf.ListenerThreads];
 }
 
 /**
- * @function signalHandler
- * @brief    thread per la gestione di segnali
- * 
- * @param arg puntatore al parametro (insieme di segnali da "ascoltare")
+ * @function printQueueStats
+ * @brief    stampa lo stato delle code dei worker e, per ogni operazione,
+ *             i percentili dell'attesa in coda e della durata del servizio:
+ *             attese lunghe con servizi brevi indicano pochi worker
  * 
- * @return valore di terminazione della funzione
+ * @param q    puntatore alle code locali dei worker
+ * @param fout descrittore del file aperto in scrittura
  */
-static void *sigHandler(void *arg) {
-	sigset_t set = *(sigset_t*)arg;
-	int r, sig;
-	while (1) {
-		r = sigwait(&set, &sig);
-		if (r != 0) {
-			errno = r;
-			perror("sigwait");
-			return NULL;
+static void printQueueStats(wsqueue_t *q, FILE *fout) {
+	int         nargs = conf.MaxThreadsInPool + conf.FileThreads;
+	size_t      len = 0, maxlen = 0;
+	histogram_t wait, service;
+
+	for (int i = 0; i < (int)conf.MaxThreadsInPool; ++i)
+		len += wsLength(q, i);
+	for (int i = 0; i < (int)conf.FileThreads; ++i)
+		len += wsLength(fileq, i);
+	for (int i = 0; i < nargs; ++i) {
+		size_t m = __atomic_load_n(&wstats[i].maxlen, __ATOMIC_RELAXED);
+		if (m > maxlen)
+			maxlen = m;
+	}
+	fprintf(fout, "# coda %zu max %zu worker %d/%u\n", len, maxlen,
+		__atomic_load_n(&pool.active, __ATOMIC_RELAXED), conf.MaxThreadsInPool);
+
+	for (int op = 0; op < STATS_OPS; ++op) {
+		memset(&wait, 0, sizeof(histogram_t));
+		memset(&service, 0, sizeof(histogram_t));
+		for (int i = 0; i < nargs; ++i) {
+			histMerge(&wait, &wstats[i].wait[op]);
+			histMerge(&service, &wstats[i].service[op]);
 		}
-		if (sig == SIGINT || sig == SIGTERM || sig == SIGQUIT)
-			stop = 1;
-		else if (sig == SIGUSR1)
-			stats = 1;
+		printHist(fout, op, "attesa", &wait);
+		printHist(fout, op, "servizio", &service);
 	}
-	return NULL; // mai raggiunto
 }
 
 /**
- * @function listener
- * @brief    thread che attende connessioni da parte di utenti
+ * @function handleSignals
+ * @brief    consuma i segnali arrivati sul signalfd: stampa le statistiche
+ *             e, se richiesto, notifica la terminazione a tutti i listener
  * 
- * @param args puntatore al parametro (struttura thArgs_t)
+ * @param q puntatore alle code locali dei worker
  * 
- * @return valore di terminazione della funzione
+ * @return 1 se il server deve terminare
+ *         0 altrimenti
  */
-static void *listener(void *args) {
-	queue_t *q        = ((thArgs_t*)args) -> q;
-	int      readpipe = ((thArgs_t*)args) -> pipe[0];
-	int      fd_sock;
-	struct sockaddr_un addr;
+static int handleSignals(wsqueue_t *q) {
+	struct signalfd_siginfo info;
+	uint64_t one = 1;
 	FILE *stats_file;
 
-	// preparazione socket
-	SYSCALL(fd_sock, socket(AF_UNIX, SOCK_STREAM, 0), "socket");
-	addr.sun_family = AF_UNIX;
-	strcpy(addr.sun_path, UnixPath);
-	SYSCALL(notused, bind(fd_sock, (struct sockaddr *)&addr, sizeof(addr)), "bind");
-	SYSCALL(notused, listen(fd_sock, conf.MaxConnections), "listen");
-	
-	// creazione insieme di file descriptor
-	fd_set set, rdset;
-	int fd_client, fd_max;
-	FD_ZERO(&set);
-	FD_SET(readpipe, &set);
-	FD_SET(fd_sock, &set);
-	fd_max = fd_sock; // i file descriptor sono assegnati in ordine crescente
-
-	// ciclo di ascolto
-	struct timeval t, t_tmp; // timer per la select
-	t.tv_sec  = 0;
-    t.tv_usec = 50000; // 50 ms
-	while (1) {
-		rdset = set;
-		t_tmp = t;
-		SYSCALL(notused, select(fd_max + 1, &rdset, NULL, NULL, &t_tmp), "select");
-		if (stop) // devo terminare
-			break;
-		if (stats) { // stampa statistiche
+	// il signalfd e' non bloccante: leggo tutti i segnali pendenti
+	while (read(fd_signal, &info, sizeof(info)) == sizeof(info)) {
+		if (info.ssi_signo == SIGINT || info.ssi_signo == SIGTERM || info.ssi_signo == SIGQUIT) {
+			// sveglio gli altri listener (l'eventfd non viene mai letto)
+			SYSCALL(notused, write(fd_stop, &one, sizeof(one)), "write");
+			return 1;
+		}
+		if (info.ssi_signo == SIGUSR1) { // stampa statistiche
 			stats_file = fopen(StatFileName, "w");
 			if (!stats_file)
 				exit(EXIT_FAILURE);
+			printQueueStats(q, stats_file); // come commenti, prima della riga delle statistiche
 			printStats(stats_file);
 			fclose(stats_file);
-			stats = 0;
 		}
-		for (int fd = 0; fd <= fd_max; ++fd) {
-			if (FD_ISSET(fd, &rdset)) {
-				if (fd == readpipe) { // un worker ha terminato
-					int *buf;
-					MALLOC(buf, malloc(sizeof(int)), "buf listener");
-					SYSCALL(notused, readn(readpipe, buf, sizeof(int)), "readn");
-					FD_SET(*buf, &set);
-					if (*buf > fd_max)
-						fd_max = *buf;
-					free(buf);
+	}
+	return 0;
+}
+
+#if defined(USE_IO_URING)
+/**
+ * @function takeSqe
+ * @brief    acquisisce la lock dell'anello e riserva una sqe,
+ *             svuotando la coda di sottomissione se e' piena
+ * 
+ * @param r puntatore all'anello
+ * 
+ * @return il puntatore alla sqe (con r->mutex acquisita)
+ */
+static struct io_uring_sqe *takeSqe(uring_t *r) {
+	struct io_uring_sqe *sqe;
+	pthread_mutex_lock(&r->mutex);
+	while ((sqe = getSqe(r)) == NULL) { // coda di sottomissione piena, la svuoto
+		pthread_mutex_unlock(&r->mutex);
+		if (submitUring(r, 0, 0) == -1 && errno != EBUSY && errno != EAGAIN) {
+			perror("io_uring_enter");
+			exit(errno);
+		}
+		pthread_mutex_lock(&r->mutex);
+	}
+	return sqe;
+}
+
+/**
+ * @function releaseSqe
+ * @brief    rilascia la lock dell'anello e, se richiesto, sottomette subito
+ * 
+ * @param r     puntatore all'anello
+ * @param defer 1 se la sottomissione puo' essere rimandata alla prossima
+ *                attesa del listener (solo se il chiamante e' il proprietario)
+ */
+static void releaseSqe(uring_t *r, int defer) {
+	pthread_mutex_unlock(&r->mutex);
+	if (!defer && submitUring(r, 0, 0) == -1 && errno != EBUSY && errno != EAGAIN) {
+		perror("io_uring_enter");
+		exit(errno);
+	}
+}
+
+/**
+ * @function armRecv
+ * @brief    accoda sull'anello del listener proprietario una ricezione
+ *             nello spazio libero del buffer della connessione
+ * 
+ * @param c     puntatore alla connessione (con c->mutex acquisita)
+ * @param defer 1 se la sottomissione puo' essere rimandata
+ */
+static void armRecv(conn_t *c, int defer) {
+	uring_t *r = &rings[c->fd % conf.ListenerThreads];
+	struct io_uring_sqe *sqe;
+	size_t avail;
+	char  *space = readerSpace(&c->rd, &avail);
+
+	sqe = takeSqe(r);
+	sqe->opcode    = IORING_OP_RECV;
+	sqe->fd        = c->fd;
+	sqe->addr      = (unsigned long)space;
+	sqe->len       = avail;
+	sqe->user_data = c->fd;
+	releaseSqe(r, defer);
+}
+
+/**
+ * @function armSend
+ * @brief    accoda sull'anello del listener proprietario l'invio raggruppato
+ *             dei messaggi in attesa sulla connessione
+ * 
+ * @param c     puntatore alla connessione (con c->mutex acquisita)
+ * @param defer 1 se la sottomissione puo' essere rimandata
+ */
+static void armSend(conn_t *c, int defer) {
+	uring_t *r = &rings[c->fd % conf.ListenerThreads];
+	struct io_uring_sqe *sqe;
+
+	// i blocchi restano validi fino al completamento: i messaggi vengono solo accodati
+	memset(&c->wmsg, 0, sizeof(c->wmsg));
+	c->wmsg.msg_iov    = c->wiov;
+	c->wmsg.msg_iovlen = gatherOut(c, c->wiov, IOV_BATCH);
+
+	sqe = takeSqe(r);
+	sqe->opcode    = IORING_OP_SENDMSG;
+	sqe->fd        = c->fd;
+	sqe->addr      = (unsigned long)&c->wmsg;
+	sqe->len       = 1;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = c->fd | WRITE_BIT;
+	releaseSqe(r, defer);
+}
+
+/**
+ * @function armAccept
+ * @brief    accoda sull'anello del listener 0 un'accept sul socket
+ * 
+ * @param fd_sock il socket del server
+ *
+ * @return 1 se l'accept e' stata accodata
+ *         0 se l'anello e' pieno (riprovo al prossimo giro)
+ */
+static int armAccept(int fd_sock) {
+	struct io_uring_sqe *sqe;
+	pthread_mutex_lock(&rings[0].mutex);
+	if ((sqe = getSqe(&rings[0])) != NULL) {
+		sqe->opcode    = IORING_OP_ACCEPT;
+		sqe->fd        = fd_sock;
+		sqe->user_data = ACCEPT_TAG;
+	}
+	pthread_mutex_unlock(&rings[0].mutex);
+	return sqe != NULL;
+}
+
+/**
+ * @function armPoll
+ * @brief    accoda sull'anello di un listener l'attesa di leggibilita' di un fd
+ *             (usata per il signalfd e per l'eventfd di terminazione)
+ * 
+ * @param r   puntatore all'anello
+ * @param fd  il fd da attendere
+ * @param tag user_data del completamento
+ */
+static void armPoll(uring_t *r, int fd, uint64_t tag) {
+	struct io_uring_sqe *sqe;
+	pthread_mutex_lock(&r->mutex);
+	if ((sqe = getSqe(r)) == NULL) {
+		fprintf(stderr, "ERROR: coda di sottomissione piena\n");
+		exit(EXIT_FAILURE);
+	}
+	sqe->opcode        = IORING_OP_POLL_ADD;
+	sqe->fd            = fd;
+	sqe->poll32_events = POLLIN;
+	sqe->user_data     = tag;
+	pthread_mutex_unlock(&r->mutex);
+}
+
+#endif
+
+/**
+ * @function armConn
+ * @brief    attende nel backend del listener proprietario cio' di cui
+ *             la connessione ha bisogno: le richieste se la ricezione
+ *             appartiene al listener, la scrittura se ci sono messaggi
+ *             in attesa (chiamata con c->mutex acquisita)
+ * 
+ * @param c     puntatore alla connessione
+ * @param defer 1 se la sottomissione puo' essere rimandata (solo io_uring)
+ */
+static void armConn(conn_t *c, int defer) {
+	struct epoll_event ev;
+#if defined(USE_IO_URING)
+	if (rings) {
+		if (c->reading && !c->rarmed) {
+			c->rarmed = 1;
+			c->inflight++;
+			armRecv(c, defer);
+		}
+		if (c->outq && !c->wbusy && !c->closed) {
+			c->wbusy = 1;
+			c->inflight++;
+			armSend(c, defer);
+		}
+		return;
+	}
+#endif
+	memset(&ev, 0, sizeof(ev));
+	ev.events = (c->reading ? EPOLLIN : 0) | (c->outq && !c->closed ? EPOLLOUT : 0);
+	if (ev.events == 0) // resta disarmato, altrimenti EPOLLHUP verrebbe notificato comunque
+		return;
+	ev.events |= EPOLLONESHOT | (conf.EdgeTriggered ? EPOLLET : 0);
+	ev.data.fd = c->fd;
+	SYSCALL(notused, epoll_ctl(epollOf(c->fd), EPOLL_CTL_MOD, c->fd, &ev), "epoll_ctl");
+}
+
+/**
+ * @function releaseConn
+ * @brief    libera una connessione chiusa da un worker
+ *             (dal listener proprietario, senza eventi pendenti)
+ * 
+ * @param fd il fd del client
+ */
+static void releaseConn(int fd) {
+	freeConn(fd);
+	SYSCALL(notused, close(fd), "close"); // dopo freeConn: il fd non puo' essere riusato prima
+}
+
+/**
+ * @function nowUsec
+ * @brief    restituisce l'istante corrente
+ * 
+ * @return i microsecondi trascorsi da un istante fissato
+ */
+static uint64_t nowUsec(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @function route
+ * @brief    sceglie il worker nella cui coda locale passa un client
+ * 
+ * @param fd il fd del client
+ * 
+ * @return l'indice (modulo ThreadsInPool) del worker
+ */
+static int route(int fd) {
+	conn_t *c = getConn(fd);
+	int     home;
+	// home e' scritto dal worker che serve il client mentre il listener instrada
+	if (conf.Affinity == AFFINITY_USER && c && (home = __atomic_load_n(&c->home, __ATOMIC_RELAXED)) >= 0) // nickname gia' noto
+		return home;
+	return fd;
+}
+
+/**
+ * @function laneOf
+ * @brief    sceglie la corsia di priorita' di un client in base alla
+ *             prima richiesta in attesa, perche' i trasferimenti di file
+ *             non ritardino i messaggi e le operazioni di controllo
+ * 
+ * @param c puntatore alla connessione (con le richieste estratte)
+ * 
+ * @return LANE_CONTROL, LANE_TEXT o LANE_BULK
+ */
+static int laneOf(conn_t *c) {
+	if (c->count == 0) // disconnessione
+		return LANE_CONTROL;
+	switch (c->frames[c->head].msg.hdr.op) {
+	case POSTTXT_OP:
+	case POSTTXTALL_OP:
+	case POSTBATCH_OP:
+	case GETPREVMSGS_OP:
+		return LANE_TEXT;
+	case POSTFILE_OP:
+	case GETFILE_OP:
+		return LANE_BULK;
+	default:
+		return LANE_CONTROL;
+	}
+}
+
+/**
+ * @function poolOf
+ * @brief    sceglie il pool che serve una corsia: i trasferimenti di file
+ *             passano al pool dedicato, se presente
+ * 
+ * @param q    puntatore alle code locali dei worker
+ * @param lane corsia di priorita'
+ * 
+ * @return le code del pool
+ */
+static wsqueue_t *poolOf(wsqueue_t *q, int lane) {
+	return (lane == LANE_BULK && fileq) ? fileq : q;
+}
+
+/**
+ * @function dispatch
+ * @brief    passa ai worker un client con richieste complete (o disconnesso),
+ *             sempre nella coda locale dello stesso worker, che ne ha
+ *             lo stato in cache (se e' occupato e non c'e' affinita',
+ *             un altro worker lo ruba), nella corsia e nel pool
+ *             della prima richiesta
+ * 
+ * @param q  puntatore alle code locali dei worker
+ * @param fd il fd del client
+ */
+static void dispatch(wsqueue_t *q, int fd) {
+	conn_t *c    = getConn(fd);
+	int     lane = laneOf(c);
+	c->queued = nowUsec(); // per misurare l'attesa in coda
+	FUNCALL(notused, wsEnqueue(poolOf(q, lane), route(fd), lane, INT_TO_ITEM(fd)), "wsEnqueue"); // il fd viaggia per valore
+}
+
+/**
+ * @function flushBatch
+ * @brief    passa ai worker i client raccolti dal listener, inserendo
+ *             insieme quelli destinati alla stessa coda
+ * 
+ * @param q puntatore alle code locali dei worker
+ * @param b puntatore ai client raccolti
+ */
+static void flushBatch(wsqueue_t *q, batch_t *b) {
+	wsqueue_t *pool[MAX_EVENTS];
+	int        target[MAX_EVENTS], lane[MAX_EVENTS], k;
+	void      *items[MAX_EVENTS];
+	uint64_t   now = nowUsec();
+
+	for (int i = 0; i < b->n; ++i) { // instradamento di ogni client
+		conn_t *c = getConn(b->fd[i]);
+		lane[i]   = laneOf(c);
+		pool[i]   = poolOf(q, lane[i]);
+		target[i] = wsTarget(pool[i], route(b->fd[i]));
+		c->queued = now;
+	}
+	for (int i = 0; i < b->n; ++i) {
+		if (!pool[i]) // gia' inserito con un client precedente
+			continue;
+		items[0] = INT_TO_ITEM(b->fd[i]);
+		k = 1;
+		for (int j = i + 1; j < b->n; ++j) // raccolgo i successivi con la stessa coda
+			if (pool[j] == pool[i] && target[j] == target[i] && lane[j] == lane[i]) {
+				items[k++] = INT_TO_ITEM(b->fd[j]);
+				pool[j]    = NULL;
+			}
+		FUNCALL(notused, wsEnqueueBatch(pool[i], target[i], lane[i], items, k), "wsEnqueueBatch");
+	}
+	b->n = 0;
+}
+
+/**
+ * @function stage
+ * @brief    raccoglie un client con richieste complete (o disconnesso),
+ *             passato ai worker alla fine del giro del ciclo di ascolto
+ * 
+ * @param q  puntatore alle code locali dei worker
+ * @param b  puntatore ai client raccolti
+ * @param fd il fd del client
+ */
+static void stage(wsqueue_t *q, batch_t *b, int fd) {
+	b->fd[b->n++] = fd;
+	if (b->n == MAX_EVENTS)
+		flushBatch(q, b);
+}
+
+#if defined(USE_IO_URING)
+/**
+ * @function uringLoop
+ * @brief    ciclo di ascolto del listener con il backend io_uring:
+ *             accept e ricezioni vengono sottomesse in blocco ad ogni attesa,
+ *             ai worker passano solo i client con richieste complete
+ * 
+ * @param q       puntatore alle code locali dei worker
+ * @param id      indice del listener
+ * @param fd_sock il socket del server (solo per il listener 0)
+ */
+static void uringLoop(wsqueue_t *q, int id, int fd_sock) {
+	uring_t *r = &rings[id];
+	struct io_uring_cqe *cqe;
+	int accepts = 0; // accept in attesa di completamento
+	int running = 1;
+	batch_t b;       // client pronti nel giro corrente
+	b.n = 0;
+
+	// il listener 0 attende i segnali, gli altri la notifica di terminazione
+	if (id == 0)
+		armPoll(r, fd_signal, SIGNAL_TAG);
+	else
+		armPoll(r, fd_stop, STOP_TAG);
+	if (lingerFd(id) != -1)
+		armPoll(r, lingerFd(id), LINGER_TAG);
+
+	while (running) {
+		// mantengo URING_ACCEPTS accept pendenti, per accettare connessioni a raffica
+		// (conto solo quelle accodate: con l'anello pieno riprovo al prossimo giro)
+		while (id == 0 && accepts < URING_ACCEPTS && armAccept(fd_sock))
+			accepts++;
+
+		// sottometto tutto quello che e' stato accodato e attendo senza timeout
+		if (submitUring(r, 1, -1) == -1 && errno != EINTR && errno != EBUSY) {
+			perror("io_uring_enter");
+			exit(errno);
+		}
+
+		while (running && (cqe = peekCqe(r)) != NULL) {
+			uint64_t tag = cqe->user_data;
+			int      res = cqe->res;
+			seenCqe(r);
+
+			if (tag == STOP_TAG) // devo terminare
+				running = 0;
+			else if (tag == SIGNAL_TAG) { // segnale ricevuto
+				if (handleSignals(q))
+					running = 0;
+				else
+					armPoll(r, fd_signal, SIGNAL_TAG);
+			}
+			else if (tag == LINGER_TAG) { // notifiche ritardate da inviare
+				flushLinger(id);
+				armPoll(r, lingerFd(id), LINGER_TAG);
+			}
+			else if (tag == ACCEPT_TAG) { // tentativo di connessione al server
+				accepts--;
+				if (res >= 0) {
+					conn_t *c = newConn(res);
+					pthread_mutex_lock(&c->mutex);
+					armConn(c, (res % conf.ListenerThreads) == id);
+					pthread_mutex_unlock(&c->mutex);
 				}
-				else if (fd == fd_sock) { // tentativo di connessione al server
-					SYSCALL(fd_client, accept(fd_sock, NULL, 0), "accept");
-					FD_SET(fd_client, &set);
-					if (fd_client > fd_max)
-						fd_max = fd_client;
+				else if (res != -EAGAIN && res != -EINTR && res != -ECONNABORTED) {
+					errno = -res;
+					perror("accept");
+					exit(errno);
 				}
-				else { // un client ha scritto
-					int *tmp;
-					MALLOC(tmp, malloc(sizeof(int)), "tmp listener");
-					*tmp = fd;
-					FUNCALL(notused, enqueue(q, tmp), "enqueue");
-					FD_CLR(fd, &set); // non lo "ascolto" fino a quando un worker non soddisfa la sua richiesta
-					if (fd == fd_max)
-						fd_max = updateMax(set, fd_max);
+			}
+			else if (tag & WRITE_BIT) { // invio completato (anche in parte)
+				conn_t *c = getConn((int)(tag & ~WRITE_BIT));
+				pthread_mutex_lock(&c->mutex);
+				c->wbusy = 0;
+				c->inflight--;
+				if (res > 0 && !c->closed)
+					consumeOut(c, res);
+				else // connessione interrotta o chiusa da un worker durante l'invio
+					dropOut(c);
+				if (c->closed && c->inflight == 0) {
+					pthread_mutex_unlock(&c->mutex);
+					releaseConn(c->fd);
+					continue;
+				}
+				armConn(c, 1); // invio il resto
+				pthread_mutex_unlock(&c->mutex);
+			}
+			else { // un client ha scritto (o si e' disconnesso)
+				conn_t *c = getConn((int)tag);
+				pthread_mutex_lock(&c->mutex);
+				c->rarmed = 0;
+				c->inflight--;
+				if (c->closed) { // chiusa da un worker: la libero dopo l'ultimo completamento
+					int last = c->inflight == 0;
+					pthread_mutex_unlock(&c->mutex);
+					if (last)
+						releaseConn((int)tag);
+					continue;
+				}
+				c->reading = 0; // la ricezione e' del listener fino al riarmo
+				pthread_mutex_unlock(&c->mutex);
+
+				if (res > 0)
+					readerCommit(&c->rd, res);
+				else // errori e chiusura vengono gestiti dal worker
+					c->eof = 1;
+
+				if (fillFrames(c) > 0 || c->eof) // richiesta completa
+					stage(q, &b, (int)tag);
+				else { // richiesta incompleta, continuo a ricevere
+					pthread_mutex_lock(&c->mutex);
+					c->reading = 1;
+					armConn(c, 1);
+					pthread_mutex_unlock(&c->mutex);
 				}
 			}
 		}
+		flushBatch(q, &b); // passo ai worker tutti i client pronti del giro
 	}
+}
+#endif
 
-	// protocollo di terminazione
-	for (int i = 0; i < conf.ThreadsInPool; ++i)
-		FUNCALL(notused, enqueue(q, END), "enqueue");
-	close(fd_sock);
+/**
+ * @function receive
+ * @brief    legge senza bloccarsi i byte disponibili di un client
+ *             ed estrae le richieste complete
+ * 
+ * @param c puntatore alla connessione
+ * 
+ * @return 1 se il client va passato ai worker (richieste complete o disconnessione)
+ *         0 se la richiesta e' incompleta e il client va riarmato
+ */
+static int receive(conn_t *c) {
+	int full; // il buffer e' stato riempito, nel socket potrebbero esserci altri byte
+
+	do {
+		if (readAvailable(c->fd, &c->rd) <= 0) // errori e chiusura vengono gestiti dal worker
+			c->eof = 1;
+		full = !c->eof && c->rd.len == c->rd.size;
+	} while (fillFrames(c) < MAX_FRAMES && full);
+	return c->count > 0 || c->eof;
+}
+
+/**
+ * @function epollLoop
+ * @brief    ciclo di ascolto del listener con il backend epoll,
+ *             ai worker passano solo i client con richieste complete
+ *             e il listener invia i messaggi rimasti in attesa
+ * 
+ * @param q       puntatore alle code locali dei worker
+ * @param id      indice del listener
+ * @param fd_sock il socket del server (solo per il listener 0)
+ */
+static void epollLoop(wsqueue_t *q, int id, int fd_sock) {
+	int      fd_epoll  = epolls[id];
+	int      fd_linger = lingerFd(id);
+	int      fd_client, nready;
+	int      running = 1;
+	struct epoll_event ev, events[MAX_EVENTS];
+	uint32_t trigger = conf.EdgeTriggered ? EPOLLET : 0; // modalita' di notifica
+	batch_t  b;  // client pronti nel giro corrente
+	b.n = 0;
+	memset(&ev, 0, sizeof(ev));
+
+	if (id == 0) { // inserimento del socket e del signalfd nell'insieme epoll
+		ev.events  = EPOLLIN | trigger;
+		ev.data.fd = fd_sock;
+		SYSCALL(notused, epoll_ctl(fd_epoll, EPOLL_CTL_ADD, fd_sock, &ev), "epoll_ctl");
+		ev.events  = EPOLLIN;
+		ev.data.fd = fd_signal;
+		SYSCALL(notused, epoll_ctl(fd_epoll, EPOLL_CTL_ADD, fd_signal, &ev), "epoll_ctl");
+	}
+	else { // gli altri listener attendono la notifica di terminazione (level-triggered)
+		ev.events  = EPOLLIN;
+		ev.data.fd = fd_stop;
+		SYSCALL(notused, epoll_ctl(fd_epoll, EPOLL_CTL_ADD, fd_stop, &ev), "epoll_ctl");
+	}
+	if (fd_linger != -1) { // scadenze delle notifiche ritardate
+		ev.events  = EPOLLIN;
+		ev.data.fd = fd_linger;
+		SYSCALL(notused, epoll_ctl(fd_epoll, EPOLL_CTL_ADD, fd_linger, &ev), "epoll_ctl");
+	}
+
+	while (running) {
+		// attendo senza timeout: segnali e terminazione arrivano come eventi
+		nready = epoll_wait(fd_epoll, events, MAX_EVENTS, -1);
+		if (nready == -1 && errno != EINTR) {
+			perror("epoll_wait");
+			exit(errno);
+		}
+		// scorro solo i fd pronti
+		for (int i = 0; running && i < nready; ++i) {
+			int fd = events[i].data.fd;
+			if (fd == fd_stop) // devo terminare
+				running = 0;
+			else if (fd == fd_signal) { // segnale ricevuto
+				if (handleSignals(q))
+					running = 0;
+			}
+			else if (fd == fd_linger) // notifiche ritardate da inviare
+				flushLinger(id);
+			else if (fd == fd_sock) { // tentativi di connessione al server
+				while ((fd_client = accept(fd_sock, NULL, 0)) != -1) {
+					newConn(fd_client);
+					// oneshot: dopo la notifica il fd resta disabilitato fino al riarmo del worker
+					ev.events  = EPOLLIN | EPOLLONESHOT | trigger;
+					ev.data.fd = fd_client;
+					SYSCALL(notused, epoll_ctl(epollOf(fd_client), EPOLL_CTL_ADD, fd_client, &ev), "epoll_ctl");
+				}
+				if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+					perror("accept");
+					exit(errno);
+				}
+			}
+			else { // evento su un client (oneshot: e' disarmato fino al prossimo armConn)
+				conn_t  *c   = getConn(fd);
+				uint32_t evs = events[i].events;
+				int      own;
+
+				pthread_mutex_lock(&c->mutex);
+				if (c->closed) { // chiusa da un worker, nessun altro evento e' pendente
+					pthread_mutex_unlock(&c->mutex);
+					releaseConn(fd);
+					continue;
+				}
+				if (c->outq) // socket scrivibile (o in errore): invio i messaggi in attesa
+					flushOut(c);
+				own = c->reading && (evs & (EPOLLIN | EPOLLHUP | EPOLLERR));
+				if (own) // la ricezione e' del listener fino al riarmo
+					c->reading = 0;
+				pthread_mutex_unlock(&c->mutex);
+
+				if (own && receive(c)) // richiesta completa (non lo "ascolto" fino al riarmo)
+					stage(q, &b, fd);
+				else { // richiesta incompleta o messaggi ancora in attesa
+					pthread_mutex_lock(&c->mutex);
+					if (own)
+						c->reading = 1;
+					armConn(c, 1);
+					pthread_mutex_unlock(&c->mutex);
+				}
+			}
+		}
+		flushBatch(q, &b); // passo ai worker tutti i client pronti del giro
+	}
+}
+
+static void *worker(void *args); // definita piu' avanti, avviata dalle funzioni del pool
+
+/**
+ * @function startWorker
+ * @brief    avvia un thread worker (con pool.mutex acquisita)
+ * 
+ * @param a puntatore ai parametri del worker
+ */
+static void startWorker(thArgs_t *a) {
+	pthread_t      tid;
+	pthread_attr_t attr;
+	LIBCALL(notused, pthread_attr_init(&attr), "pthread_attr_init");
+	LIBCALL(notused, pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED), "pthread_attr_setdetachstate");
+	LIBCALL(notused, pinAttr(&attr, &workerCpus, a - pool.args), "pthread_attr_setaffinity_np"); // stesso indice, stessa CPU
+	LIBCALL(notused, pthread_create(&tid, &attr, worker, a), "pthread_create");
+	pthread_attr_destroy(&attr);
+	pool.live++;
+}
+
+/**
+ * @function growPool
+ * @brief    aggiunge un worker al pool generale, se non ha raggiunto
+ *             MaxThreadsInPool e non e' appena cresciuto
+ * 
+ * @param q puntatore alle code locali dei worker
+ */
+static void growPool(wsqueue_t *q) {
+	uint64_t now = nowUsec();
+	if (pthread_mutex_trylock(&pool.mutex) != 0) // un altro worker sta gia' decidendo
+		return;
+	if (!pool.stopping && pool.active < (int)conf.MaxThreadsInPool && now - pool.grown >= POOL_GROW_GAP * 1000) {
+		startWorker(&pool.args[pool.active]); // il nuovo worker ha l'indice successivo
+		wsResize(q, ++pool.active);
+		pool.grown = now;
+	}
+	pthread_mutex_unlock(&pool.mutex);
+}
+
+/**
+ * @function retireWorker
+ * @brief    decide se un worker inattivo deve terminare: solo l'ultimo
+ *             worker attivo, e solo oltre ThreadsInPool, cosi' gli indici
+ *             dei worker attivi restano contigui
+ * 
+ * @param q  puntatore alle code locali dei worker
+ * @param id indice del worker
+ * 
+ * @return 1 se il worker deve terminare
+ *         0 altrimenti
+ */
+static int retireWorker(wsqueue_t *q, int id) {
+	int r = 0;
+	pthread_mutex_lock(&pool.mutex);
+	if (!pool.stopping && id == pool.active - 1 && pool.active > (int)conf.ThreadsInPool) {
+		wsResize(q, --pool.active); // eventuali client gia' nella sua coda vengono rubati
+		r = 1;
+	}
+	pthread_mutex_unlock(&pool.mutex);
+	return r;
+}
+
+/**
+ * @function exitWorker
+ * @brief    registra la terminazione di un worker
+ */
+static void exitWorker(void) {
+	pthread_mutex_lock(&pool.mutex);
+	if (--pool.live == 0)
+		pthread_cond_signal(&pool.done);
+	pthread_mutex_unlock(&pool.mutex);
+}
+
+/**
+ * @function stopPool
+ * @brief    avvia la terminazione dei worker: il pool non cambia piu'
+ *             e ogni worker in vita riceve un messaggio di terminazione
+ * 
+ * @param q puntatore alle code locali dei worker
+ */
+static void stopPool(wsqueue_t *q) {
+	pthread_mutex_lock(&pool.mutex);
+	pool.stopping = 1;
+	for (int i = 0; i < pool.active; ++i)
+		FUNCALL(notused, wsEnqueue(q, i, LANE_CONTROL, END), "wsEnqueue");
+	for (int i = 0; i < conf.FileThreads; ++i)
+		FUNCALL(notused, wsEnqueue(fileq, i, LANE_BULK, END), "wsEnqueue");
+	pthread_mutex_unlock(&pool.mutex);
+}
+
+/**
+ * @function listener
+ * @brief    thread che attende richieste dai client del proprio insieme epoll
+ *             (o anello io_uring), il listener 0 accetta anche le nuove
+ *             connessioni e le distribuisce tra tutti i listener
+ * 
+ * @param args puntatore al parametro (struttura thArgs_t)
+ * 
+ * @return valore di terminazione della funzione
+ */
+static void *listener(void *args) {
+	wsqueue_t *q   = ((thArgs_t*)args) -> q;
+	int        id  = ((thArgs_t*)args) -> id;
+	int      fd_sock = -1, sock_flags = SOCK_NONBLOCK;
+	struct sockaddr_un addr;
+
+#if defined(USE_IO_URING)
+	if (rings)
+		sock_flags = 0; // con io_uring l'accept e' asincrona, il socket resta bloccante
+#endif
+
+	if (id == 0) {
+		// preparazione socket (non bloccante, per poter svuotare la coda di accept)
+		SYSCALL(fd_sock, socket(AF_UNIX, SOCK_STREAM | sock_flags, 0), "socket");
+		addr.sun_family = AF_UNIX;
+		strcpy(addr.sun_path, UnixPath);
+		SYSCALL(notused, bind(fd_sock, (struct sockaddr *)&addr, sizeof(addr)), "bind");
+		SYSCALL(notused, listen(fd_sock, conf.MaxConnections), "listen");
+	}
+
+	// ciclo di ascolto
+#if defined(USE_IO_URING)
+	if (rings)
+		uringLoop(q, id, fd_sock);
+	else
+#endif
+	epollLoop(q, id, fd_sock);
+
+	// protocollo di terminazione (una sola volta, dal listener che accetta)
+	if (id == 0) {
+		stopPool(q);
+		close(fd_sock);
+	}
 	pthread_exit(NULL);	
 }
 
+/**
+ * @function closeClient
+ * @brief    chiude la connessione di un client, lo stato viene
+ *             liberato dal listener proprietario
+ * 
+ * @param fd il fd del client
+ */
+static void closeClient(int fd) {
+	removeOnline(fd); // da qui nessun altro thread accoda messaggi sulla connessione
+	closeConn(getConn(fd));
+}
+
+/**
+ * @function serveRequest
+ * @brief    soddisfa una richiesta completa di un client
+ * 
+ * @param users tabella degli utenti
+ * @param fd    il fd del client
+ * @param f     puntatore alla richiesta
+ * 
+ * @return 0 se la connessione e' stata chiusa (DISCONNECT_OP)
+ *         1 altrimenti
+ */
+static int serveRequest(hash_t users, int fd, frame_t *f) {
+	message_t *req = &(f->msg);
+
+	switch (req->hdr.op) { // scelgo l'operazione (operations.c)
+	case REGISTER_OP:
+		registerOp(users, fd, *req);
+		break;
+	
+	case CONNECT_OP:
+		connectOp(users, fd, *req);
+		break;
+	
+	case POSTTXT_OP:
+		postTxtOp(users, fd, *req);
+		break;
+	
+	case POSTTXTALL_OP:
+		postTxtAllOp(users, fd, *req);
+		break;
+
+	case POSTBATCH_OP:
+		postBatchOp(users, fd, *req);
+		break;
+	
+	case POSTFILE_OP:
+		postFileOp(users, fd, *req, f->file);
+		break;
+	
+	case GETFILE_OP:
+		getFileOp(users, fd, *req);
+		break;
+
+	case GETPREVMSGS_OP:
+		sendHistory(users, req->hdr.sender, fd);
+		break;
+	
+	case USRLIST_OP:
+		if (getSession(fd, req->hdr.sender) != -1) // solo ad un utente collegato
+			sendOnlineList(fd, req->hdr.sender);
+		break;
+	
+	case UNREGISTER_OP:
+		unregisterOp(users, fd, *req);
+		break;
+	
+	case DISCONNECT_OP:
+		closeClient(fd);
+		return 0; // non devo riarmarlo
+
+	case CREATEGROUP_OP:
+		createGroupOp(users, fd, *req);
+		break;
+	
+	case ADDGROUP_OP:
+		addGroupOp(users, fd, *req);
+		break;
+	
+	case DELGROUP_OP:
+		delGroupOp(users, fd, *req);
+		break;
+
+	case HELLO_OP:
+		helloOp(fd, *req);
+		break;
+	
+	default:
+		printf("SERVER - ERRORE: operazione non riconosciuta\n");
+	}
+	return 1;
+}
+
+/**
+ * @function inTurn
+ * @brief    indica se la prossima richiesta di un client puo' essere servita
+ *             nel turno corrente: non deve appartenere ad una corsia meno
+ *             prioritaria ne' ad un altro pool
+ * 
+ * @param q    puntatore alle code locali dei worker
+ * @param mine puntatore alle code del pool del worker
+ * @param c    puntatore alla connessione (con le richieste estratte)
+ * @param lane corsia del turno corrente
+ * 
+ * @return 1 se la richiesta fa parte del turno
+ *         0 altrimenti
+ */
+static int inTurn(wsqueue_t *q, wsqueue_t *mine, conn_t *c, int lane) {
+	int next = laneOf(c);
+	return next <= lane && poolOf(q, next) == mine;
+}
+
 /**
  * @function worker
  * @brief    thread del pool, soddisfa le richieste dei client
+ *             (gia' ricevute per intero dal listener)
  * 
  * @param args puntatore al parametro (struttura thArgs_t)
  * 
  * @return valore di terminazione della funzione
  */
 static void *worker(void *args) {
-	queue_t        *q         = ((thArgs_t*)args) -> q;
-	int             writepipe = ((thArgs_t*)args) -> pipe[1];
+	wsqueue_t      *q         = ((thArgs_t*)args) -> q;
+	int             id        = ((thArgs_t*)args) -> id;
 	hash_t          users     = ((thArgs_t*)args) -> table;
-	int            *fd_client, n;
-	message_t      *req;   // richiesta dal client
+	wsqueue_t      *mine      = ((thArgs_t*)args) -> file ? fileq : q; // code del proprio pool
+	int             elastic   = !((thArgs_t*)args) -> file && conf.MaxThreadsInPool > conf.ThreadsInPool;
+	void           *items[WORKER_BATCH], *item; // client estratti insieme
+	int             nitems = 0, next = 0;
+	int             fd_client, open, served, lane, op;
+	wstats_t       *st        = &wstats[(thArgs_t*)args - pool.args];
+	uint64_t        waited, start;
+	size_t          len;
+	conn_t         *c;
+	frame_t         f;     // richiesta dal client
+
+	wsBindLocal(mine, id); // le proprie corsie sul nodo del worker (solo con NumaLocal)
 	
 	while (1) {
-		fd_client = (int*)dequeue(q); // estraggo il fd del client da servire
-		if (fd_client == END) // devo terminare
+		// estraggo i fd dei client da servire (o ne rubo uno), il pool elastico
+		//   si riduce quando un worker resta inattivo per POOL_IDLE_MS
+		if (next == nitems) {
+			next   = 0;
+			nitems = wsTimedDequeue(mine, id, elastic ? POOL_IDLE_MS : -1, items, WORKER_BATCH);
+			if (nitems == 0) {
+				if (retireWorker(q, id))
+					break;
+				continue;
+			}
+			if ((len = wsLength(mine, id) + nitems) > st->maxlen) // client in coda al worker
+				__atomic_store_n(&st->maxlen, len, __ATOMIC_RELAXED);
+		}
+		item = items[next++];
+		if (item == END) { // devo terminare: restituisco gli elementi estratti insieme
+			for (; next < nitems; ++next) {
+				if (items[next] == END) {
+					FUNCALL(notused, wsEnqueue(mine, id, LANE_CONTROL, END), "wsEnqueue");
+				}
+				else
+					dispatch(q, ITEM_TO_INT(items[next]));
+			}
 			break;
+		}
+		fd_client = ITEM_TO_INT(item);
 
-		MALLOC(req, malloc(sizeof(message_t)), "req worker");
-		n = readMsg(*fd_client, req); // leggo la richiesta del client
-
-		if (n > 0) {
-			switch (req->hdr.op) { // scelgo l'operazione (operations.c)
-			case REGISTER_OP:
-				registerOp(users, *fd_client, *req);
-				break;
-			
-			case CONNECT_OP:
-				connectOp(users, *fd_client, *req);
-				break;
-			
-			case POSTTXT_OP:
-				postTxtOp(users, *fd_client, *req);
-				break;
-			
-			case POSTTXTALL_OP:
-				postTxtAllOp(users, *fd_client, *req);
-				break;
-			
-			case POSTFILE_OP:
-				postFileOp(users, *fd_client, *req);
-				break;
-			
-			case GETFILE_OP:
-				getFileOp(users, *fd_client, *req);
-				break;
-
-			case GETPREVMSGS_OP:
-				sendHistory(users, req->hdr.sender, *fd_client);
-				break;
-			
-			case USRLIST_OP:
-				sendOnlineList(req->hdr.sender);
-				break;
-			
-			case UNREGISTER_OP:
-				unregisterOp(users, *fd_client, *req);
-				break;
-			
-			case DISCONNECT_OP:
-				removeOnline(*fd_client);
-				SYSCALL(notused, close(*fd_client), "close");
-				break;
+		// servo in un solo turno tutte le richieste gia' ricevute (pipelining),
+		//   al massimo MAX_PIPELINE per non affamare gli altri client; una richiesta
+		//   di una corsia meno prioritaria o di un altro pool interrompe il turno
+		c      = getConn(fd_client);
+		lane   = laneOf(c); // corsia in cui era in coda
+		waited = nowUsec() - c->queued;
 
-			case CREATEGROUP_OP:
-				createGroupOp(users, *fd_client, *req);
-				break;
-			
-			case ADDGROUP_OP:
-				addGroupOp(users, *fd_client, *req);
-				break;
-			
-			case DELGROUP_OP:
-				delGroupOp(users, *fd_client, *req);
-				break;
-			
-			default:
-				printf("SERVER - ERRORE: operazione non riconosciuta\n");
+		// il pool cresce se i client attendono troppo o si accumulano nella coda
+		if (elastic && (waited > POOL_GROW_WAIT || wsLength(q, id) > POOL_GROW_DEPTH))
+			growPool(q);
+		open   = 1;
+		served = 0;
+		while (open && served < MAX_PIPELINE && fillFrames(c) > 0 && inTurn(q, mine, c, lane) && popFrame(c, &f)) {
+			// con affinita' per utente, dalla prima richiesta con un nickname (non la HELLO_OP)
+			//   il client resta del worker del suo nickname
+			//   (home e' letto anche dal listener, vedi route)
+			if (conf.Affinity == AFFINITY_USER && __atomic_load_n(&c->home, __ATOMIC_RELAXED) < 0 && f.msg.hdr.op != HELLO_OP)
+				__atomic_store_n(&c->home, (int)(hash(f.msg.hdr.sender) % conf.ThreadsInPool), __ATOMIC_RELAXED);
+			op    = f.msg.hdr.op;
+			start = nowUsec();
+			open  = serveRequest(users, fd_client, &f);
+			if (op >= 0 && op < STATS_OPS) {
+				if (served == 0) // l'attesa in coda e' del turno, la attribuisco alla prima richiesta
+					histAdd(&st->wait[op], waited);
+				histAdd(&st->service[op], nowUsec() - start);
 			}
-			
-			// comunico al listener che il client e' stato servito
-			SYSCALL(notused, writen(writepipe, fd_client, sizeof(int)), "writen");
+			served++;
 		}
-		else { // client disconnesso (n <= 0)
-			removeOnline(*fd_client);
-			printf("SERVER: fd %d disconnesso\n", *fd_client);
-			SYSCALL(notused, close(*fd_client), "close");
+
+		if (open) {
+			if (fillFrames(c) > 0) { // turno finito: lo rimetto in fondo alla coda della sua corsia
+				dispatch(q, fd_client);
+				continue;
+			}
+			if (c->eof) { // il client si e' disconnesso dopo l'ultima richiesta
+				printf("SERVER: fd %d disconnesso\n", fd_client);
+				closeClient(fd_client);
+			}
+			else // client servito: lo riarmo direttamente nel listener proprietario
+				watchConn(c);
 		}
-		free(req);
-		free(fd_client);
 	}
+	exitWorker();
 	pthread_exit(NULL);
 }
 
@@ -313,7 +1173,7 @@ static void *worker(void *args) {
  */
 void loadConfig(char *conf_path) {
 	FILE *conf_file = fopen(conf_path, "r");
-	char *buf;
+	char *buf, *cpus;
 	int maxSize = 128;
 	if (!conf_file) {
 		printf("SERVER - ERRORE: impossibile aprire il file %s\n", conf_path);
@@ -325,10 +1185,16 @@ void loadConfig(char *conf_path) {
 	MALLOC(UnixPath, malloc(maxSize + 1), "UnixPath loadConfig");
 	MALLOC(DirName, malloc(maxSize + 1), "DirName loadConfig");
 	MALLOC(StatFileName, malloc(maxSize + 1), "StatFileName loadConfig");
+	MALLOC(cpus, malloc(maxSize + 1), "cpus loadConfig");
+
+#if defined(USE_IO_URING)
+	conf.IoUring = 1; // se compilato, il backend io_uring e' usato di default
+#endif
 
 	// ciclo di parsing
 	while (fscanf(conf_file, "%s", buf) >= 0) {
 		if (strncmp(buf, "ThreadsInPool",  maxSize + 1) == 0 && fscanf(conf_file, "%*s %u", &conf.ThreadsInPool) > 0){} else
+		if (strncmp(buf, "MaxThreadsInPool", maxSize + 1) == 0 && fscanf(conf_file, "%*s %u", &conf.MaxThreadsInPool) > 0){} else
 		if (strncmp(buf, "MaxConnections", maxSize + 1) == 0 && fscanf(conf_file, "%*s %u", &conf.MaxConnections) > 0){} else
 		if (strncmp(buf, "MaxHistMsgs",    maxSize + 1) == 0 && fscanf(conf_file, "%*s %u", &conf.MaxHistMsgs) > 0){} else
 		if (strncmp(buf, "MaxMsgSize",     maxSize + 1) == 0 && fscanf(conf_file, "%*s %u", &conf.MaxMsgSize) > 0){} else
@@ -336,12 +1202,43 @@ void loadConfig(char *conf_path) {
 		if (strncmp(buf, "MaxUsers",       maxSize + 1) == 0 && fscanf(conf_file, "%*s %u", &MaxUsers) > 0){} else
 		if (strncmp(buf, "MaxOnlineUsers", maxSize + 1) == 0 && fscanf(conf_file, "%*s %u", &MaxOnlineUsers) > 0){} else
 		if (strncmp(buf, "MaxGroups",      maxSize + 1) == 0 && fscanf(conf_file, "%*s %u", &MaxGroups) > 0){} else
+		if (strncmp(buf, "EdgeTriggered",  maxSize + 1) == 0 && fscanf(conf_file, "%*s %u", &conf.EdgeTriggered) > 0){} else
+		if (strncmp(buf, "ListenerThreads",maxSize + 1) == 0 && fscanf(conf_file, "%*s %u", &conf.ListenerThreads) > 0){} else
+		if (strncmp(buf, "IoUring",        maxSize + 1) == 0 && fscanf(conf_file, "%*s %u", &conf.IoUring) > 0){} else
+		if (strncmp(buf, "Affinity",       maxSize + 1) == 0 && fscanf(conf_file, "%*s %u", &conf.Affinity) > 0){} else
+		if (strncmp(buf, "FileThreads",    maxSize + 1) == 0 && fscanf(conf_file, "%*s %u", &conf.FileThreads) > 0){} else
+		if (strncmp(buf, "NumaLocal",      maxSize + 1) == 0 && fscanf(conf_file, "%*s %u", &conf.NumaLocal) > 0){} else
+		if (strncmp(buf, "NotifyLinger",   maxSize + 1) == 0 && fscanf(conf_file, "%*s %u", &conf.NotifyLinger) > 0){} else
+		if (strncmp(buf, "ListenerCpus",   maxSize + 1) == 0 && fscanf(conf_file, "%*s %s", cpus) > 0) {
+			if (parseCpus(cpus, &listenerCpus) == -1 || usableCpus(&listenerCpus) == 0) {
+				printf("SERVER - ERRORE: elenco di CPU non valido o senza CPU disponibili: %s\n", cpus);
+				exit(EXIT_FAILURE);
+			}
+		} else
+		if (strncmp(buf, "WorkerCpus",     maxSize + 1) == 0 && fscanf(conf_file, "%*s %s", cpus) > 0) {
+			if (parseCpus(cpus, &workerCpus) == -1 || usableCpus(&workerCpus) == 0) {
+				printf("SERVER - ERRORE: elenco di CPU non valido o senza CPU disponibili: %s\n", cpus);
+				exit(EXIT_FAILURE);
+			}
+		} else
 		if (strncmp(buf, "UnixPath",       maxSize + 1) == 0 && fscanf(conf_file, "%*s %s", UnixPath) > 0){} else
 		if (strncmp(buf, "DirName",        maxSize + 1) == 0 && fscanf(conf_file, "%*s %s", DirName) > 0){} else
 		if (strncmp(buf, "StatFileName",   maxSize + 1) == 0 && fscanf(conf_file, "%*s %s", StatFileName) > 0){}
 	}
 	free(buf);
+	free(cpus);
 	fclose(conf_file);
+
+	// valori di default per i parametri opzionali
+	if (conf.ListenerThreads == 0)
+		conf.ListenerThreads = 1;
+	if (conf.MaxThreadsInPool < conf.ThreadsInPool || conf.Affinity != AFFINITY_NONE)
+		conf.MaxThreadsInPool = conf.ThreadsInPool; // con l'affinita' il pool non varia
+
+	if ((unsigned long)MaxUsers + MaxGroups > NAMES_MAX) { // non potrebbero essere tutti registrati
+		printf("SERVER - ERRORE: MaxUsers e MaxGroups superano il limite di %d nomi\n", NAMES_MAX);
+		exit(EXIT_FAILURE);
+	}
 }
 
 /**
@@ -373,17 +1270,63 @@ int main(int argc, char *argv[]) {
 	SYSCALL(notused, sigaddset(&sigset, SIGUSR1), "sigaddset");
 	LIBCALL(notused, pthread_sigmask(SIG_BLOCK, &sigset, NULL), "pthread_sigmask"); // maschero i segnali
 
-	// creazione sigHandler
-	pthread_t sigHandlertid;
-	LIBCALL(notused, pthread_create(&sigHandlertid, NULL, sigHandler, &sigset), "pthread_create");
+	// i segnali gestiti vengono consegnati al listener 0 come eventi (SIGPIPE resta solo mascherato)
+	SYSCALL(notused, sigdelset(&sigset, SIGPIPE), "sigdelset");
+	SYSCALL(fd_signal, signalfd(-1, &sigset, SFD_NONBLOCK | SFD_CLOEXEC), "signalfd");
+	SYSCALL(fd_stop, eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC), "eventfd");
+
+	// alzo il limite di fd aperti, per poter gestire MaxOnlineUsers connessioni
+	struct rlimit rl;
+	SYSCALL(notused, getrlimit(RLIMIT_NOFILE, &rl), "getrlimit");
+	if (rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur < MaxOnlineUsers + 64) {
+		rl.rlim_cur = (rl.rlim_max == RLIM_INFINITY || rl.rlim_max > MaxOnlineUsers + 64) ? MaxOnlineUsers + 64 : rl.rlim_max;
+		if (setrlimit(RLIMIT_NOFILE, &rl) == -1)
+			perror("setrlimit"); // posso andare avanti con il limite attuale
+	}
+	SYSCALL(notused, getrlimit(RLIMIT_NOFILE, &rl), "getrlimit"); // limite effettivo
+
+	// creazione degli insiemi epoll, uno per listener (condivisi con i worker)
+	MALLOC(epolls, malloc(conf.ListenerThreads * sizeof(int)), "epolls main");
+	for (int i = 0; i < conf.ListenerThreads; ++i)
+		SYSCALL(epolls[i], epoll_create1(EPOLL_CLOEXEC), "epoll_create1");
+
+	// creazione degli anelli io_uring, se richiesti (altrimenti uso epoll)
+#if defined(USE_IO_URING)
+	if (conf.IoUring) {
+		MALLOC(rings, malloc(conf.ListenerThreads * sizeof(uring_t)), "rings main");
+		for (int i = 0; i < conf.ListenerThreads; ++i)
+			if (initUring(&rings[i], URING_ENTRIES) == -1) {
+				perror("io_uring_setup"); // torno al backend epoll
+				for (int j = 0; j < i; ++j)
+					freeUring(&rings[j]);
+				free(rings);
+				rings = NULL;
+				break;
+			}
+	}
+#else
+	if (conf.IoUring)
+		fprintf(stderr, "SERVER: backend io_uring non compilato (make IOURING=1), uso epoll\n");
+#endif
 
-	// creazione pipe di ritorno
-	int retpipe[2];
-	SYSCALL(notused, pipe(retpipe), "pipe");
+	// posizionamento della memoria: strutture condivise sui nodi delle CPU
+	//   dei worker, quelle di ogni worker sul proprio nodo
+	if (conf.NumaLocal)
+		initNuma(&workerCpus);
 
-	// creazione coda
-	queue_t *q;
-	MALLOC(q, initQueue(), "initQueue");
+	// creazione tabella delle connessioni, indicizzata per fd
+	initConns(rl.rlim_cur, armConn);
+
+	// creazione code locali dei worker: ogni client e' in coda al piu' una volta
+	//   (oneshot), quindi basta un posto per fd piu' il messaggio di terminazione;
+	//   con l'affinita' ogni client resta del proprio worker, senza furto
+	wsqueue_t *q;
+	MALLOC(q, initWsQueue(conf.MaxThreadsInPool, rl.rlim_cur + 1, conf.Affinity == AFFINITY_NONE), "initWsQueue");
+	if (conf.FileThreads > 0) // pool dedicato ai trasferimenti di file
+		MALLOC(fileq, initWsQueue(conf.FileThreads, rl.rlim_cur + 1, conf.Affinity == AFFINITY_NONE), "initWsQueue");
+
+	// creazione tabella dei nomi (id di utenti e gruppi)
+	initNames(MaxUsers);
 
 	// creazione tabella hash
 	hash_t users;
@@ -398,42 +1341,84 @@ int main(int argc, char *argv[]) {
 	// ignoro l'errore, posso andare avanti anche se non era gia' presente nessun socket 
 	unlink(UnixPath);
 
+	// creazione thread worker (prima dei listener, che possono avviarne la terminazione),
+	//   ognuno con la propria coda locale: il pool generale parte da ThreadsInPool
+	//   worker, quello dei file ha dimensione fissa
+	int nargs = conf.MaxThreadsInPool + conf.FileThreads;
+	MALLOC(pool.args, malloc(nargs * sizeof(thArgs_t)), "pool.args main");
+	void *p;
+	LIBCALL(notused, posix_memalign(&p, CACHE_LINE, nargs * sizeof(wstats_t)), "posix_memalign wstats");
+	wstats = memset(p, 0, nargs * sizeof(wstats_t));
+	for (int i = 0; i < nargs; ++i) { // prima il pool generale, poi quello dei file
+		pool.args[i].q     = q;
+		pool.args[i].file  = i >= (int)conf.MaxThreadsInPool;
+		pool.args[i].id    = pool.args[i].file ? i - (int)conf.MaxThreadsInPool : i;
+		pool.args[i].table = users;
+	}
+	pthread_mutex_lock(&pool.mutex);
+	pool.active = conf.ThreadsInPool;
+	wsResize(q, pool.active);
+	for (int i = 0; i < (int)conf.ThreadsInPool; ++i)
+		startWorker(&pool.args[i]);
+	for (int i = 0; i < (int)conf.FileThreads; ++i)
+		startWorker(&pool.args[conf.MaxThreadsInPool + i]);
+	pthread_mutex_unlock(&pool.mutex);
+
 	// creazione thread listener
-	pthread_t listid;
-	thArgs_t  args;
-	args.q     = q;
-	args.pipe  = retpipe;
-	args.table = users;
-	LIBCALL(notused, pthread_create(&listid, NULL, listener, &args), "pthread_create");
-
-	// creazione thread worker
-	pthread_t *worktid;
-	MALLOC(worktid, malloc(conf.ThreadsInPool * sizeof(pthread_t)), "worktid main");
-	for (int i = 0; i < conf.ThreadsInPool; ++i)
-		LIBCALL(notused, pthread_create(&worktid[i], NULL, worker, &args), "pthread_create");
-	
-	// attesa thread listener
-	LIBCALL(notused, pthread_join(listid, NULL), "pthread_join");
+	pthread_t     *listid;
+	thArgs_t      *args;
+	pthread_attr_t attr;
+	MALLOC(listid, malloc(conf.ListenerThreads * sizeof(pthread_t)), "listid main");
+	MALLOC(args, malloc(conf.ListenerThreads * sizeof(thArgs_t)), "args main");
+	for (int i = 0; i < conf.ListenerThreads; ++i) {
+		args[i].q     = q;
+		args[i].id    = i;
+		args[i].table = users;
+		LIBCALL(notused, pthread_attr_init(&attr), "pthread_attr_init");
+		LIBCALL(notused, pinAttr(&attr, &listenerCpus, i), "pthread_attr_setaffinity_np");
+		LIBCALL(notused, pthread_create(&listid[i], &attr, listener, &args[i]), "pthread_create");
+		pthread_attr_destroy(&attr);
+	}
 
-	// terminazione sigHandler (sigwait e' un cancellation point)
-	LIBCALL(notused, pthread_cancel(sigHandlertid), "pthread_cancel");
-	LIBCALL(notused, pthread_join(sigHandlertid, NULL), "pthread_join");
+	// attesa thread listener
+	for (int i = 0; i < conf.ListenerThreads; ++i)
+		LIBCALL(notused, pthread_join(listid[i], NULL), "pthread_join");
 
-	// attesa thread worker
-	for (int i = 0; i < conf.ThreadsInPool; ++i)
-		LIBCALL(notused, pthread_join(worktid[i], NULL), "pthread_join");
+	// attesa thread worker (staccati, l'ultimo che termina lo segnala)
+	pthread_mutex_lock(&pool.mutex);
+	while (pool.live > 0)
+		pthread_cond_wait(&pool.done, &pool.mutex);
+	pthread_mutex_unlock(&pool.mutex);
 	
 	// cleanup
 	free(UnixPath);
 	free(DirName);
 	free(StatFileName);
-	free(worktid);
-	freeQueue(q);
+	free(listid);
+	free(args);
+	free(pool.args);
+	free(wstats);
+	freeWsQueue(q);
+	if (fileq)
+		freeWsQueue(fileq);
 	freeUsers(users);
 	freeOnline();
 	freeGroups();
-	close(retpipe[0]);
-	close(retpipe[1]);
+	freeNames(); // dopo le strutture che usano gli id
+	for (int i = 0; i < conf.ListenerThreads; ++i)
+		close(epolls[i]);
+	free(epolls);
+	close(fd_signal);
+	close(fd_stop);
+#if defined(USE_IO_URING)
+	if (rings) { // prima delle connessioni, che possono avere ricezioni pendenti
+		for (int i = 0; i < conf.ListenerThreads; ++i)
+			freeUring(&rings[i]);
+		free(rings);
+	}
+#endif
+	freeConns();
+	freeBufPool(); // dopo le connessioni, che restituiscono i propri buffer
 	printf("\nSERVER TERMINATO\n");
 	return 0;
 }
@@ -52,7 +52,7 @@ static size_t      msglen=0;
 static void use(const char * filename) {
     fprintf(stderr, 
 	    "use:\n"
-	    " %s -l unix_socket_path -k nick -c nick -[gad] group -t milli -S msg:to -s file:to -R n -h\n"
+	    " %s -l unix_socket_path -k nick -c nick -[gad] group -t milli -S msg:to -s file:to -R n -V v -B -b n -h\n"
 	    "  -l specifica il socket dove il server e' in ascolto\n"
 	    "  -k specifica il nickname del client\n"
 	    "  -c specifica il nickname che deve essere creato\n"
@@ -62,9 +62,13 @@ static void use(const char * filename) {
 	    "  -d rimuove  'nick' dal gruppo 'group'\n"
 	    "  -L richiede la lista degli utenti online\n"
 	    "  -p richiede di recuperare la history dei messaggi\n"
+	    "  -V chiede al server di usare la versione 'v' del protocollo (1: header fissi, 2: compatti,\n"
+	    "     3: compatti con i dati lunghi compressi)\n"
 	    "  -t specifica i millisecondi 'milli' che intercorrono tra la gestione di due comandi consecutivi\n"
 	    "  -S spedisce il messaggio 'msg' al destinatario 'to' che puo' essere un nickname o groupname\n"
 	    "  -s come l'opzione -S ma permette di spedire files\n"
+	    "  -B spedisce le opzioni -S consecutive dirette a un nickname o groupname con un'unica richiesta\n"
+	    "  -b come l'opzione -B, con al piu' 'n' messaggi per richiesta\n"
 	    "  -R riceve un messaggio da un nickname o groupname, se viene ricevuto un identificatore di file\n"
 	    "     il file viene scaricato dal server. In base al valore di n il comportamento e' diverso, se:\n"
 	    "      n > 0 : aspetta di ricevere 'n' messaggi e poi passa al comando successivo (se c'e')\n"
@@ -131,6 +135,48 @@ static int downloadFile(int connfd, char *filename, char *sender) {
     return -1;
 }
 
+// raccoglie le POSTTXT_OP consecutive in POSTBATCH_OP di al piu' max messaggi, ritorna il nuovo numero di operazioni
+static int makeBatches(operation_t *ops, int k, int max) {
+    char p[PACK_MAXSIZE];
+    message_data_t data;
+    int j=0;
+    for(int i=0;i<k;) {
+	int e=i;
+	while(e<k && e-i<max && ops[e].op == POSTTXT_OP) ++e;
+	if (e-i < 2) { // niente da raccogliere
+	    ops[j++] = ops[i++];
+	    continue;
+	}
+	// ogni messaggio e' preceduto dal suo header dati
+	long size=0;
+	for(int l=i;l<e;++l) {
+	    setData(&data, ops[l].rname, NULL, ops[l].size);
+	    size += packDataHdr(p, &data.hdr, BATCH_PROTO) + ops[l].size;
+	}
+	char *buf = malloc(size);
+	if (!buf) {
+	    perror("malloc");
+	    return -1;
+	}
+	for(long l=i, off=0; l<e; ++l) {
+	    setData(&data, ops[l].rname, NULL, ops[l].size);
+	    off += packDataHdr(buf+off, &data.hdr, BATCH_PROTO);
+	    memcpy(buf+off, ops[l].msg, ops[l].size);
+	    off += ops[l].size;
+	    free(ops[l].msg);
+	}
+	ops[j] = ops[i];
+	ops[j].rname = NULL;
+	ops[j].op    = POSTBATCH_OP;
+	ops[j].msg   = buf;
+	ops[j].size  = size;
+	ops[j].n     = e-i; // numero di messaggi del lotto
+	++j;
+	i=e;
+    }
+    return j;
+}
+
 // gestisce operazioni di tipo richiesta-risposta
 static int execute_requestreply(int connfd, operation_t *o) {
     char *sname = o->sname;
@@ -142,7 +188,7 @@ static int execute_requestreply(int connfd, operation_t *o) {
     //setData(&msg.data, "", NULL, 0);
     setData(&msg.data, rname, NULL, 0);
     setHeader(&msg.hdr, op, sname);
-    if (op == POSTTXT_OP || op == POSTTXTALL_OP || op == POSTFILE_OP) {
+    if (op == POSTTXT_OP || op == POSTTXTALL_OP || op == POSTFILE_OP || op == POSTBATCH_OP) {
 	if (o->size == 0) {
 	    fprintf(stderr, "ERRORE: size non valida per l'operazione di POST\n");
 	    return -1;
@@ -269,6 +315,24 @@ static int execute_requestreply(int connfd, operation_t *o) {
 	    printf("[Il file '%s' e' stato scaricato correttamente]\n",FILENAMES[i]);
 	}
     } break;
+    case POSTBATCH_OP: { // ... ricevere l'esito di ogni messaggio del lotto
+	if (readData(connfd, &msg.data) <= 0) {
+	    perror("reply data");
+	    return -1; 
+	}	
+	if (msg.data.hdr.len != o->n) {
+	    fprintf(stderr, "ERRORE: risposta non valida\n");
+	    return -1;
+	}
+	int r = 0;
+	for(long i=0;i<o->n;++i) 
+	    if (msg.data.buf[i] != OP_OK) {
+		fprintf(stderr, "Messaggio %ld del lotto FALLITO\n", i);
+		if (r == 0) r = -msg.data.buf[i]; // codice di errore del primo messaggio fallito
+	    }
+	free(msg.data.buf);
+	return r;
+    } break;
     case POSTTXT_OP:
     case POSTTXTALL_OP:
     case POSTFILE_OP:
@@ -343,11 +407,12 @@ static int execute_receive(int connfd, operation_t *o) {
 }
 
 int main(int argc, char *argv[]) {
-    const char optstring[] = "l:k:c:C:g:a:d:t:S:s:R:pLh";
+    const char optstring[] = "l:k:c:C:g:a:d:t:S:s:R:V:b:pLBh";
     int optc;
     char *spath = NULL, *nick = NULL;
     operation_t *ops = NULL;
     long msleep=0;
+    int version=PROTO_V1, batch=0;
 
     if (argc <= 4) {
 	use(argv[0]);
@@ -366,6 +431,9 @@ int main(int argc, char *argv[]) {
  	switch (optc) {
         case 'l': spath=optarg;                   break;
 	case 't': msleep= strtol(optarg,NULL,10); break;
+	case 'V': version=strtol(optarg,NULL,10); break;
+	case 'B': batch=BATCH_MAXMSGS;            break;
+	case 'b': batch=strtol(optarg,NULL,10);   break;
 	case 'k': {
 	    nick = strdup(optarg);
 	    if (strlen(nick)>MAX_NAME_LENGTH) {
@@ -538,6 +606,7 @@ int main(int argc, char *argv[]) {
 	fprintf(stderr, "ERRORE: L'opzione -c puo' comparire una sola volta\n\n");
 	return -1;
     }
+    if (batch && (k=makeBatches(ops, k, batch))<0) return -1;
 
     int connfd;
     // faccio 10 tentativi aspettando 1 secondo tra due tentativi
@@ -545,6 +614,12 @@ int main(int argc, char *argv[]) {
 	fprintf(stderr, "ERRORE: riprovo a riconnettermi...\n");
 	return -1;
     }
+    // la versione del protocollo va negoziata prima di ogni altra richiesta
+    if (version != PROTO_V1 && helloServer(connfd, version) <= 0) {
+	perror("helloServer");
+	fprintf(stderr, "ERRORE: versione %d del protocollo non accettata\n", version);
+	return -1;
+    }
 
     // ignoro SIGPIPE per evitare di essere terminato da una scrittura su un socket chiuso
     struct sigaction s;
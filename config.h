@@ -24,6 +24,39 @@
 
 #define END NULL
 
+#define MAX_EVENTS 64 // numero massimo di eventi restituiti da una epoll_wait
+
+#define RECV_BUFSIZE 4096 // dimensione del buffer di ricezione di ogni connessione
+#define MAX_FRAMES   8    // richieste complete bufferizzate per ogni connessione
+#define MAX_PIPELINE 32   // richieste di un client servite al massimo per ogni turno di un worker
+#define IOV_BATCH    64   // messaggi raggruppati in un singolo invio
+#define OUTQ_LIMIT   (8 * 1024 * 1024) // byte in attesa oltre i quali le notifiche vengono scartate (vedi queueOut)
+
+#define QUEUE_SPINS  64   // tentativi di estrazione dalla coda prima di sospendersi
+#define WORKER_BATCH 8    // client estratti al piu' insieme da un worker
+
+#define HASH_STRIPES 64   // lock della tabella hash degli utenti, ognuna per un blocco contiguo di celle
+
+#define POOL_GROW_WAIT  2000 // attesa in coda (in microsecondi) oltre la quale il pool cresce
+#define POOL_GROW_DEPTH 8    // client in coda ad un worker oltre i quali il pool cresce
+#define POOL_GROW_GAP   10   // millisecondi minimi tra due crescite del pool
+#define POOL_IDLE_MS    5000 // inattivita' dopo la quale un worker oltre ThreadsInPool termina
+
+#define LANE_CONTROL 0    // corsia delle operazioni di controllo (connessione, utenti, gruppi)
+#define LANE_TEXT    1    // corsia dei messaggi testuali
+#define LANE_BULK    2    // corsia dei trasferimenti di file
+#define LANES        3    // numero di corsie di priorita' delle code dei worker
+#define LANE_WEIGHTS {4, 4, 1} // estrazioni consecutive concesse ad ogni corsia
+
+#define AFFINITY_NONE 0   // ogni worker puo' servire ogni client (furto del lavoro)
+#define AFFINITY_FD   1   // ogni client e' servito sempre dal worker fd % ThreadsInPool
+#define AFFINITY_USER 2   // ogni client e' servito sempre dal worker scelto dall'hash del nickname
+
+#define STATS_OPS 20 // operazioni misurate dalle statistiche dei worker (le richieste hanno codici < OP_OK)
+
+#define URING_ENTRIES 1024 // posizioni della coda di sottomissione di ogni anello io_uring
+#define URING_ACCEPTS 8    // accept io_uring mantenute pendenti dal listener 0
+
 // to avoid warnings like "ISO C forbids an empty translation unit"
 typedef int make_iso_compilers_happy;
 
@@ -31,19 +64,43 @@ typedef int make_iso_compilers_happy;
  * @struct config
  * @brief  parametri di configurazione
  * 
- * @var ThreadsInPool  numero di thread worker
+ * @var ThreadsInPool  numero (minimo) di thread worker
+ * @var MaxThreadsInPool numero massimo di thread worker: il pool cresce fino a
+ *                       questo valore in base al carico (default ThreadsInPool)
  * @var MaxConnections numero massimo di connessioni in coda
  * @var MaxHistMsgs    numero massimo di messaggi conservati 
  *                       nella history di ogni utente
  * @var MaxMsgSize     lunghezza massima di un messaggio testuale
  * @var MaxFileSize    dimensione massima di un file
+ * @var EdgeTriggered  1 se il listener usa epoll in modalita' edge-triggered,
+ *                       0 per la modalita' level-triggered
+ * @var ListenerThreads numero di thread listener, ognuno con il proprio
+ *                       insieme epoll (default 1)
+ * @var IoUring        1 se il listener usa il backend io_uring
+ *                       (solo se compilato con USE_IO_URING)
+ * @var Affinity       assegnamento dei client ai worker
+ *                       (AFFINITY_NONE, AFFINITY_FD o AFFINITY_USER)
+ * @var FileThreads    numero di thread del pool dedicato ai trasferimenti
+ *                       di file (0 se servono il pool generale)
+ * @var NumaLocal      1 se le strutture vengono posizionate sui nodi NUMA
+ *                       dei thread che le usano (vedi numa.h)
+ * @var NotifyLinger   microsecondi per cui le notifiche a un client attendono
+ *                       le successive, per inviarle insieme (0 per inviarle subito)
  */
 typedef struct {
 	unsigned int ThreadsInPool;
+	unsigned int MaxThreadsInPool;
 	unsigned int MaxConnections;
 	unsigned int MaxHistMsgs;
 	unsigned int MaxMsgSize;
 	unsigned int MaxFileSize;
+	unsigned int EdgeTriggered;
+	unsigned int ListenerThreads;
+	unsigned int IoUring;
+	unsigned int Affinity;
+	unsigned int FileThreads;
+	unsigned int NumaLocal;
+	unsigned int NotifyLinger;
 } config;
 
 #endif /* CONFIG_H_ */
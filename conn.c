@@ -0,0 +1,949 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/timerfd.h>
+
+#include <util.h>
+#include <config.h>
+#include <connections.h>
+#include <conn.h>
+#include <bufpool.h>
+
+/**
+ * @file   conn.c
+ * @brief  Contiene le funzioni che implementano la tabella delle
+ *           connessioni aperte, con lo stato di ricezione di ognuna
+ * @author Michele Zoncheddu 545227
+ * 
+ * Si dichiara che il contenuto di questo file e'
+ *   in ogni sua parte opera originale dell'autore
+ */
+
+/**
+ * @struct linger_t
+ * @brief  notifiche in attesa dell'invio ritardato, per un listener
+ *
+ * Il ritardo e' lo stesso per tutte: le scadenze sono gia' in ordine
+ * 
+ * @var mutex    lock della coda
+ * @var fd_timer timerfd che scade alla prima scadenza
+ * @var fds      connessioni in attesa (coda circolare)
+ * @var due      scadenze (in microsecondi), con gli stessi indici di fds
+ * @var head     posizione della prima connessione
+ * @var count    numero di connessioni in attesa
+ * @var size     dimensione della coda
+ */
+typedef struct {
+	pthread_mutex_t mutex;
+	int             fd_timer;
+	int            *fds;
+	uint64_t       *due;
+	size_t          head;
+	size_t          count;
+	size_t          size;
+} linger_t;
+
+extern config   conf;    // parametri di configurazione
+static conn_t **conns;   // tabella delle connessioni, indicizzata per fd
+static int      nconns;  // dimensione della tabella
+static void   (*armFn)(conn_t*, int); // armamento nel backend del listener
+static linger_t *lingers = NULL; // una coda per listener (NULL se NotifyLinger vale 0)
+
+/**
+ * @function readAvailable
+ * @brief    legge, senza bloccarsi, i byte gia' disponibili sulla connessione
+ *             (fino al riempimento del buffer di ricezione)
+ * 
+ * @param fd descrittore della connessione
+ * @param r  puntatore al parser
+ * 
+ * @return <=0 se c'e' stato un errore
+ *         (se <0 errno deve essere settato, se == 0 connessione chiusa)
+ *         1 altrimenti, anche se non c'era nulla da leggere
+ */
+int readAvailable(long fd, reader_t *r) {
+	size_t avail;
+	char  *space;
+	int    n;
+
+	while ((space = readerSpace(r, &avail)), avail > 0) {
+		if ((n = recv((int)fd, space, avail, MSG_DONTWAIT)) == -1) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) return 1; // socket svuotato
+			return -1;
+		}
+		if (n == 0) return 0;
+		readerCommit(r, n);
+	}
+	return 1; // buffer pieno, il resto verra' letto dopo l'analisi
+}
+
+/**
+ * @function expandPart
+ * @brief    sostituisce una parte dati compressa con quella originale,
+ *             in un buffer del pool
+ * 
+ * @param data puntatore alla parte dati (buf NULL se gia' scartata)
+ * @param max  dimensione massima dei dati originali: oltre questa soglia
+ *               i dati vengono scartati (hdr.len diventa quella originale)
+ * 
+ * @return -1 se i dati compressi non sono validi
+ *          0 altrimenti
+ */
+static int expandPart(message_data_t *data, size_t max) {
+	long  len;
+	char *buf;
+
+	if (!data->buf)
+		return 0;
+	if ((len = expandedLen(data)) == -1)
+		return -1;
+	if ((size_t)len > max) { // troppo lunghi, come i dati scartati in ricezione
+		bufFree(data->buf);
+		data->buf     = NULL;
+		data->hdr.len = len;
+		return 0;
+	}
+	buf = bufAlloc(len);
+	if (expandData(data, buf, len) == -1) {
+		bufFree(buf);
+		return -1;
+	}
+	bufFree(data->buf);
+	data->buf     = buf;
+	data->hdr.len = len;
+	return 0;
+}
+
+/**
+ * @function dataMax
+ * @brief    restituisce la dimensione massima della prima parte dati
+ *             del messaggio in ricezione
+ * 
+ * @param r puntatore al parser (con l'header del messaggio gia' decodificato)
+ * 
+ * @return MaxMsgSize, o per un lotto lo spazio di BATCH_MAXMSGS messaggi
+ *           con i loro header
+ */
+static size_t dataMax(reader_t *r) {
+	if (r->msg.hdr.op == POSTBATCH_OP)
+		return (size_t)BATCH_MAXMSGS * ((size_t)r->max + PACK_MAXSIZE);
+	return r->max;
+}
+
+/**
+ * @function parseMsg
+ * @brief    estrae dai byte ricevuti il prossimo messaggio completo,
+ *             conservando lo stato se il messaggio e' incompleto
+ * 
+ * @param r    puntatore al parser
+ * @param msg  puntatore al messaggio da scrivere
+ * @param file puntatore alla seconda parte dati (solo POSTFILE_OP,
+ *               altrimenti viene azzerata)
+ * 
+ * @return 1 se e' stato estratto un messaggio completo
+ *         0 se servono altri byte
+ *        -1 se il messaggio non e' valido (la connessione va chiusa)
+ */
+int parseMsg(reader_t *r, message_t *msg, message_data_t *file) {
+	char  *dst;  // dove copiare la parte corrente (NULL se va scartata)
+	size_t need; // dimensione della parte corrente
+	size_t n;
+	int    h;
+
+	while (1) {
+		// gli header vengono decodificati interi: il buffer ne contiene sempre uno
+		switch (r->state) {
+		case R_HDR:     h = unpackHdr(r->buf + r->start, r->len, &(r->msg.hdr), r->version);           break;
+		case R_DATAHDR: h = unpackDataHdr(r->buf + r->start, r->len, &(r->msg.data.hdr), r->version); break;
+		case R_FILEHDR: h = unpackDataHdr(r->buf + r->start, r->len, &(r->file.hdr), r->version);     break;
+		case R_ERROR:   return -1;
+		default:        h = 0;
+		}
+		if (h == -1) { // header non valido, il resto dello stream non e' interpretabile
+			if (r->state == R_FILEHDR) // libero i dati gia' ricevuti
+				bufFree(r->msg.data.buf);
+			r->state = R_ERROR;
+			return -1;
+		}
+		if (r->state == R_HDR || r->state == R_DATAHDR || r->state == R_FILEHDR) {
+			if (h == 0) // header incompleto
+				return 0;
+			r->start += h;
+			r->len   -= h;
+		}
+		else {
+			if (r->state == R_DATA) {
+				dst  = r->msg.data.buf;
+				need = r->msg.data.hdr.len;
+			}
+			else {
+				dst  = r->file.buf;
+				need = r->file.hdr.len;
+			}
+
+			// consumo i byte disponibili della parte corrente
+			n = need - r->got < r->len ? need - r->got : r->len;
+			if (dst && n > 0)
+				memcpy(dst + r->got, r->buf + r->start, n);
+			r->start += n;
+			r->len   -= n;
+			r->got   += n;
+			if (r->got < need) // parte incompleta
+				return 0;
+			r->got = 0;
+		}
+
+		// passo alla parte successiva
+		switch (r->state) {
+		case R_HDR:
+			r->state = R_DATAHDR;
+			break;
+		case R_DATAHDR: // i dati troppo lunghi vengono scartati, il worker rispondera' OP_MSG_TOOLONG
+			r->lz = 0;
+			if (r->version == PROTO_V3 && (r->msg.data.hdr.len & DATA_LZ)) { // dati compressi
+				r->lz = 1;
+				r->msg.data.hdr.len &= ~DATA_LZ;
+			}
+			r->msg.data.buf = NULL;
+			if (r->msg.data.hdr.len > 0 && r->msg.data.hdr.len <= dataMax(r))
+				r->msg.data.buf = bufAlloc(r->msg.data.hdr.len);
+			r->state = R_DATA;
+			break;
+		case R_DATA:
+			if (r->lz && expandPart(&(r->msg.data), dataMax(r)) == -1) {
+				bufFree(r->msg.data.buf);
+				r->state = R_ERROR;
+				return -1;
+			}
+			if (r->msg.hdr.op == POSTFILE_OP) { // segue il contenuto del file
+				r->state = R_FILEHDR;
+				break;
+			}
+			// i messaggi che seguono una HELLO_OP valida sono nella nuova versione
+			if ((h = helloVersion(&(r->msg))) != 0)
+				r->version = h;
+			memset(&(r->file), 0, sizeof(message_data_t));
+			*msg  = r->msg;
+			*file = r->file;
+			r->state = R_HDR;
+			return 1;
+		case R_FILEHDR:
+			r->lz = 0;
+			if (r->version == PROTO_V3 && (r->file.hdr.len & DATA_LZ)) { // dati compressi
+				r->lz = 1;
+				r->file.hdr.len &= ~DATA_LZ;
+			}
+			r->file.buf = NULL;
+			if (r->file.hdr.len > 0 && r->file.hdr.len <= r->fmax)
+				r->file.buf = bufAlloc(r->file.hdr.len);
+			r->state = R_FILE;
+			break;
+		default:
+			if (r->lz && expandPart(&(r->file), r->fmax) == -1) {
+				bufFree(r->msg.data.buf);
+				bufFree(r->file.buf);
+				r->state = R_ERROR;
+				return -1;
+			}
+			*msg  = r->msg;
+			*file = r->file;
+			r->state = R_HDR;
+			return 1;
+		}
+	}
+}
+
+/**
+ * @function freeReader
+ * @brief    libera il buffer di ricezione e il messaggio parziale
+ * 
+ * @param r puntatore al parser
+ */
+void freeReader(reader_t *r) {
+	if (r->state == R_DATA || r->state == R_FILEHDR || r->state == R_FILE)
+		bufFree(r->msg.data.buf);
+	if (r->state == R_FILE)
+		bufFree(r->file.buf);
+	free(r->buf);
+}
+
+/**
+ * @function helloVersion
+ * @brief    restituisce la versione richiesta da un messaggio HELLO_OP
+ * 
+ * @param msg puntatore al messaggio
+ * 
+ * @return 0 se il messaggio non e' una HELLO_OP valida
+ *         la versione richiesta altrimenti
+ */
+int helloVersion(message_t *msg) {
+	if (msg->hdr.op != HELLO_OP || msg->data.hdr.len != 1 || !msg->data.buf)
+		return 0;
+	if (msg->data.buf[0] < PROTO_V1 || msg->data.buf[0] > PROTO_LAST)
+		return 0;
+	return msg->data.buf[0];
+}
+
+/**
+ * @function initConns
+ * @brief    inizializza la tabella delle connessioni e, se le notifiche
+ *             vengono ritardate, le code dei listener (vedi flushLinger)
+ * 
+ * @param n   numero massimo di fd (la tabella e' indicizzata per fd)
+ * @param arm funzione del listener che attende nel proprio backend cio' di cui
+ *              la connessione ha bisogno (ricezione se reading vale 1, invio se
+ *              la coda di uscita non e' vuota), chiamata con mutex acquisita.
+ *              Il secondo parametro vale 1 se la sottomissione puo' essere
+ *              rimandata (solo se chiamata dal listener proprietario)
+ */
+void initConns(int n, void (*arm)(conn_t*, int)) {
+	MALLOC(conns, calloc(n, sizeof(conn_t*)), "conns initConns");
+	nconns = n;
+	armFn  = arm;
+
+	if (conf.NotifyLinger == 0) // le notifiche vengono inviate subito
+		return;
+	MALLOC(lingers, calloc(conf.ListenerThreads, sizeof(linger_t)), "lingers initConns");
+	for (unsigned int i = 0; i < conf.ListenerThreads; ++i) {
+		if (pthread_mutex_init(&lingers[i].mutex, NULL) != 0) {
+			fprintf(stderr, "ERROR: pthread_mutex_init initConns\n");
+			exit(EXIT_FAILURE);
+		}
+		SYSCALL(lingers[i].fd_timer, timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC), "timerfd_create");
+	}
+}
+
+/**
+ * @function newConn
+ * @brief    crea lo stato di una connessione appena accettata
+ * 
+ * @param fd il fd della connessione
+ * 
+ * @return il puntatore allo stato della connessione
+ */
+conn_t *newConn(int fd) {
+	conn_t *c;
+
+	if (fd >= nconns) {
+		fprintf(stderr, "ERROR: fd %d fuori dalla tabella delle connessioni\n", fd);
+		exit(EXIT_FAILURE);
+	}
+	MALLOC(c, calloc(1, sizeof(conn_t)), "c newConn");
+	c->fd      = fd;
+	c->reading = 1; // appena accettata, il client e' atteso dal listener
+	c->home    = -1;
+	c->version = PROTO_V1;
+	c->user    = -1; // nessun utente collegato
+	if (pthread_mutex_init(&c->mutex, NULL) != 0) {
+		fprintf(stderr, "ERROR: pthread_mutex_init newConn\n");
+		exit(EXIT_FAILURE);
+	}
+	// i dati oltre le dimensioni massime vengono scartati durante la ricezione
+	initReader(&c->rd, RECV_BUFSIZE, conf.MaxMsgSize, conf.MaxFileSize * 1024);
+	conns[fd] = c;
+	return c;
+}
+
+/**
+ * @function getConn
+ * @brief    restituisce lo stato di una connessione
+ * 
+ * @param fd il fd della connessione
+ * 
+ * @return NULL se la connessione non esiste
+ *         il puntatore allo stato altrimenti
+ */
+conn_t *getConn(int fd) {
+	return (fd >= 0 && fd < nconns) ? conns[fd] : NULL;
+}
+
+/**
+ * @function fillFrames
+ * @brief    estrae dai byte ricevuti le richieste complete,
+ *             finche' c'e' spazio nella coda della connessione
+ *             (una richiesta non valida equivale alla chiusura)
+ * 
+ * @param c puntatore alla connessione
+ * 
+ * @return il numero di richieste in attesa
+ */
+int fillFrames(conn_t *c) {
+	frame_t *f;
+	int      n;
+	while (c->count < MAX_FRAMES) {
+		f = &c->frames[(c->head + c->count) % MAX_FRAMES];
+		if ((n = parseMsg(&c->rd, &f->msg, &f->file)) == -1) // richiesta non valida: servo le precedenti e chiudo
+			c->eof = 1;
+		if (n <= 0) // richiesta incompleta
+			break;
+		c->count++;
+	}
+	return c->count;
+}
+
+/**
+ * @function popFrame
+ * @brief    estrae la prima richiesta completa in attesa
+ * 
+ * @param c puntatore alla connessione
+ * @param f puntatore alla richiesta da scrivere
+ * 
+ * @return 0 se non ci sono richieste in attesa
+ *         1 altrimenti
+ */
+int popFrame(conn_t *c, frame_t *f) {
+	if (c->count == 0)
+		return 0;
+	*f = c->frames[c->head];
+	c->head = (c->head + 1) % MAX_FRAMES;
+	c->count--;
+	return 1;
+}
+
+/**
+ * @function watchConn
+ * @brief    restituisce la ricezione al listener, dopo che un worker
+ *             ha servito le richieste del client
+ * 
+ * @param c puntatore alla connessione
+ */
+void watchConn(conn_t *c) {
+	pthread_mutex_lock(&c->mutex);
+	c->reading = 1;
+	armFn(c, 0);
+	pthread_mutex_unlock(&c->mutex);
+}
+
+/**
+ * @function closeConn
+ * @brief    chiude la connessione (da un worker): i messaggi in attesa
+ *             vengono scartati e il listener la libera al prossimo evento
+ *             (con un invio io_uring pendente li scarta il suo completamento)
+ * 
+ * @param c puntatore alla connessione
+ */
+void closeConn(conn_t *c) {
+	pthread_mutex_lock(&c->mutex);
+	c->closed  = 1;
+	c->reading = 1; // la chiusura rende il socket leggibile: il listener riceve l'evento
+	if (!c->wbusy) // altrimenti il kernel sta ancora leggendo i messaggi
+		dropOut(c);
+	shutdown(c->fd, SHUT_RDWR);
+	armFn(c, 0);
+	pthread_mutex_unlock(&c->mutex);
+}
+
+/**
+ * @function gatherOut
+ * @brief    compila i blocchi per un invio raggruppato dei byte in attesa
+ *             (con mutex acquisita)
+ * 
+ * @param c   puntatore alla connessione
+ * @param iov array di blocchi da compilare
+ * @param max dimensione dell'array
+ * 
+ * @return il numero di blocchi compilati
+ */
+int gatherOut(conn_t *c, struct iovec *iov, int max) {
+	int n = 0;
+	for (outbuf_t *b = c->outq; b && n < max; b = b->next, ++n) {
+		iov[n].iov_base = b->data + b->off;
+		iov[n].iov_len  = b->len - b->off;
+	}
+	return n;
+}
+
+/**
+ * @function consumeOut
+ * @brief    rimuove dalla coda di uscita i byte inviati (con mutex acquisita)
+ * 
+ * @param c puntatore alla connessione
+ * @param n numero di byte inviati
+ */
+void consumeOut(conn_t *c, size_t n) {
+	outbuf_t *b;
+	c->outbytes -= n;
+	while (n > 0 && c->outq) {
+		b = c->outq;
+		if (n < b->len - b->off) { // messaggio inviato in parte
+			b->off += n;
+			return;
+		}
+		n -= b->len - b->off;
+		c->outq = b->next;
+		bufFree((char*)b);
+	}
+	if (!c->outq) { // coda svuotata (o scartata nel frattempo)
+		c->outtail  = NULL;
+		c->outbytes = 0;
+	}
+}
+
+/**
+ * @function dropOut
+ * @brief    scarta tutti i messaggi in attesa (con mutex acquisita)
+ * 
+ * @param c puntatore alla connessione
+ */
+void dropOut(conn_t *c) {
+	outbuf_t *b;
+	while ((b = c->outq) != NULL) {
+		c->outq = b->next;
+		bufFree((char*)b);
+	}
+	c->outtail  = NULL;
+	c->outbytes = 0;
+}
+
+/**
+ * @function flushOut
+ * @brief    invia senza bloccarsi i byte in attesa, raggruppando
+ *             i messaggi in un'unica chiamata (con mutex acquisita)
+ * 
+ * @param c puntatore alla connessione
+ * 
+ * @return -1 se la connessione e' interrotta (la coda viene scartata)
+ *          0 se il socket e' pieno e restano byte in attesa
+ *          1 se la coda e' stata svuotata
+ */
+int flushOut(conn_t *c) {
+	struct iovec  iov[IOV_BATCH];
+	struct msghdr mh;
+	ssize_t       n;
+
+	while (c->outq) {
+		memset(&mh, 0, sizeof(mh));
+		mh.msg_iov    = iov;
+		mh.msg_iovlen = gatherOut(c, iov, IOV_BATCH);
+		if ((n = sendmsg(c->fd, &mh, MSG_DONTWAIT | MSG_NOSIGNAL)) == -1) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) return 0; // riprovo quando e' scrivibile
+			dropOut(c);
+			return -1;
+		}
+		consumeOut(c, n);
+	}
+	return 1;
+}
+
+/**
+ * @function nowUsec
+ * @brief    restituisce l'istante corrente
+ * 
+ * @return i microsecondi trascorsi da un istante fissato
+ */
+static uint64_t nowUsec(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @function armLinger
+ * @brief    fa scadere il timerfd di una coda alla prima scadenza
+ *             (con la mutex della coda acquisita e la coda non vuota)
+ * 
+ * @param l puntatore alla coda
+ */
+static void armLinger(linger_t *l) {
+	struct itimerspec its;
+	uint64_t due = l->due[l->head];
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec  = due / 1000000;
+	its.it_value.tv_nsec = (due % 1000000) * 1000;
+	if (timerfd_settime(l->fd_timer, TFD_TIMER_ABSTIME, &its, NULL) == -1) {
+		perror("timerfd_settime");
+		exit(errno);
+	}
+}
+
+/**
+ * @function lingerConn
+ * @brief    rimanda l'invio delle notifiche di una connessione di
+ *             NotifyLinger microsecondi (con c->mutex acquisita)
+ * 
+ * @param c puntatore alla connessione
+ */
+static void lingerConn(conn_t *c) {
+	linger_t *l = &lingers[c->fd % conf.ListenerThreads];
+	size_t    i, size;
+	int      *fds;
+	uint64_t *due;
+
+	pthread_mutex_lock(&l->mutex);
+	if (l->count == l->size) { // coda piena, la raddoppio
+		size = l->size ? 2 * l->size : 64;
+		MALLOC(fds, malloc(size * sizeof(int)), "fds lingerConn");
+		MALLOC(due, malloc(size * sizeof(uint64_t)), "due lingerConn");
+		for (i = 0; i < l->count; ++i) {
+			fds[i] = l->fds[(l->head + i) % l->size];
+			due[i] = l->due[(l->head + i) % l->size];
+		}
+		free(l->fds);
+		free(l->due);
+		l->fds  = fds;
+		l->due  = due;
+		l->head = 0;
+		l->size = size;
+	}
+	i = (l->head + l->count) % l->size;
+	l->fds[i] = c->fd;
+	l->due[i] = nowUsec() + conf.NotifyLinger;
+	if (l->count++ == 0) // altrimenti il timerfd scade prima
+		armLinger(l);
+	pthread_mutex_unlock(&l->mutex);
+}
+
+/**
+ * @function compressOut
+ * @brief    comprime la parte dati di un messaggio da inviare in PROTO_V3.
+ *             Se i dati sono in un buffer del pool la forma compressa viene
+ *             calcolata una volta sola e conservata con loro (vedi bufSetAux),
+ *             per gli altri destinatari e per i nuovi invii
+ * 
+ * @param data   puntatore alla parte dati
+ * @param z      puntatore alla parte dati compressa da scrivere
+ * @param pooled 1 se data->buf e' un buffer del pool, che non viene modificato
+ * 
+ * @return 0 se i dati vanno inviati cosi' come sono
+ *         1 se sono stati compressi in z (z->buf va liberato)
+ *         2 se z contiene la forma conservata con i dati (da non liberare)
+ */
+static int compressOut(message_data_t *data, message_data_t *z, int pooled) {
+	char        *aux;
+	unsigned int len;
+
+	pooled = pooled && data->buf;
+	if (pooled && bufAux(data->buf, &aux, &len)) { // gia' calcolata
+		if (!(len & DATA_LZ)) // non si accorcia
+			return 0;
+		z->hdr     = data->hdr;
+		z->hdr.len = len;
+		z->buf     = aux;
+		return 2;
+	}
+	z->buf = bufAlloc(data->hdr.len);
+	if (!compressData(data, z)) {
+		bufFree(z->buf);
+		if (pooled) // ricordo che non conviene comprimerli
+			bufSetAux(data->buf, NULL, data->hdr.len);
+		return 0;
+	}
+	if (pooled && bufSetAux(data->buf, z->buf, z->hdr.len))
+		return 2;
+	return 1;
+}
+
+/**
+ * @function packOut
+ * @brief    codifica un messaggio, o una sua parte, nel formato di una
+ *             versione del protocollo
+ * 
+ * @param hdr     puntatore all'header (NULL se si invia solo la parte dati)
+ * @param data    puntatore alla parte dati (NULL se si invia solo l'header)
+ * @param version versione del protocollo del destinatario
+ * @param pooled  1 se i dati sono in un buffer del pool (vedi compressOut)
+ * 
+ * @return il messaggio da accodare
+ */
+static outbuf_t *packOut(message_hdr_t *hdr, message_data_t *data, int version, int pooled) {
+	char           p[2 * PACK_MAXSIZE];
+	size_t         n = 0, len;
+	outbuf_t      *b;
+	message_data_t z;
+	int            lz = 0;
+
+	if (data && version == PROTO_V3 && data->hdr.len >= LZ_MINSIZE) // in PROTO_V3 i dati lunghi viaggiano compressi
+		if ((lz = compressOut(data, &z, pooled)) != 0)
+			data = &z;
+	if (hdr)
+		n += packHdr(p, hdr, version);
+	if (data)
+		n += packDataHdr(p + n, &(data->hdr), version);
+	len = n + (data ? data->hdr.len & ~DATA_LZ : 0);
+
+	b = (outbuf_t*)bufAlloc(sizeof(outbuf_t) + len);
+	b->next = NULL;
+	b->len  = len;
+	b->off  = 0;
+	memcpy(b->data, p, n);
+	if (data && len > n)
+		memcpy(b->data + n, data->buf, len - n);
+	if (lz == 1)
+		bufFree(z.buf);
+	return b;
+}
+
+/**
+ * @function queueOut
+ * @brief    accoda un messaggio sulla connessione e prova ad inviarlo subito,
+ *             senza mai bloccarsi sul socket del destinatario
+ * 
+ * @param fd   il fd del destinatario
+ * @param hdr  puntatore all'header (NULL se si invia solo la parte dati)
+ * @param data puntatore alla parte dati (NULL se si invia solo l'header)
+ * @param next   versione del protocollo dei messaggi successivi (0 se non cambia)
+ * @param notify 1 se il messaggio e' una notifica, che puo' attendere le successive
+ * @param pooled 1 se i dati sono in un buffer del pool (vedi compressOut)
+ * 
+ * @return -1 se la connessione e' chiusa o la coda di uscita e' piena
+ *          1 altrimenti
+ * 
+ * Con la coda piena solo le notifiche vengono scartate: un messaggio di una
+ *   risposta non puo' mancare, quindi il client troppo lento viene disconnesso
+ */
+static int queueOut(int fd, message_hdr_t *hdr, message_data_t *data, int next, int notify, int pooled) {
+	conn_t   *c = getConn(fd);
+	outbuf_t *b;
+	int       version;
+
+	if (!c)
+		return -1;
+
+	// codifico il messaggio fuori dal lock, il chiamante puo' liberare i propri buffer
+	version = __atomic_load_n(&c->version, __ATOMIC_RELAXED);
+	b = packOut(hdr, data, version, pooled);
+
+	pthread_mutex_lock(&c->mutex);
+	if (c->closed || (c->outq && c->outbytes >= OUTQ_LIMIT)) { // destinatario chiuso o troppo lento
+		// niente piu' byte sul socket: il proprietario riceve la chiusura e la gestisce
+		if (!c->closed && !notify)
+			shutdown(c->fd, SHUT_RDWR);
+		pthread_mutex_unlock(&c->mutex);
+		bufFree((char*)b);
+		return -1;
+	}
+	if (c->version != version) { // versione cambiata nel frattempo (HELLO_OP), ricodifico
+		bufFree((char*)b);
+		b = packOut(hdr, data, c->version, pooled);
+	}
+	if (c->outtail)
+		c->outtail->next = b;
+	else
+		c->outq = b;
+	c->outtail   = b;
+	c->outbytes += b->len;
+	if (next) // i messaggi accodati dopo questo usano la nuova versione
+		__atomic_store_n(&c->version, next, __ATOMIC_RELAXED);
+
+	// se non c'e' un invio asincrono in corso provo subito, il resto lo invia il listener;
+	//   le notifiche aspettano le successive, le risposte partono subito insieme a loro
+	if (!c->wbusy) {
+		if (notify && lingers) {
+			if (!c->linger) {
+				c->linger = 1;
+				lingerConn(c);
+			}
+		}
+		else if (flushOut(c) == 0)
+			armFn(c, 0);
+	}
+	pthread_mutex_unlock(&c->mutex);
+	return 1;
+}
+
+/**
+ * @function queueOp
+ * @brief    accoda l'invio di un header con l'operazione specificata
+ * 
+ * @param fd il fd del destinatario
+ * @param op l'operazione
+ * 
+ * @return -1 se la connessione e' chiusa o la coda di uscita e' piena
+ *           (il client troppo lento viene disconnesso)
+ *          1 altrimenti
+ */
+int queueOp(int fd, op_t op) {
+	message_hdr_t hdr;
+	memset(&hdr, 0, sizeof(message_hdr_t));
+	hdr.op = op;
+	strncpy(hdr.sender, "server", 7); // MAX_NAME_LENGTH e' > 6
+	return queueOut(fd, &hdr, NULL, 0, 0, 0);
+}
+
+/**
+ * @function queueData
+ * @brief    accoda l'invio della parte dati di un messaggio
+ * 
+ * @param fd   il fd del destinatario
+ * @param data puntatore alla parte dati
+ * 
+ * @return -1 se la connessione e' chiusa o la coda di uscita e' piena
+ *           (il client troppo lento viene disconnesso)
+ *          1 altrimenti
+ */
+int queueData(int fd, message_data_t *data) {
+	return queueOut(fd, NULL, data, 0, 0, 0);
+}
+
+/**
+ * @function queueMsg
+ * @brief    accoda l'invio di un messaggio completo
+ * 
+ * @param fd  il fd del destinatario
+ * @param msg puntatore al messaggio
+ * 
+ * @return -1 se la connessione e' chiusa o la coda di uscita e' piena
+ *           (il client troppo lento viene disconnesso)
+ *          1 altrimenti
+ */
+int queueMsg(int fd, message_t *msg) {
+	return queueOut(fd, &(msg->hdr), &(msg->data), 0, 0, 0);
+}
+
+/**
+ * @function queueHistory
+ * @brief    accoda l'invio di un messaggio della history: i dati sono in un
+ *             buffer del pool condiviso tra i destinatari, quindi in PROTO_V3
+ *             vengono compressi una volta sola
+ * 
+ * @param fd  il fd del destinatario
+ * @param msg puntatore al messaggio
+ * 
+ * @return -1 se la connessione e' chiusa o la coda di uscita e' piena
+ *           (il client troppo lento viene disconnesso)
+ *          1 altrimenti
+ */
+int queueHistory(int fd, message_t *msg) {
+	return queueOut(fd, &(msg->hdr), &(msg->data), 0, 0, 1);
+}
+
+/**
+ * @function queueNotify
+ * @brief    accoda l'invio di una notifica (TXT_MESSAGE o FILE_MESSAGE):
+ *             con NotifyLinger le notifiche che arrivano nel frattempo
+ *             vengono inviate insieme. I dati sono quelli della history,
+ *             come per queueHistory
+ * 
+ * @param fd  il fd del destinatario
+ * @param msg puntatore al messaggio
+ * 
+ * @return -1 se la connessione e' chiusa o la coda di uscita e' piena
+ *          1 altrimenti
+ */
+int queueNotify(int fd, message_t *msg) {
+	return queueOut(fd, &(msg->hdr), &(msg->data), 0, 1, 1);
+}
+
+/**
+ * @function upgradeConn
+ * @brief    accoda la conferma di una HELLO_OP nella versione corrente del
+ *             protocollo e passa alla nuova per i messaggi successivi
+ * 
+ * @param fd      il fd del client
+ * @param version nuova versione del protocollo
+ * 
+ * @return -1 se la connessione e' chiusa o la coda di uscita e' piena
+ *          1 altrimenti
+ */
+int upgradeConn(int fd, int version) {
+	message_hdr_t hdr;
+	memset(&hdr, 0, sizeof(message_hdr_t));
+	hdr.op = OP_OK;
+	strncpy(hdr.sender, "server", 7);
+	return queueOut(fd, &hdr, NULL, version, 0, 0);
+}
+
+/**
+ * @function lingerFd
+ * @brief    restituisce il timerfd delle notifiche ritardate di un listener
+ * 
+ * @param id indice del listener
+ * 
+ * @return -1 se le notifiche vengono inviate subito
+ *         il timerfd, leggibile quando ci sono notifiche da inviare, altrimenti
+ */
+int lingerFd(int id) {
+	return lingers ? lingers[id].fd_timer : -1;
+}
+
+/**
+ * @function flushLinger
+ * @brief    invia le notifiche il cui ritardo e' scaduto, chiamata dal
+ *             listener quando il suo timerfd e' leggibile (il listener e'
+ *             il proprietario delle connessioni: nessuna puo' essere liberata)
+ * 
+ * @param id indice del listener
+ */
+void flushLinger(int id) {
+	linger_t *l = &lingers[id];
+	uint64_t  expired, now = nowUsec();
+	conn_t   *c;
+	int       fd;
+
+	if (read(l->fd_timer, &expired, sizeof(expired)) == -1 && errno != EAGAIN)
+		perror("read timerfd");
+
+	while (1) {
+		// non tengo la mutex della coda mentre acquisisco quella di una connessione
+		pthread_mutex_lock(&l->mutex);
+		if (l->count == 0 || l->due[l->head] > now) {
+			if (l->count > 0) // la prossima scadenza
+				armLinger(l);
+			pthread_mutex_unlock(&l->mutex);
+			return;
+		}
+		fd      = l->fds[l->head];
+		l->head = (l->head + 1) % l->size;
+		l->count--;
+		pthread_mutex_unlock(&l->mutex);
+
+		if (!(c = getConn(fd)))
+			continue;
+		pthread_mutex_lock(&c->mutex);
+		if (c->linger) { // il fd potrebbe essere di una connessione piu' recente
+			c->linger = 0;
+			if (!c->closed && !c->wbusy && flushOut(c) == 0)
+				armFn(c, 1);
+		}
+		pthread_mutex_unlock(&c->mutex);
+	}
+}
+
+/**
+ * @function freeConn
+ * @brief    libera lo stato di una connessione (prima della close del fd)
+ * 
+ * @param fd il fd della connessione
+ */
+void freeConn(int fd) {
+	conn_t *c = getConn(fd);
+	frame_t f;
+	if (!c)
+		return;
+
+	// richieste mai servite
+	while (popFrame(c, &f)) {
+		bufFree(f.msg.data.buf);
+		bufFree(f.file.buf);
+	}
+	freeReader(&c->rd);
+	dropOut(c);
+	pthread_mutex_destroy(&c->mutex);
+	free(c);
+	conns[fd] = NULL;
+}
+
+/**
+ * @function freeConns
+ * @brief    libera la tabella e le connessioni ancora aperte
+ */
+void freeConns() {
+	for (int i = 0; i < nconns; ++i)
+		freeConn(i);
+	free(conns);
+	for (unsigned int i = 0; lingers && i < conf.ListenerThreads; ++i) {
+		close(lingers[i].fd_timer);
+		pthread_mutex_destroy(&lingers[i].mutex);
+		free(lingers[i].fds);
+		free(lingers[i].due);
+	}
+	free(lingers);
+}
@@ -0,0 +1,398 @@
+#ifndef CONN_H_
+#define CONN_H_
+
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+
+#include <config.h>
+#include <message.h>
+#include <connections.h>
+
+/**
+ * @file   conn.h
+ * @brief  Contiene le funzioni che implementano la tabella delle
+ *           connessioni aperte, con lo stato di ricezione di ognuna
+ * @author Michele Zoncheddu 545227
+ * 
+ * Si dichiara che il contenuto di questo file e'
+ *   in ogni sua parte opera originale dell'autore
+ */
+
+/**
+ * @struct frame_t
+ * @brief  richiesta completa ricevuta da un client
+ * 
+ * @var msg  messaggio di richiesta
+ * @var file seconda parte dati (solo per POSTFILE_OP)
+ */
+typedef struct {
+	message_t      msg;
+	message_data_t file;
+} frame_t;
+
+/**
+ * @struct outbuf_t
+ * @brief  messaggio in attesa di essere inviato su una connessione
+ * 
+ * @var next messaggio successivo nella coda di uscita
+ * @var len  dimensione del messaggio
+ * @var off  byte gia' inviati
+ * @var data byte del messaggio
+ */
+typedef struct outbuf {
+	struct outbuf *next;
+	size_t         len;
+	size_t         off;
+	char           data[];
+} outbuf_t;
+
+/**
+ * @struct conn_t
+ * @brief  stato di una connessione aperta
+ *
+ * La ricezione appartiene al listener finche' reading vale 1 e al worker
+ *   che serve le richieste altrimenti, quindi rd e frames non richiedono lock.
+ *   La coda di uscita e lo stato di armamento sono protetti da mutex
+ * 
+ * @var fd       fd della connessione
+ * @var rd       parser incrementale delle richieste
+ * @var frames   richieste complete in attesa di essere servite (coda circolare)
+ * @var head     posizione della prima richiesta in attesa
+ * @var count    numero di richieste in attesa
+ * @var eof      1 se il client ha chiuso la connessione (o c'e' stato un errore)
+ * @var mutex    lock per la coda di uscita e per lo stato di armamento
+ * @var outq     primo messaggio in attesa di invio
+ * @var outtail  ultimo messaggio in attesa di invio
+ * @var outbytes byte in attesa di invio
+ * @var reading  1 se il listener attende le richieste del client
+ * @var closed   1 se la connessione e' stata chiusa da un worker,
+ *                 il listener la libera al prossimo evento
+ * @var rarmed   1 se c'e' una ricezione io_uring pendente
+ * @var wbusy    1 se c'e' un invio io_uring pendente
+ * @var inflight operazioni io_uring pendenti sulla connessione
+ * @var wmsg     descrittore dell'invio io_uring pendente
+ * @var wiov     blocchi dell'invio io_uring pendente
+ * @var home     worker a cui e' assegnato il client (AFFINITY_USER),
+ *                 -1 finche' non e' noto il nickname (accesso atomico,
+ *                 lo scrive il worker e lo legge il listener)
+ * @var queued   istante (in microsecondi) dell'ultimo inserimento in coda
+ * @var version  versione del protocollo dei messaggi inviati (vedi upgradeConn),
+ *                 quella dei messaggi ricevuti e' in rd
+ * @var linger   1 se le notifiche in coda attendono l'invio ritardato
+ *                 (vedi flushLinger)
+ * @var user     posizione nella struttura online dell'utente collegato sulla
+ *                 connessione, -1 se nessuno (vedi getSession)
+ */
+typedef struct {
+	int             fd;
+	reader_t        rd;
+	frame_t         frames[MAX_FRAMES];
+	int             head;
+	int             count;
+	int             eof;
+	pthread_mutex_t mutex;
+	outbuf_t       *outq;
+	outbuf_t       *outtail;
+	size_t          outbytes;
+	int             reading;
+	int             closed;
+	int             rarmed;
+	int             wbusy;
+	int             inflight;
+	struct msghdr   wmsg;
+	struct iovec    wiov[IOV_BATCH];
+	int             home;
+	uint64_t        queued;
+	int             version;
+	int             linger;
+	int             user;
+} conn_t;
+
+/**
+ * @function readAvailable
+ * @brief    legge, senza bloccarsi, i byte gia' disponibili sulla connessione
+ *             (fino al riempimento del buffer di ricezione)
+ * 
+ * @param fd descrittore della connessione
+ * @param r  puntatore al parser
+ * 
+ * @return <=0 se c'e' stato un errore
+ *         (se <0 errno deve essere settato, se == 0 connessione chiusa)
+ *         1 altrimenti, anche se non c'era nulla da leggere
+ */
+int readAvailable(long fd, reader_t *r);
+
+/**
+ * @function parseMsg
+ * @brief    estrae dai byte ricevuti il prossimo messaggio completo,
+ *             conservando lo stato se il messaggio e' incompleto
+ * 
+ * @param r    puntatore al parser
+ * @param msg  puntatore al messaggio da scrivere
+ * @param file puntatore alla seconda parte dati (solo POSTFILE_OP,
+ *               altrimenti viene azzerata)
+ * 
+ * @return 1 se e' stato estratto un messaggio completo
+ *         0 se servono altri byte
+ *        -1 se il messaggio non e' valido (la connessione va chiusa)
+ */
+int parseMsg(reader_t *r, message_t *msg, message_data_t *file);
+
+/**
+ * @function freeReader
+ * @brief    libera il buffer di ricezione e il messaggio parziale
+ * 
+ * @param r puntatore al parser
+ */
+void freeReader(reader_t *r);
+
+/**
+ * @function helloVersion
+ * @brief    restituisce la versione richiesta da un messaggio HELLO_OP
+ * 
+ * @param msg puntatore al messaggio
+ * 
+ * @return 0 se il messaggio non e' una HELLO_OP valida
+ *         la versione richiesta altrimenti
+ */
+int helloVersion(message_t *msg);
+
+/**
+ * @function initConns
+ * @brief    inizializza la tabella delle connessioni e, se le notifiche
+ *             vengono ritardate, le code dei listener (vedi flushLinger)
+ * 
+ * @param n   numero massimo di fd (la tabella e' indicizzata per fd)
+ * @param arm funzione del listener che attende nel proprio backend cio' di cui
+ *              la connessione ha bisogno (ricezione se reading vale 1, invio se
+ *              la coda di uscita non e' vuota), chiamata con mutex acquisita.
+ *              Il secondo parametro vale 1 se la sottomissione puo' essere
+ *              rimandata (solo se chiamata dal listener proprietario)
+ */
+void initConns(int n, void (*arm)(conn_t*, int));
+
+/**
+ * @function newConn
+ * @brief    crea lo stato di una connessione appena accettata
+ * 
+ * @param fd il fd della connessione
+ * 
+ * @return il puntatore allo stato della connessione
+ */
+conn_t *newConn(int fd);
+
+/**
+ * @function getConn
+ * @brief    restituisce lo stato di una connessione
+ * 
+ * @param fd il fd della connessione
+ * 
+ * @return NULL se la connessione non esiste
+ *         il puntatore allo stato altrimenti
+ */
+conn_t *getConn(int fd);
+
+/**
+ * @function fillFrames
+ * @brief    estrae dai byte ricevuti le richieste complete,
+ *             finche' c'e' spazio nella coda della connessione
+ *             (una richiesta non valida equivale alla chiusura)
+ * 
+ * @param c puntatore alla connessione
+ * 
+ * @return il numero di richieste in attesa
+ */
+int fillFrames(conn_t *c);
+
+/**
+ * @function popFrame
+ * @brief    estrae la prima richiesta completa in attesa
+ * 
+ * @param c puntatore alla connessione
+ * @param f puntatore alla richiesta da scrivere
+ * 
+ * @return 0 se non ci sono richieste in attesa
+ *         1 altrimenti
+ */
+int popFrame(conn_t *c, frame_t *f);
+
+/**
+ * @function watchConn
+ * @brief    restituisce la ricezione al listener, dopo che un worker
+ *             ha servito le richieste del client
+ * 
+ * @param c puntatore alla connessione
+ */
+void watchConn(conn_t *c);
+
+/**
+ * @function closeConn
+ * @brief    chiude la connessione (da un worker): i messaggi in attesa
+ *             vengono scartati e il listener la libera al prossimo evento
+ * 
+ * @param c puntatore alla connessione
+ */
+void closeConn(conn_t *c);
+
+/**
+ * @function gatherOut
+ * @brief    compila i blocchi per un invio raggruppato dei byte in attesa
+ *             (con mutex acquisita)
+ * 
+ * @param c   puntatore alla connessione
+ * @param iov array di blocchi da compilare
+ * @param max dimensione dell'array
+ * 
+ * @return il numero di blocchi compilati
+ */
+int gatherOut(conn_t *c, struct iovec *iov, int max);
+
+/**
+ * @function consumeOut
+ * @brief    rimuove dalla coda di uscita i byte inviati (con mutex acquisita)
+ * 
+ * @param c puntatore alla connessione
+ * @param n numero di byte inviati
+ */
+void consumeOut(conn_t *c, size_t n);
+
+/**
+ * @function dropOut
+ * @brief    scarta tutti i messaggi in attesa (con mutex acquisita)
+ * 
+ * @param c puntatore alla connessione
+ */
+void dropOut(conn_t *c);
+
+/**
+ * @function flushOut
+ * @brief    invia senza bloccarsi i byte in attesa, raggruppando
+ *             i messaggi in un'unica chiamata (con mutex acquisita)
+ * 
+ * @param c puntatore alla connessione
+ * 
+ * @return -1 se la connessione e' interrotta (la coda viene scartata)
+ *          0 se il socket e' pieno e restano byte in attesa
+ *          1 se la coda e' stata svuotata
+ */
+int flushOut(conn_t *c);
+
+/**
+ * @function queueOp
+ * @brief    accoda l'invio di un header con l'operazione specificata
+ * 
+ * @param fd il fd del destinatario
+ * @param op l'operazione
+ * 
+ * @return -1 se la connessione e' chiusa o la coda di uscita e' piena
+ *           (il client troppo lento viene disconnesso)
+ *          1 altrimenti
+ */
+int queueOp(int fd, op_t op);
+
+/**
+ * @function queueData
+ * @brief    accoda l'invio della parte dati di un messaggio
+ * 
+ * @param fd   il fd del destinatario
+ * @param data puntatore alla parte dati
+ * 
+ * @return -1 se la connessione e' chiusa o la coda di uscita e' piena
+ *           (il client troppo lento viene disconnesso)
+ *          1 altrimenti
+ */
+int queueData(int fd, message_data_t *data);
+
+/**
+ * @function queueMsg
+ * @brief    accoda l'invio di un messaggio completo
+ * 
+ * @param fd  il fd del destinatario
+ * @param msg puntatore al messaggio
+ * 
+ * @return -1 se la connessione e' chiusa o la coda di uscita e' piena
+ *           (il client troppo lento viene disconnesso)
+ *          1 altrimenti
+ */
+int queueMsg(int fd, message_t *msg);
+
+/**
+ * @function queueHistory
+ * @brief    accoda l'invio di un messaggio della history: i dati sono in un
+ *             buffer del pool condiviso tra i destinatari, quindi in PROTO_V3
+ *             vengono compressi una volta sola
+ * 
+ * @param fd  il fd del destinatario
+ * @param msg puntatore al messaggio
+ * 
+ * @return -1 se la connessione e' chiusa o la coda di uscita e' piena
+ *           (il client troppo lento viene disconnesso)
+ *          1 altrimenti
+ */
+int queueHistory(int fd, message_t *msg);
+
+/**
+ * @function queueNotify
+ * @brief    accoda l'invio di una notifica (TXT_MESSAGE o FILE_MESSAGE):
+ *             con NotifyLinger le notifiche che arrivano nel frattempo
+ *             vengono inviate insieme. I dati sono quelli della history,
+ *             come per queueHistory
+ * 
+ * @param fd  il fd del destinatario
+ * @param msg puntatore al messaggio
+ * 
+ * @return -1 se la connessione e' chiusa o la coda di uscita e' piena
+ *          1 altrimenti
+ */
+int queueNotify(int fd, message_t *msg);
+
+/**
+ * @function upgradeConn
+ * @brief    accoda la conferma di una HELLO_OP nella versione corrente del
+ *             protocollo e passa alla nuova per i messaggi successivi
+ * 
+ * @param fd      il fd del client
+ * @param version nuova versione del protocollo
+ * 
+ * @return -1 se la connessione e' chiusa o la coda di uscita e' piena
+ *          1 altrimenti
+ */
+int upgradeConn(int fd, int version);
+
+/**
+ * @function lingerFd
+ * @brief    restituisce il timerfd delle notifiche ritardate di un listener
+ * 
+ * @param id indice del listener
+ * 
+ * @return -1 se le notifiche vengono inviate subito
+ *         il timerfd, leggibile quando ci sono notifiche da inviare, altrimenti
+ */
+int lingerFd(int id);
+
+/**
+ * @function flushLinger
+ * @brief    invia le notifiche il cui ritardo e' scaduto, chiamata dal
+ *             listener quando il suo timerfd e' leggibile (il listener e'
+ *             il proprietario delle connessioni: nessuna puo' essere liberata)
+ * 
+ * @param id indice del listener
+ */
+void flushLinger(int id);
+
+/**
+ * @function freeConn
+ * @brief    libera lo stato di una connessione (prima della close del fd)
+ * 
+ * @param fd il fd della connessione
+ */
+void freeConn(int fd);
+
+/**
+ * @function freeConns
+ * @brief    libera la tabella e le connessioni ancora aperte
+ */
+void freeConns();
+
+#endif /* CONN_H_ */
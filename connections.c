@@ -8,9 +8,11 @@
  *   in ogni sua parte opera originale dell'autore
  */
 
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -20,6 +22,41 @@
 #include <message.h>
 #include <connections.h>
 #include <util.h>
+#include <lz.h>
+
+#define VARINT_MAX     5    // byte massimi di un varint (32 bit)
+#define CLIENT_BUFSIZE 4096 // dimensione del buffer di ricezione lato client
+
+// lato client ogni connessione ha un buffer di ricezione, con la versione del protocollo
+static reader_t **readers  = NULL; // tabella dei buffer, indicizzata per fd
+static long       nreaders = 0;    // dimensione della tabella
+
+/**
+ * @function readerOf
+ * @brief    restituisce il buffer di ricezione lato client di una connessione,
+ *             creandolo se non esiste
+ *
+ * @param fd descrittore della connessione
+ *
+ * @return NULL se il descrittore non e' valido
+ *         il puntatore al buffer altrimenti
+ */
+static reader_t *readerOf(long fd) {
+	long n;
+	if (fd < 0)
+		return NULL;
+	if (fd >= nreaders) { // allargo la tabella
+		n = fd + 1 > 2 * nreaders ? fd + 1 : 2 * nreaders;
+		MALLOC(readers, realloc(readers, n * sizeof(reader_t*)), "readers readerOf");
+		memset(readers + nreaders, 0, (n - nreaders) * sizeof(reader_t*));
+		nreaders = n;
+	}
+	if (!readers[fd]) {
+		MALLOC(readers[fd], malloc(sizeof(reader_t)), "reader readerOf");
+		initReader(readers[fd], CLIENT_BUFSIZE, 0, 0); // lato client i limiti non vengono usati
+	}
+	return readers[fd];
+}
 
 /**
  * @function openConnection
@@ -33,6 +70,7 @@
  *         -1 in caso di errore
  */
 int openConnection(char *path, unsigned int ntimes, unsigned int secs) {
+	reader_t *r;
 	int sock_fd = socket(AF_UNIX, SOCK_STREAM, 0);
 	if (sock_fd == -1) {
 		perror("socket");
@@ -48,12 +86,381 @@ int openConnection(char *path, unsigned int ntimes, unsigned int secs) {
 			sleep(secs);
 			continue;
 		}
+		r = readerOf(sock_fd); // il fd puo' essere stato usato da un'altra connessione
+		r->start   = 0;
+		r->len     = 0;
+		r->version = PROTO_V1;
 		return sock_fd;
 	}
 	perror("connect");
 	return -1;
 }
 
+/**
+ * @function setProtocol
+ * @brief    imposta la versione del protocollo usata su una connessione
+ *             lato client (ogni connessione parte da PROTO_V1)
+ *
+ * @param fd      descrittore della connessione
+ * @param version versione del protocollo
+ *
+ * @return -1 se la versione o il descrittore non sono validi
+ *          0 altrimenti
+ */
+int setProtocol(long fd, int version) {
+	reader_t *r;
+	if (version < PROTO_V1 || version > PROTO_LAST || !(r = readerOf(fd)))
+		return -1;
+	r->version = version;
+	return 0;
+}
+
+/**
+ * @function getProtocol
+ * @brief    restituisce la versione del protocollo usata su una connessione
+ *             lato client
+ *
+ * @param fd descrittore della connessione
+ *
+ * @return la versione del protocollo
+ */
+int getProtocol(long fd) {
+	return (fd >= 0 && fd < nreaders && readers[fd]) ? readers[fd]->version : PROTO_V1;
+}
+
+/**
+ * @function putVarint
+ * @brief    codifica un intero senza segno in base 128
+ *
+ * @param p buffer di almeno VARINT_MAX byte
+ * @param v valore da codificare
+ *
+ * @return il numero di byte scritti
+ */
+static size_t putVarint(char *p, unsigned int v) {
+	size_t n = 0;
+	while (v >= 0x80) {
+		p[n++] = (char)(v | 0x80);
+		v >>= 7;
+	}
+	p[n++] = (char)v;
+	return n;
+}
+
+/**
+ * @function getVarint
+ * @brief    decodifica un intero senza segno in base 128
+ *
+ * @param p   byte ricevuti
+ * @param len numero di byte ricevuti
+ * @param v   puntatore al valore decodificato
+ *
+ * @return -1 se il varint non e' valido (oltre 32 bit)
+ *          0 se servono altri byte
+ *          il numero di byte consumati altrimenti
+ */
+static int getVarint(const char *p, size_t len, unsigned int *v) {
+	unsigned char b;
+	*v = 0;
+	for (int i = 0; i < VARINT_MAX; ++i) {
+		if ((size_t)i >= len)
+			return 0;
+		b = (unsigned char)p[i];
+		if (i == VARINT_MAX - 1 && b > 0x0f) // restano solo 4 bit
+			return -1;
+		*v |= (unsigned int)(b & 0x7f) << (7 * i);
+		if (!(b & 0x80))
+			return i + 1;
+	}
+	return -1;
+}
+
+/**
+ * @function packName
+ * @brief    codifica un nome in PROTO_V2 (lunghezza e caratteri, senza terminatore)
+ *
+ * @param p    buffer di almeno VARINT_MAX + MAX_NAME_LENGTH byte
+ * @param name nome da codificare
+ *
+ * @return il numero di byte scritti
+ */
+static size_t packName(char *p, const char *name) {
+	size_t len = strnlen(name, MAX_NAME_LENGTH);
+	size_t n   = putVarint(p, len);
+	memcpy(p + n, name, len);
+	return n + len;
+}
+
+/**
+ * @function unpackName
+ * @brief    decodifica un nome in PROTO_V2
+ *
+ * @param p    byte ricevuti
+ * @param len  numero di byte ricevuti
+ * @param name buffer di MAX_NAME_LENGTH+1 byte (terminato in uscita)
+ *
+ * @return -1 se il nome non e' valido
+ *          0 se servono altri byte
+ *          il numero di byte consumati altrimenti
+ */
+static int unpackName(const char *p, size_t len, char *name) {
+	unsigned int nlen;
+	int          n;
+
+	if ((n = getVarint(p, len, &nlen)) <= 0)
+		return n;
+	if (nlen > MAX_NAME_LENGTH)
+		return -1;
+	if (len < n + nlen)
+		return 0;
+	memset(name, 0, MAX_NAME_LENGTH + 1);
+	memcpy(name, p + n, nlen);
+	return n + nlen;
+}
+
+/**
+ * @function packHdr
+ * @brief    codifica l'header del messaggio nel formato di una versione
+ *
+ * @param p       buffer di almeno PACK_MAXSIZE byte
+ * @param hdr     puntatore all'header
+ * @param version versione del protocollo
+ *
+ * @return il numero di byte scritti
+ */
+size_t packHdr(char *p, message_hdr_t *hdr, int version) {
+	if (version == PROTO_V1) {
+		memcpy(p, hdr, sizeof(message_hdr_t));
+		return sizeof(message_hdr_t);
+	}
+	p[0] = (char)hdr->op; // i codici delle operazioni sono minori di OP_END
+	return 1 + packName(p + 1, hdr->sender);
+}
+
+/**
+ * @function packDataHdr
+ * @brief    codifica l'header della parte dati nel formato di una versione
+ *
+ * @param p       buffer di almeno PACK_MAXSIZE byte
+ * @param hdr     puntatore all'header della parte dati
+ * @param version versione del protocollo
+ *
+ * @return il numero di byte scritti
+ */
+size_t packDataHdr(char *p, message_data_hdr_t *hdr, int version) {
+	size_t n;
+	if (version == PROTO_V1) {
+		memcpy(p, hdr, sizeof(message_data_hdr_t));
+		return sizeof(message_data_hdr_t);
+	}
+	n = packName(p, hdr->receiver);
+	if (version == PROTO_V3) // l'ultimo bit indica i dati compressi
+		return n + putVarint(p + n, (hdr->len & ~DATA_LZ) << 1 | (hdr->len & DATA_LZ ? 1 : 0));
+	return n + putVarint(p + n, hdr->len);
+}
+
+/**
+ * @function unpackHdr
+ * @brief    decodifica l'header del messaggio da un buffer
+ *
+ * @param p       byte ricevuti
+ * @param len     numero di byte ricevuti
+ * @param hdr     puntatore all'header da scrivere
+ * @param version versione del protocollo
+ *
+ * @return -1 se l'header non e' valido
+ *          0 se servono altri byte
+ *          il numero di byte consumati altrimenti
+ */
+int unpackHdr(const char *p, size_t len, message_hdr_t *hdr, int version) {
+	int n;
+	if (version == PROTO_V1) {
+		if (len < sizeof(message_hdr_t))
+			return 0;
+		memcpy(hdr, p, sizeof(message_hdr_t));
+		return sizeof(message_hdr_t);
+	}
+	if (len < 1)
+		return 0;
+	if ((n = unpackName(p + 1, len - 1, hdr->sender)) <= 0)
+		return n;
+	hdr->op = (unsigned char)p[0];
+	return 1 + n;
+}
+
+/**
+ * @function unpackDataHdr
+ * @brief    decodifica l'header della parte dati da un buffer
+ *
+ * @param p       byte ricevuti
+ * @param len     numero di byte ricevuti
+ * @param hdr     puntatore all'header della parte dati da scrivere
+ * @param version versione del protocollo
+ *
+ * @return -1 se l'header non e' valido
+ *          0 se servono altri byte
+ *          il numero di byte consumati altrimenti
+ */
+int unpackDataHdr(const char *p, size_t len, message_data_hdr_t *hdr, int version) {
+	int n, m;
+	if (version == PROTO_V1) {
+		if (len < sizeof(message_data_hdr_t))
+			return 0;
+		memcpy(hdr, p, sizeof(message_data_hdr_t));
+		return sizeof(message_data_hdr_t);
+	}
+	if ((n = unpackName(p, len, hdr->receiver)) <= 0)
+		return n;
+	if ((m = getVarint(p + n, len - n, &(hdr->len))) <= 0)
+		return m;
+	if (version == PROTO_V3)
+		hdr->len = hdr->len >> 1 | (hdr->len & 1 ? DATA_LZ : 0);
+	return n + m;
+}
+
+/**
+ * @function compressData
+ * @brief    comprime la parte dati di un messaggio per PROTO_V3, se e' lunga
+ *             almeno LZ_MINSIZE byte e la compressione la accorcia
+ *
+ * @param data puntatore alla parte dati da inviare
+ * @param z    puntatore alla parte dati compressa da scrivere (hdr.len con
+ *               DATA_LZ), z->buf deve contenere data->hdr.len byte
+ *
+ * @return 1 se i dati sono stati compressi in z
+ *         0 se vanno inviati cosi' come sono
+ */
+int compressData(message_data_t *data, message_data_t *z) {
+	size_t n, m;
+
+	if (data->hdr.len < LZ_MINSIZE)
+		return 0;
+	n = putVarint(z->buf, data->hdr.len);
+	if ((m = lzCompress(data->buf, data->hdr.len, z->buf + n, data->hdr.len - n - 1)) == 0)
+		return 0; // non si accorcia
+	z->hdr     = data->hdr;
+	z->hdr.len = (n + m) | DATA_LZ;
+	return 1;
+}
+
+/**
+ * @function expandedLen
+ * @brief    restituisce la lunghezza originale dei dati compressi ricevuti
+ *
+ * @param data puntatore alla parte dati (hdr.len senza DATA_LZ)
+ *
+ * @return -1 se i dati compressi non sono validi
+ *         la lunghezza originale altrimenti
+ */
+long expandedLen(message_data_t *data) {
+	unsigned int len;
+	if (getVarint(data->buf, data->hdr.len, &len) <= 0 || len < LZ_MINSIZE || len >= DATA_LZ)
+		return -1;
+	return len;
+}
+
+/**
+ * @function expandData
+ * @brief    decomprime i dati ricevuti
+ *
+ * @param data puntatore alla parte dati (hdr.len senza DATA_LZ)
+ * @param buf  buffer in cui scrivere i dati originali
+ * @param len  lunghezza originale (vedi expandedLen)
+ *
+ * @return -1 se i dati compressi non sono validi
+ *          0 altrimenti
+ */
+int expandData(message_data_t *data, char *buf, unsigned int len) {
+	unsigned int orig;
+	int          n = getVarint(data->buf, data->hdr.len, &orig);
+	if (n <= 0 || orig != len || lzExpand(data->buf + n, data->hdr.len - n, buf, len) != (long)len)
+		return -1;
+	return 0;
+}
+
+/**
+ * @function fillReader
+ * @brief    legge dalla connessione, con una sola chiamata, i byte
+ *             disponibili (fino al riempimento del buffer di ricezione)
+ *
+ * @param fd descrittore della connessione
+ * @param r  puntatore al buffer di ricezione
+ *
+ * @return <=0 se c'e' stato un errore
+ *         (se <0 errno deve essere settato, se == 0 connessione chiusa)
+ *         il numero di byte letti altrimenti
+ */
+static int fillReader(long fd, reader_t *r) {
+	size_t avail;
+	char  *space = readerSpace(r, &avail);
+	int    n;
+	while ((n = read((int)fd, space, avail)) == -1 && errno == EINTR);
+	if (n > 0)
+		readerCommit(r, n);
+	return n;
+}
+
+/**
+ * @function readPacked
+ * @brief    decodifica un header dai byte ricevuti, leggendo dalla
+ *             connessione solo se sono incompleti
+ *
+ * @param fd   descrittore della connessione
+ * @param data 0 per l'header del messaggio, 1 per quello della parte dati
+ * @param hdr  puntatore all'header da scrivere
+ *
+ * @return <=0 se c'e' stato un errore
+ *         (se <0 errno deve essere settato, se == 0 connessione chiusa)
+ */
+static int readPacked(long fd, int data, void *hdr) {
+	reader_t *r = readerOf(fd);
+	int       n;
+
+	if (!r) {
+		errno = EBADF;
+		return -1;
+	}
+	while ((n = data ? unpackDataHdr(r->buf + r->start, r->len, hdr, r->version)
+	                 : unpackHdr(r->buf + r->start, r->len, hdr, r->version)) == 0)
+		if ((n = fillReader(fd, r)) <= 0)
+			return n;
+	if (n == -1) {
+		errno = EPROTO;
+		return -1;
+	}
+	r->start += n;
+	r->len   -= n;
+	return n;
+}
+
+/**
+ * @function readBuffered
+ * @brief    legge esattamente size byte, prima dal buffer di ricezione
+ *             e poi, per il resto, direttamente dalla connessione
+ *
+ * @param fd   descrittore della connessione
+ * @param buf  buffer nel quale salvare i dati
+ * @param size numero di byte da leggere
+ *
+ * @return <=0 se c'e' stato un errore
+ *         (se <0 errno deve essere settato, se == 0 connessione chiusa)
+ */
+static int readBuffered(long fd, char *buf, size_t size) {
+	reader_t *r = readerOf(fd);
+	size_t    n = r->len < size ? r->len : size;
+	int       m;
+
+	memcpy(buf, r->buf + r->start, n);
+	r->start += n;
+	r->len   -= n;
+	if (n == size)
+		return size;
+	// i dati piu' grandi del buffer non vengono copiati due volte
+	if ((m = readn((int)fd, buf + n, size - n)) <= 0)
+		return m;
+	return size;
+}
+
 /**
  * @function readHeader
  * @brief    Legge l'header del messaggio
@@ -65,7 +472,7 @@ int openConnection(char *path, unsigned int ntimes, unsigned int secs) {
  *         (se <0 errno deve essere settato, se == 0 connessione chiusa)
  */
 int readHeader(long fd, message_hdr_t *hdr) {
-	return readn((int)fd, hdr, sizeof(message_hdr_t));
+	return readPacked(fd, 0, hdr);
 }
 
 /**
@@ -79,16 +486,37 @@ int readHeader(long fd, message_hdr_t *hdr) {
  *         (se <0 errno deve essere settato, se == 0 connessione chiusa)
  */
 int readData(long fd, message_data_t *data) {
-	int n = readn((int)fd, &(data->hdr), sizeof(message_data_hdr_t));
+	int   n = readPacked(fd, 1, &(data->hdr));
+	int   lz;
+	long  len;
+	char *buf;
 	if (n == -1)
 		return -1;
 
+	lz = getProtocol(fd) == PROTO_V3 && (data->hdr.len & DATA_LZ);
+	if (lz)
+		data->hdr.len &= ~DATA_LZ;
 	if (n == 0 || data->hdr.len == 0) // non devo leggere dati
 		return n;
 	
 	MALLOC(data->buf, malloc(data->hdr.len), "data readData");
 	
-	return readn((int)fd, data->buf, data->hdr.len);
+	if ((n = readBuffered(fd, data->buf, data->hdr.len)) <= 0 || !lz)
+		return n;
+	if ((len = expandedLen(data)) == -1) {
+		errno = EPROTO;
+		return -1;
+	}
+	MALLOC(buf, malloc(len), "buf readData");
+	if (expandData(data, buf, len) == -1) {
+		free(buf);
+		errno = EPROTO;
+		return -1;
+	}
+	free(data->buf);
+	data->buf     = buf;
+	data->hdr.len = len;
+	return n;
 }
 
 /**
@@ -108,6 +536,55 @@ int readMsg(long fd, message_t *msg) {
 	return n;
 }
 
+/**
+ * @function initReader
+ * @brief    inizializza il parser incrementale di una connessione
+ *
+ * @param r    puntatore al parser
+ * @param size dimensione del buffer di ricezione
+ * @param max  dimensione massima del testo di un messaggio
+ * @param fmax dimensione massima del contenuto di un file
+ */
+void initReader(reader_t *r, size_t size, unsigned int max, unsigned int fmax) {
+	memset(r, 0, sizeof(reader_t));
+	MALLOC(r->buf, malloc(size), "buf initReader");
+	r->size    = size;
+	r->max     = max;
+	r->fmax    = fmax;
+	r->state   = R_HDR;
+	r->version = PROTO_V1;
+}
+
+/**
+ * @function readerSpace
+ * @brief    restituisce lo spazio libero in fondo al buffer di ricezione,
+ *             per riempirlo con una ricezione asincrona (vedi readerCommit)
+ *
+ * @param r     puntatore al parser
+ * @param avail puntatore al numero di byte liberi
+ *
+ * @return il puntatore al primo byte libero
+ */
+char *readerSpace(reader_t *r, size_t *avail) {
+	if (r->start > 0) { // compatto i byte non ancora analizzati
+		memmove(r->buf, r->buf + r->start, r->len);
+		r->start = 0;
+	}
+	*avail = r->size - r->len;
+	return r->buf + r->len;
+}
+
+/**
+ * @function readerCommit
+ * @brief    registra n byte ricevuti nello spazio restituito da readerSpace
+ *
+ * @param r puntatore al parser
+ * @param n numero di byte ricevuti
+ */
+void readerCommit(reader_t *r, size_t n) {
+	r->len += n;
+}
+
 /**
  * @function sendHeader
  * @brief    invia l'header del messaggio
@@ -119,7 +596,29 @@ int readMsg(long fd, message_t *msg) {
  *         (se <0 errno deve essere settato, se == 0 connessione chiusa)
  */
 int sendHeader(long fd, message_hdr_t *hdr) {
-	return writen((int)fd, hdr, sizeof(message_hdr_t));
+	char p[PACK_MAXSIZE];
+	return writen((int)fd, p, packHdr(p, hdr, getProtocol(fd)));
+}
+
+/**
+ * @function compressOut
+ * @brief    comprime i dati da inviare, se la connessione usa PROTO_V3
+ *
+ * @param fd   descrittore della connessione
+ * @param data puntatore ai dati del messaggio
+ * @param z    puntatore ai dati compressi da scrivere (buffer da liberare)
+ *
+ * @return 1 se i dati sono stati compressi in z
+ *         0 altrimenti
+ */
+static int compressOut(long fd, message_data_t *data, message_data_t *z) {
+	if (getProtocol(fd) != PROTO_V3 || data->hdr.len < LZ_MINSIZE)
+		return 0;
+	MALLOC(z->buf, malloc(data->hdr.len), "buf compressOut");
+	if (compressData(data, z))
+		return 1;
+	free(z->buf);
+	return 0;
 }
 
 /**
@@ -132,16 +631,22 @@ int sendHeader(long fd, message_hdr_t *hdr) {
  * @return <=0 se c'e' stato un errore
  */
 int sendData(long fd, message_data_t *data) {
-	// invio l'header, per far sapere la lunghezza dei dati al client
-	int n = writen((int)fd, &(data->hdr), sizeof(message_data_hdr_t));
-	if (n == -1)
-		return -1;
-
-	if (data->hdr.len == 0) // non ho dati da inviare
-		return n;
-
-	// invio i dati
-	return writen((int)fd, data->buf, data->hdr.len);
+	// l'header, per far sapere la lunghezza dei dati al client, e i dati con una sola writev
+	char           p[PACK_MAXSIZE];
+	struct iovec   iov[2];
+	message_data_t z;
+	int            lz = compressOut(fd, data, &z);
+	int            n;
+	if (lz) // in PROTO_V3 i dati lunghi viaggiano compressi
+		data = &z;
+	iov[0].iov_base = p;
+	iov[0].iov_len  = packDataHdr(p, &(data->hdr), getProtocol(fd));
+	iov[1].iov_base = data->buf;
+	iov[1].iov_len  = data->hdr.len & ~DATA_LZ;
+	n = writevn((int)fd, iov, iov[1].iov_len > 0 ? 2 : 1);
+	if (lz)
+		free(z.buf);
+	return n;
 }
 
 /**
@@ -154,10 +659,25 @@ int sendData(long fd, message_data_t *data) {
  * @return <= 0 se c'e' stato un errore
  */
 int sendMsg(long fd, message_t *msg) {
-	int n = sendHeader(fd, &(msg->hdr));
-	if (n > 0)
-		n += sendData(fd, &(msg->data));
-	return n;
+	// i due header, codificati insieme, e i dati con una sola writev
+	char            p[2 * PACK_MAXSIZE];
+	struct iovec    iov[2];
+	int             version = getProtocol(fd);
+	size_t          n       = packHdr(p, &(msg->hdr), version);
+	message_data_t  z;
+	message_data_t *data = &(msg->data);
+	int             lz   = compressOut(fd, data, &z);
+	int             m;
+	if (lz) // in PROTO_V3 i dati lunghi viaggiano compressi
+		data = &z;
+	iov[0].iov_base = p;
+	iov[0].iov_len  = n + packDataHdr(p + n, &(data->hdr), version);
+	iov[1].iov_base = data->buf;
+	iov[1].iov_len  = data->hdr.len & ~DATA_LZ;
+	m = writevn((int)fd, iov, iov[1].iov_len > 0 ? 2 : 1);
+	if (lz)
+		free(z.buf);
+	return m;
 }
 
 /**
@@ -189,3 +709,41 @@ int sendOp(long fd, op_t op) {
 int sendRequest(long fd, message_t *msg) {
 	return sendMsg(fd, msg);
 }
+
+/**
+ * @function helloServer
+ * @brief    negozia con il server la versione del protocollo: la richiesta
+ *             e la risposta viaggiano nella versione corrente, i messaggi
+ *             successivi nella nuova. Va chiamata subito dopo openConnection,
+ *             prima di ogni altra richiesta
+ *
+ * @param fd      descrittore della connessione
+ * @param version versione richiesta
+ *
+ * @return <=0 se c'e' stato un errore o il server ha rifiutato la versione
+ *         1 altrimenti
+ */
+int helloServer(long fd, int version) {
+	message_t     msg;
+	message_hdr_t reply;
+	char          v = (char)version;
+	int           n;
+
+	if (version < PROTO_V1 || version > PROTO_LAST) { // versione non gestita
+		errno = EINVAL;
+		return -1;
+	}
+	memset(&msg, 0, sizeof(message_t));
+	msg.hdr.op = HELLO_OP;
+	setData(&(msg.data), "", &v, 1);
+	if ((n = sendRequest(fd, &msg)) <= 0)
+		return n;
+	if ((n = readHeader(fd, &reply)) <= 0)
+		return n;
+	if (reply.op != OP_OK) { // versione non supportata
+		errno = EPROTONOSUPPORT;
+		return -1;
+	}
+	setProtocol(fd, version);
+	return 1;
+}
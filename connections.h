@@ -17,6 +17,32 @@
 
 #include <message.h>
 
+// versioni del protocollo, negoziate per connessione con HELLO_OP
+#define PROTO_V1     1  // header a dimensione fissa (message_hdr_t e message_data_hdr_t)
+#define PROTO_V2     2  // header compatti: lunghezze varint e nomi di lunghezza variabile
+#define PROTO_V3     3  // header compatti e dati compressi oltre LZ_MINSIZE byte (vedi lz.h)
+#define PROTO_LAST   PROTO_V3
+#define PACK_MAXSIZE 64 // dimensione massima di un header codificato, in ogni versione
+
+#define LZ_MINSIZE   256 // dati piu' corti di questa soglia non vengono compressi
+#define DATA_LZ      0x80000000u // in hdr.len: dati compressi (solo PROTO_V3)
+
+/*
+ * Formato PROTO_V2 (varint in base 128, a partire dai 7 bit meno significativi):
+ *   header       op (1 byte) | varint lunghezza mittente | mittente
+ *   header dati  varint lunghezza destinatario | destinatario | varint len
+ * i nomi non sono terminati, i dati (len byte) seguono come in PROTO_V1
+ *
+ * PROTO_V3 codifica la lunghezza dei dati come varint (len << 1 | z): se z vale 1
+ * i len byte di dati sono la varint della lunghezza originale seguita dai dati
+ * compressi. Dopo unpackDataHdr z e' il bit DATA_LZ di hdr.len
+ *
+ * I dati di una POSTBATCH_OP sono una sequenza di messaggi, ognuno con il
+ * proprio header dati in PROTO_V2 seguito dal testo, in ogni versione.
+ */
+#define BATCH_PROTO  PROTO_V2 // codifica degli header dati dei messaggi di un lotto
+#define BATCH_MAXMSGS 64      // messaggi al piu' in un lotto (il server rifiuta i lotti piu' lunghi)
+
 /**
  * @file   connections.h
  * @brief  Contiene le funzioni che implementano il protocollo 
@@ -76,6 +102,217 @@ int readData(long fd, message_data_t *data);
  */
 int readMsg(long fd, message_t *msg);
 
+/**
+ * @function setProtocol
+ * @brief    imposta la versione del protocollo usata su una connessione
+ *             lato client (ogni connessione parte da PROTO_V1)
+ *
+ * @param fd      descrittore della connessione
+ * @param version versione del protocollo
+ *
+ * @return -1 se la versione o il descrittore non sono validi
+ *          0 altrimenti
+ */
+int setProtocol(long fd, int version);
+
+/**
+ * @function getProtocol
+ * @brief    restituisce la versione del protocollo usata su una connessione
+ *             lato client
+ *
+ * @param fd descrittore della connessione
+ *
+ * @return la versione del protocollo
+ */
+int getProtocol(long fd);
+
+/**
+ * @function helloServer
+ * @brief    negozia con il server la versione del protocollo: la richiesta
+ *             e la risposta viaggiano nella versione corrente, i messaggi
+ *             successivi nella nuova. Va chiamata subito dopo openConnection,
+ *             prima di ogni altra richiesta
+ *
+ * @param fd      descrittore della connessione
+ * @param version versione richiesta
+ *
+ * @return <=0 se c'e' stato un errore o il server ha rifiutato la versione
+ *         1 altrimenti
+ */
+int helloServer(long fd, int version);
+
+/**
+ * @function packHdr
+ * @brief    codifica l'header del messaggio nel formato di una versione
+ *
+ * @param p       buffer di almeno PACK_MAXSIZE byte
+ * @param hdr     puntatore all'header
+ * @param version versione del protocollo
+ *
+ * @return il numero di byte scritti
+ */
+size_t packHdr(char *p, message_hdr_t *hdr, int version);
+
+/**
+ * @function packDataHdr
+ * @brief    codifica l'header della parte dati nel formato di una versione
+ *
+ * @param p       buffer di almeno PACK_MAXSIZE byte
+ * @param hdr     puntatore all'header della parte dati
+ * @param version versione del protocollo
+ *
+ * @return il numero di byte scritti
+ */
+size_t packDataHdr(char *p, message_data_hdr_t *hdr, int version);
+
+/**
+ * @function unpackHdr
+ * @brief    decodifica l'header del messaggio da un buffer
+ *
+ * @param p       byte ricevuti
+ * @param len     numero di byte ricevuti
+ * @param hdr     puntatore all'header da scrivere
+ * @param version versione del protocollo
+ *
+ * @return -1 se l'header non e' valido
+ *          0 se servono altri byte
+ *          il numero di byte consumati altrimenti
+ */
+int unpackHdr(const char *p, size_t len, message_hdr_t *hdr, int version);
+
+/**
+ * @function unpackDataHdr
+ * @brief    decodifica l'header della parte dati da un buffer
+ *
+ * @param p       byte ricevuti
+ * @param len     numero di byte ricevuti
+ * @param hdr     puntatore all'header della parte dati da scrivere
+ * @param version versione del protocollo
+ *
+ * @return -1 se l'header non e' valido
+ *          0 se servono altri byte
+ *          il numero di byte consumati altrimenti
+ */
+int unpackDataHdr(const char *p, size_t len, message_data_hdr_t *hdr, int version);
+
+/**
+ * @function compressData
+ * @brief    comprime la parte dati di un messaggio per PROTO_V3, se e' lunga
+ *             almeno LZ_MINSIZE byte e la compressione la accorcia
+ *
+ * @param data puntatore alla parte dati da inviare
+ * @param z    puntatore alla parte dati compressa da scrivere (hdr.len con
+ *               DATA_LZ), z->buf deve contenere data->hdr.len byte
+ *
+ * @return 1 se i dati sono stati compressi in z
+ *         0 se vanno inviati cosi' come sono
+ */
+int compressData(message_data_t *data, message_data_t *z);
+
+/**
+ * @function expandedLen
+ * @brief    restituisce la lunghezza originale dei dati compressi ricevuti
+ *
+ * @param data puntatore alla parte dati (hdr.len senza DATA_LZ)
+ *
+ * @return -1 se i dati compressi non sono validi
+ *         la lunghezza originale altrimenti
+ */
+long expandedLen(message_data_t *data);
+
+/**
+ * @function expandData
+ * @brief    decomprime i dati ricevuti
+ *
+ * @param data puntatore alla parte dati (hdr.len senza DATA_LZ)
+ * @param buf  buffer in cui scrivere i dati originali
+ * @param len  lunghezza originale (vedi expandedLen)
+ *
+ * @return -1 se i dati compressi non sono validi
+ *          0 altrimenti
+ */
+int expandData(message_data_t *data, char *buf, unsigned int len);
+
+/**
+ * @enum  rstate_t
+ * @brief parte del messaggio che il parser incrementale sta ricevendo
+ */
+typedef enum {
+	R_HDR,      // header del messaggio
+	R_DATAHDR,  // header della parte dati
+	R_DATA,     // dati
+	R_FILEHDR,  // header della seconda parte dati (solo POSTFILE_OP)
+	R_FILE,     // contenuto del file (solo POSTFILE_OP)
+	R_ERROR     // messaggio non valido, la connessione va chiusa
+} rstate_t;
+
+/**
+ * @struct reader_t
+ * @brief  stato del parser incrementale dei messaggi ricevuti su una connessione
+ *
+ * @var buf     buffer di ricezione
+ * @var start   posizione del primo byte non ancora analizzato
+ * @var len     numero di byte ricevuti e non ancora analizzati
+ * @var size    dimensione del buffer
+ * @var max     dimensione massima del testo di un messaggio (per un lotto, di
+ *                ognuno dei suoi messaggi): oltre questa soglia i dati vengono
+ *                scartati (resta valida la lunghezza dichiarata)
+ * @var fmax    dimensione massima del contenuto di un file (seconda parte dati),
+ *                scartato allo stesso modo
+ * @var state   parte del messaggio in ricezione
+ * @var got     byte gia' ricevuti della parte corrente
+ * @var version versione del protocollo dei messaggi ricevuti
+ * @var lz      1 se la parte dati corrente e' compressa (PROTO_V3)
+ * @var msg     messaggio in costruzione
+ * @var file    seconda parte dati del messaggio in costruzione (solo POSTFILE_OP)
+ */
+typedef struct {
+	char          *buf;
+	size_t         start;
+	size_t         len;
+	size_t         size;
+	unsigned int   max;
+	unsigned int   fmax;
+	rstate_t       state;
+	size_t         got;
+	int            version;
+	int            lz;
+	message_t      msg;
+	message_data_t file;
+} reader_t;
+
+/**
+ * @function initReader
+ * @brief    inizializza il parser incrementale di una connessione
+ *
+ * @param r    puntatore al parser
+ * @param size dimensione del buffer di ricezione
+ * @param max  dimensione massima del testo di un messaggio
+ * @param fmax dimensione massima del contenuto di un file
+ */
+void initReader(reader_t *r, size_t size, unsigned int max, unsigned int fmax);
+
+/**
+ * @function readerSpace
+ * @brief    restituisce lo spazio libero in fondo al buffer di ricezione,
+ *             per riempirlo con una ricezione asincrona (vedi readerCommit)
+ *
+ * @param r     puntatore al parser
+ * @param avail puntatore al numero di byte liberi
+ *
+ * @return il puntatore al primo byte libero
+ */
+char *readerSpace(reader_t *r, size_t *avail);
+
+/**
+ * @function readerCommit
+ * @brief    registra n byte ricevuti nello spazio restituito da readerSpace
+ *
+ * @param r puntatore al parser
+ * @param n numero di byte ricevuti
+ */
+void readerCommit(reader_t *r, size_t n);
+
 /**
  * @function sendHeader
  * @brief    invia l'header del messaggio
@@ -8,6 +8,7 @@
 #include <config.h>
 #include <message.h>
 #include <groups.h>
+#include <names.h>
 
 /**
  * @file   groups.c
@@ -33,13 +34,29 @@ void initGroups() {
 	// inizializzo i gruppi
 	MALLOC(groups, malloc(MaxGroups * sizeof(group_t)), "groups initHash");
 	for (int i = 0; i < MaxGroups; ++i) {
-		MALLOC(groups[i].name, malloc(MAX_NAME_LENGTH + 1), "groups name");
-		MALLOC(groups[i].creator, malloc(MAX_NAME_LENGTH + 1), "groups creator");
-		groups[i].members = NULL;
+		groups[i].name     = -1;
+		groups[i].creator  = -1;
+		groups[i].members  = NULL;
 		groups[i].nmembers = 0;
 	}
 }
 
+/**
+ * @function findGroup
+ * @brief    cerca un gruppo (con groups_mutex acquisita)
+ * 
+ * @param id l'id del nome del gruppo
+ * 
+ * @return MaxGroups se il gruppo non esiste
+ *         la posizione del gruppo altrimenti
+ */
+static int findGroup(int id) {
+	int i = 0;
+	while (i < MaxGroups && (groups[i].nmembers == 0 || groups[i].name != id))
+		i++;
+	return i;
+}
+
 /**
  * @function createGroup
  * #brief    crea un nuovo gruppo
@@ -63,11 +80,10 @@ int createGroup(char *groupName, char *creator) {
 		return -1;
 	}
 	// imposto il nome del gruppo e il creatore
-	strncpy(groups[i].name, groupName, MAX_NAME_LENGTH + 1);
-	strncpy(groups[i].creator, creator, MAX_NAME_LENGTH + 1);
+	groups[i].name    = nameId(groupName);
+	groups[i].creator = nameId(creator);
 	MALLOC(name, malloc(sizeof(member_t)), "name createGroup");
-	MALLOC(name->nick, malloc(MAX_NAME_LENGTH + 1), "name.nick createGroup");
-	strncpy(name->nick, creator, MAX_NAME_LENGTH + 1);
+	name->id   = groups[i].creator;
 	name->next = NULL;
 	groups[i].members = name;
 	groups[i].nmembers++;
@@ -88,13 +104,11 @@ int createGroup(char *groupName, char *creator) {
  */
 int addToGroup(char *groupName, char *user) {
 	member_t *new, *tmp;
-	int       i = 0;
+	int       i, id = nameId(user);
 
 	// cerco il gruppo
 	pthread_mutex_lock(&groups_mutex);
-	while (i < MaxGroups && (groups[i].nmembers == 0 || strncmp(groups[i].name, groupName, MAX_NAME_LENGTH + 1) != 0))
-		i++;
-	if (i == MaxGroups) { // gruppo non trovato
+	if ((i = findGroup(nameId(groupName))) == MaxGroups) { // gruppo non trovato
 		pthread_mutex_unlock(&groups_mutex);
 		return 0;
 	}
@@ -102,7 +116,7 @@ int addToGroup(char *groupName, char *user) {
 	// controllo che non sia gia' presente all'interno del gruppo
 	tmp = groups[i].members;
 	while (tmp) {
-		if (strncmp(tmp->nick, user, MAX_NAME_LENGTH + 1) == 0)
+		if (tmp->id == id)
 			break;
 		tmp = tmp->next;
 	}
@@ -112,8 +126,7 @@ int addToGroup(char *groupName, char *user) {
 	}
 
 	MALLOC(new, malloc(sizeof(member_t)), "new addToGroup");
-	MALLOC(new->nick, malloc(MAX_NAME_LENGTH + 1), "new->nick addToGroup");
-	strncpy(new->nick, user, MAX_NAME_LENGTH + 1);
+	new->id   = id;
 	new->next = groups[i].members;
 	groups[i].members = new;
 	groups[i].nmembers++;
@@ -133,21 +146,18 @@ int addToGroup(char *groupName, char *user) {
  *        -1 se l'utente non appartiene al gruppo
  */
 int removeFromGroup(char *groupName, char *user) {
-	int i = 0;
+	int i, id = nameId(user);
 	member_t *member, *prev = NULL, *tmp;
 
 	// cerco il gruppo 
 	pthread_mutex_lock(&groups_mutex);
-	while (strncmp(groups[i].name, groupName, MAX_NAME_LENGTH + 1) != 0)
-		i++;
-
-	if (i == MaxGroups) { // gruppo non trovato
+	if ((i = findGroup(nameId(groupName))) == MaxGroups) { // gruppo non trovato
 		pthread_mutex_unlock(&groups_mutex);
 		return 0;
 	}
 
 	// il creatore sta abbandonando il gruppo e non ci sono "eredi"
-	if (strncmp(groups[i].creator, user, MAX_NAME_LENGTH + 1) == 0 && groups[i].nmembers == 1) {
+	if (groups[i].creator == id && groups[i].nmembers == 1) {
 		pthread_mutex_unlock(&groups_mutex);
 		return deleteGroup(groupName, user);
 	}
@@ -155,7 +165,7 @@ int removeFromGroup(char *groupName, char *user) {
 	// cancello l'utente
 	member = groups[i].members;
 	while (member) {
-		if (strncmp(member->nick, user, MAX_NAME_LENGTH + 1) == 0) // utente trovato
+		if (member->id == id) // utente trovato
 			break;
 		prev = member;
 		member = member->next;
@@ -167,24 +177,22 @@ int removeFromGroup(char *groupName, char *user) {
 	if (!prev) { // devo cancellare la testa della lista
 		tmp = member;
 		groups[i].members = member->next;
-		free(tmp->nick);
 		free(tmp);
 
 		/* se il creatore si sta cancellando, eredita i diritti
 		   l'utente che si e' iscritto subito dopo di lui */
-		if (strncmp(groups[i].creator, user, MAX_NAME_LENGTH + 1) == 0)
-			strncpy(groups[i].creator, groups[i].members->nick, MAX_NAME_LENGTH + 1);
+		if (groups[i].creator == id)
+			groups[i].creator = groups[i].members->id;
 	}
 	else { // elemento centrale
 		tmp = member;
 		prev->next = member->next;
-		free(member->next);
-		free(member);
+		free(tmp);
 
 		/* se il creatore si sta cancellando, eredita i diritti
 		   l'utente che si e' iscritto subito dopo di lui */
-		if (strncmp(groups[i].creator, user, MAX_NAME_LENGTH + 1) == 0)
-			strncpy(groups[i].creator, prev->nick, MAX_NAME_LENGTH + 1);
+		if (groups[i].creator == id)
+			groups[i].creator = prev->id;
 	}
 	groups[i].nmembers--;
 	pthread_mutex_unlock(&groups_mutex);
@@ -203,21 +211,18 @@ int removeFromGroup(char *groupName, char *user) {
  *        -1 se user non e' il creatore del gruppo
  */
 int deleteGroup(char *groupName, char *user) {
-	int i = 0;
+	int i;
 	member_t *member, *tmp;
 	
 	// cerco il gruppo 
 	pthread_mutex_lock(&groups_mutex);
-	while (strncmp(groups[i].name, groupName, MAX_NAME_LENGTH + 1) != 0)
-		i++;
-
-	if (i == MaxGroups) { // gruppo non trovato
+	if ((i = findGroup(nameId(groupName))) == MaxGroups) { // gruppo non trovato
 		pthread_mutex_unlock(&groups_mutex);
 		return 0;
 	}
 	
 	// controllo che l'operazione sia richiesta dal creatore del gruppo
-	if (strncmp(groups[i].creator, user, MAX_NAME_LENGTH + 1) != 0) {
+	if (groups[i].creator != nameId(user)) {
 		pthread_mutex_unlock(&groups_mutex);
 		return -1;
 	}
@@ -225,7 +230,6 @@ int deleteGroup(char *groupName, char *user) {
 	// cancello tutto il gruppo
 	member = groups[i].members;
 	while (member) {
-		free(member->nick);
 		tmp = member;
 		member = member->next;
 		free(tmp);
@@ -248,29 +252,23 @@ int deleteGroup(char *groupName, char *user) {
  * @return -1 se il gruppo non esiste
  *           i > 0 il numero di membri del gruppo
  */
-int getMembers(char *groupName, char ***list) {
-	int       i = 0;
-	char    **local_list;
+int getMembers(char *groupName, int **list) {
+	int       i;
+	int      *local_list;
 	member_t *tmp;
 
 	// cerco il gruppo
 	pthread_mutex_lock(&groups_mutex);
-	while (strncmp(groups[i].name, groupName, MAX_NAME_LENGTH + 1))
-		i++;
-	
-	if (i == MaxGroups) { // gruppo non trovato
+	if ((i = findGroup(nameId(groupName))) == MaxGroups) { // gruppo non trovato
 		pthread_mutex_unlock(&groups_mutex);
 		return -1;
 	}
 	
-	MALLOC(local_list, malloc(groups[i].nmembers * sizeof(char*)), "local_list getMembers");
-	for (int j = 0; j < groups[i].nmembers; ++j)
-		MALLOC(local_list[j], malloc(MAX_NAME_LENGTH + 1), "local_list getMembers")
-
+	MALLOC(local_list, malloc(groups[i].nmembers * sizeof(int)), "local_list getMembers");
 	tmp = groups[i].members;
 	i = 0;
 	while (tmp) {
-		strncpy(local_list[i++], tmp->nick, MAX_NAME_LENGTH + 1);
+		local_list[i++] = tmp->id;
 		tmp = tmp->next;
 	}
 	*list = local_list;
@@ -287,11 +285,8 @@ void freeGroups() {
 	member_t *name_elem, *name_tmp;
 	// cleanup
 	for (int i = 0; i < MaxGroups; ++i) {
-		free(groups[i].name);
-		free(groups[i].creator);
 		name_elem = groups[i].members;
 		while (name_elem) {
-			free(name_elem->nick);
 			name_tmp = name_elem;
 			name_elem = name_elem->next;
 			free(name_tmp);
@@ -15,11 +15,11 @@
  * @struct member
  * @brief  membro di un gruppo
  * 
- * @var nick nome del membro
+ * @var id   id del nome del membro (vedi names.h)
  * @var next puntatore al prossimo membro
  */
 typedef struct member {
-	char          *nick;
+	int            id;
 	struct member *next;
 } member_t;
 
@@ -27,14 +27,14 @@ typedef struct member {
  * @struct group_t
  * @brief  dati di un gruppo
  * 
- * @var name     nome del gruppo
- * @var creator  nome del creatore del gruppo
+ * @var name     id del nome del gruppo
+ * @var creator  id del nome del creatore del gruppo
  * @var members  lista di membri del gruppo
- * @var nmembers numero di membri del gruppo
+ * @var nmembers numero di membri del gruppo (0 se la posizione e' libera)
  */
 typedef struct {
-	char     *name;
-	char     *creator;
+	int       name;
+	int       creator;
 	member_t *members;
 	int       nmembers;
 } group_t;
@@ -102,12 +102,12 @@ int deleteGroup(char *groupName, char *user);
  * @brief    crea la lista dei membri del gruppo
  * 
  * @param groupName il nome del gruppo
- * @param list puntatore all'array di stringhe
+ * @param list puntatore all'array degli id dei membri
  * 
  * @return -1 se il gruppo non esiste
  *           i > 0 il numero di membri del gruppo
  */
-int getMembers(char *groupName, char ***list);
+int getMembers(char *groupName, int **list);
 
 /**
  * @function freeGroups
@@ -0,0 +1,152 @@
+#include <string.h>
+
+#include <lz.h>
+
+/**
+ * @file   lz.c
+ * @brief  Contiene un compressore LZ77 veloce (formato a token, nello stile
+ *           di LZF), usato per i dati dei messaggi in PROTO_V3
+ * @author Michele Zoncheddu 545227
+ *
+ * Si dichiara che il contenuto di questo file e'
+ *   in ogni sua parte opera originale dell'autore
+ */
+
+/**
+ * @function lzHash
+ * @brief    calcola la posizione nella tabella hash dei prossimi 3 byte
+ *
+ * @param p puntatore ai 3 byte
+ *
+ * @return l'indice nella tabella
+ */
+static inline unsigned int lzHash(const unsigned char *p) {
+	unsigned int v = (unsigned int)p[0] << 16 | (unsigned int)p[1] << 8 | p[2];
+	return (v * 2654435761u) >> (32 - LZ_HLOG);
+}
+
+/**
+ * @function lzCompress
+ * @brief    comprime un buffer
+ *
+ * @param in  dati da comprimere
+ * @param n   dimensione dei dati
+ * @param out buffer in cui scrivere i dati compressi
+ * @param max dimensione del buffer
+ *
+ * @return 0 se i dati compressi non entrano nel buffer
+ *         la dimensione dei dati compressi altrimenti
+ */
+size_t lzCompress(const char *in, size_t n, char *out, size_t max) {
+	const unsigned char *ip  = (const unsigned char*)in;
+	const unsigned char *end = ip + n;
+	const unsigned char *ref;
+	unsigned char *op  = (unsigned char*)out;
+	unsigned char *ctl;     // byte di controllo dei letterali in corso
+	size_t         htab[1 << LZ_HLOG]; // ultima posizione (+1) di ogni hash
+	size_t         len, lim, off;
+	unsigned int   lit = 0; // letterali in corso
+
+	if (max < 2)
+		return 0;
+	memset(htab, 0, sizeof(htab));
+	ctl = op++;
+
+	while (ip < end) {
+		// un byte di controllo, piu' tre di riferimento o un letterale, piu' il prossimo controllo
+		if ((size_t)(op - (unsigned char*)out) + 4 > max)
+			return 0;
+		len = 0;
+		if (ip + 2 < end) {
+			unsigned int h = lzHash(ip);
+			ref = htab[h] ? (const unsigned char*)in + htab[h] - 1 : NULL;
+			htab[h] = ip - (const unsigned char*)in + 1;
+			if (ref && (size_t)(ip - ref) <= LZ_MAXOFF && ref[0] == ip[0] && ref[1] == ip[1] && ref[2] == ip[2]) {
+				lim = (size_t)(end - ip) < LZ_MAXREF ? (size_t)(end - ip) : LZ_MAXREF;
+				for (len = 3; len < lim && ref[len] == ip[len]; ++len);
+			}
+		}
+		if (len == 0) { // letterale
+			*op++ = *ip++;
+			if (++lit == LZ_MAXLIT) {
+				*ctl = lit - 1;
+				ctl  = op++;
+				lit  = 0;
+			}
+			continue;
+		}
+
+		// chiudo i letterali in corso (il controllo riservato diventa il riferimento)
+		if (lit > 0) {
+			*ctl = lit - 1;
+			ctl  = op++;
+			lit  = 0;
+		}
+		off = ip - ref - 1;
+		len -= 2;
+		if (len < 7)
+			*ctl = len << 5 | off >> 8;
+		else {
+			*ctl  = 7 << 5 | off >> 8;
+			*op++ = len - 7;
+		}
+		*op++ = off & 0xff;
+		ip   += len + 2;
+		ctl   = op++;
+	}
+
+	if (lit > 0)
+		*ctl = lit - 1;
+	else // controllo riservato e non usato
+		op--;
+	return op - (unsigned char*)out;
+}
+
+/**
+ * @function lzExpand
+ * @brief    decomprime un buffer
+ *
+ * @param in  dati compressi
+ * @param n   dimensione dei dati compressi
+ * @param out buffer in cui scrivere i dati originali
+ * @param max dimensione del buffer
+ *
+ * @return -1 se i dati non sono validi o non entrano nel buffer
+ *         la dimensione dei dati originali altrimenti
+ */
+long lzExpand(const char *in, size_t n, char *out, size_t max) {
+	const unsigned char *ip  = (const unsigned char*)in;
+	const unsigned char *end = ip + n;
+	unsigned char *op   = (unsigned char*)out;
+	unsigned char *oend = op + max;
+	size_t         len, dist;
+	unsigned int   c;
+
+	while (ip < end) {
+		c = *ip++;
+		if (c < LZ_MAXLIT) { // letterali
+			len = c + 1;
+			if ((size_t)(end - ip) < len || (size_t)(oend - op) < len)
+				return -1;
+			memcpy(op, ip, len);
+			ip += len;
+			op += len;
+			continue;
+		}
+		len = c >> 5;
+		if (len == 7) {
+			if (ip >= end)
+				return -1;
+			len += *ip++;
+		}
+		if (ip >= end)
+			return -1;
+		dist = ((c & 31) << 8 | *ip++) + 1;
+		len += 2;
+		if ((size_t)(op - (unsigned char*)out) < dist || (size_t)(oend - op) < len)
+			return -1;
+		for (; len > 0; --len, ++op) // copia in avanti: il riferimento puo' sovrapporsi
+			*op = *(op - dist);
+	}
+	return op - (unsigned char*)out;
+}
@@ -0,0 +1,55 @@
+#ifndef LZ_H_
+#define LZ_H_
+
+#include <stddef.h>
+
+/**
+ * @file   lz.h
+ * @brief  Contiene un compressore LZ77 veloce (formato a token, nello stile
+ *           di LZF), usato per i dati dei messaggi in PROTO_V3
+ * @author Michele Zoncheddu 545227
+ *
+ * Si dichiara che il contenuto di questo file e'
+ *   in ogni sua parte opera originale dell'autore
+ *
+ * Formato: una sequenza di token, ognuno aperto da un byte di controllo c
+ *   c < 32   c + 1 byte letterali, copiati cosi' come sono
+ *   c >= 32  riferimento: lunghezza l = c >> 5 (se vale 7 segue un byte da
+ *            sommare), distanza (c & 31) << 8 | byte successivo, piu' 1;
+ *            vengono copiati l + 2 byte dalla distanza indicata
+ */
+
+#define LZ_HLOG   12   // bit della tabella hash del compressore
+#define LZ_MAXLIT 32   // letterali al piu' in un token
+#define LZ_MAXOFF 8192 // distanza massima di un riferimento
+#define LZ_MAXREF 264  // lunghezza massima di un riferimento
+
+/**
+ * @function lzCompress
+ * @brief    comprime un buffer
+ *
+ * @param in  dati da comprimere
+ * @param n   dimensione dei dati
+ * @param out buffer in cui scrivere i dati compressi
+ * @param max dimensione del buffer
+ *
+ * @return 0 se i dati compressi non entrano nel buffer
+ *         la dimensione dei dati compressi altrimenti
+ */
+size_t lzCompress(const char *in, size_t n, char *out, size_t max);
+
+/**
+ * @function lzExpand
+ * @brief    decomprime un buffer
+ *
+ * @param in  dati compressi
+ * @param n   dimensione dei dati compressi
+ * @param out buffer in cui scrivere i dati originali
+ * @param max dimensione del buffer
+ *
+ * @return -1 se i dati non sono validi o non entrano nel buffer
+ *         la dimensione dei dati originali altrimenti
+ */
+long lzExpand(const char *in, size_t n, char *out, size_t max);
+
+#endif /* LZ_H_ */
@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <util.h>
+#include <config.h>
+#include <names.h>
+#include <numa.h>
+
+/**
+ * @file   names.c
+ * @brief  Contiene la tabella dei nomi: ogni nickname (o nome di gruppo)
+ *           registrato riceve un id intero, con cui viene identificato
+ *           nelle strutture del server
+ * @author Michele Zoncheddu 545227
+ *
+ * Si dichiara che il contenuto di questo file e'
+ *   in ogni sua parte opera originale dell'autore
+ */
+
+/**
+ * @struct name_t
+ * @brief  nome registrato
+ *
+ * @var nick il nome
+ * @var next id del nome successivo nella lista di trabocco (-1 se ultimo)
+ */
+typedef struct {
+	char nick[MAX_NAME_LENGTH + 1];
+	int  next;
+} name_t;
+
+// i blocchi non vengono mai spostati, quindi nameOf resta valido senza lock
+static name_t          *chunks[NAMES_MAXCHUNKS];                 // nomi, indicizzati per id
+static int             *buckets;                                 // primo id di ogni lista di trabocco
+static unsigned int     nbuckets;                                // dimensione della tabella hash
+static int              nnames;                                  // id assegnati
+static pthread_mutex_t  names_mutex = PTHREAD_MUTEX_INITIALIZER; // per gli inserimenti
+
+/**
+ * @function entry
+ * @brief    restituisce il nome con un certo id
+ *
+ * @param id l'id del nome
+ *
+ * @return il puntatore al nome
+ */
+static inline name_t *entry(int id) {
+	return &chunks[id / NAMES_CHUNK][id % NAMES_CHUNK];
+}
+
+/**
+ * @function nameHash
+ * @brief    calcola la lista di trabocco di un nome
+ *
+ * @param nick il nome
+ *
+ * @return la posizione nella tabella hash
+ */
+static unsigned int nameHash(char *nick) {
+	unsigned int h = 5381;
+	for (int i = 0; i < MAX_NAME_LENGTH + 1 && nick[i]; ++i)
+		h = ((h << 5) + h) + (unsigned char)nick[i];
+	return h % nbuckets;
+}
+
+/**
+ * @function initNames
+ * @brief    inizializza la tabella dei nomi
+ *
+ * @param n il numero massimo (consigliato) di nomi
+ */
+void initNames(int n) {
+	nbuckets = n > 0 ? 2 * n : 1; // fattore di carico massimo di 0.5, come per gli utenti
+	MALLOC(buckets, allocPages(nbuckets * sizeof(int)), "buckets initNames");
+	for (unsigned int i = 0; i < nbuckets; ++i)
+		buckets[i] = -1;
+
+	// ogni worker cerca i nomi: distribuisco la tabella sui loro nodi (nessun effetto senza NumaLocal)
+	bindShared(buckets, nbuckets * sizeof(int));
+}
+
+/**
+ * @function nameId
+ * @brief    restituisce l'id di un nome, senza acquisire lock
+ *
+ * @param nick il nome
+ *
+ * @return -1 se il nome non ha un id (non e' mai stato registrato)
+ *         l'id del nome altrimenti
+ */
+int nameId(char *nick) {
+	int id = __atomic_load_n(&buckets[nameHash(nick)], __ATOMIC_ACQUIRE);
+
+	// i nomi della lista sono stati scritti prima di essere pubblicati in testa
+	while (id != -1 && strncmp(entry(id)->nick, nick, MAX_NAME_LENGTH + 1) != 0)
+		id = entry(id)->next;
+	return id;
+}
+
+/**
+ * @function internName
+ * @brief    restituisce l'id di un nome, assegnandone uno nuovo
+ *             se il nome non ne ha ancora uno
+ *
+ * @param nick il nome
+ *
+ * @return -1 se la tabella e' piena
+ *         l'id del nome altrimenti
+ */
+int internName(char *nick) {
+	unsigned int pos = nameHash(nick);
+	name_t      *e;
+	int          id;
+
+	pthread_mutex_lock(&names_mutex);
+	if ((id = nameId(nick)) != -1) { // nome gia' presente
+		pthread_mutex_unlock(&names_mutex);
+		return id;
+	}
+	if (nnames == NAMES_MAX) { // tabella piena
+		pthread_mutex_unlock(&names_mutex);
+		return -1;
+	}
+	id = nnames;
+	if (id % NAMES_CHUNK == 0) // serve un nuovo blocco
+		MALLOC(chunks[id / NAMES_CHUNK], malloc(NAMES_CHUNK * sizeof(name_t)), "chunk internName");
+
+	// scrivo il nome e poi lo pubblico in testa alla lista di trabocco
+	e = entry(id);
+	strncpy(e->nick, nick, MAX_NAME_LENGTH + 1);
+	e->next = buckets[pos];
+	__atomic_store_n(&buckets[pos], id, __ATOMIC_RELEASE);
+	nnames++;
+	pthread_mutex_unlock(&names_mutex);
+	return id;
+}
+
+/**
+ * @function nameOf
+ * @brief    restituisce il nome di un id
+ *
+ * @param id l'id (restituito da internName)
+ *
+ * @return il puntatore al nome, valido fino a freeNames
+ */
+char *nameOf(int id) {
+	return entry(id)->nick;
+}
+
+/**
+ * @function freeNames
+ * @brief    elimina la tabella dei nomi
+ */
+void freeNames() {
+	for (int i = 0; i < NAMES_MAXCHUNKS && chunks[i]; ++i)
+		free(chunks[i]);
+	free(buckets);
+}
@@ -0,0 +1,73 @@
+#ifndef NAMES_H_
+#define NAMES_H_
+
+/**
+ * @file   names.h
+ * @brief  Contiene la tabella dei nomi: ogni nickname (o nome di gruppo)
+ *           registrato riceve un id intero, con cui viene identificato
+ *           nelle strutture del server
+ * @author Michele Zoncheddu 545227
+ *
+ * Si dichiara che il contenuto di questo file e'
+ *   in ogni sua parte opera originale dell'autore
+ *
+ * Gli id sono densi (0, 1, 2, ...) e non vengono mai riutilizzati: un nome
+ *   deregistrato e poi registrato di nuovo riceve lo stesso id. La ricerca
+ *   non acquisisce lock: un nuovo nome diventa visibile solo dopo essere
+ *   stato scritto per intero. Per questo i nomi distinti registrati
+ *   dall'avvio (utenti e gruppi, anche se deregistrati) sono al piu'
+ *   NAMES_MAX: oltre, le nuove registrazioni falliscono con OP_FAIL
+ */
+
+#define NAMES_CHUNK     1024 // nomi per blocco
+#define NAMES_MAXCHUNKS 1024 // blocchi al piu'
+#define NAMES_MAX       (NAMES_CHUNK * NAMES_MAXCHUNKS) // nomi distinti al piu'
+
+/**
+ * @function initNames
+ * @brief    inizializza la tabella dei nomi
+ *
+ * @param n il numero massimo (consigliato) di nomi
+ */
+void initNames(int n);
+
+/**
+ * @function internName
+ * @brief    restituisce l'id di un nome, assegnandone uno nuovo
+ *             se il nome non ne ha ancora uno
+ *
+ * @param nick il nome
+ *
+ * @return -1 se la tabella e' piena
+ *         l'id del nome altrimenti
+ */
+int internName(char *nick);
+
+/**
+ * @function nameId
+ * @brief    restituisce l'id di un nome, senza acquisire lock
+ *
+ * @param nick il nome
+ *
+ * @return -1 se il nome non ha un id (non e' mai stato registrato)
+ *         l'id del nome altrimenti
+ */
+int nameId(char *nick);
+
+/**
+ * @function nameOf
+ * @brief    restituisce il nome di un id
+ *
+ * @param id l'id (restituito da internName)
+ *
+ * @return il puntatore al nome, valido fino a freeNames
+ */
+char *nameOf(int id);
+
+/**
+ * @function freeNames
+ * @brief    elimina la tabella dei nomi
+ */
+void freeNames();
+
+#endif // NAMES_H_
@@ -0,0 +1,216 @@
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include <numa.h>
+
+/**
+ * @file   numa.c
+ * @brief  Contiene le funzioni per il posizionamento dei thread sulle CPU
+ *           e della memoria sui nodi NUMA (senza libnuma, con le chiamate
+ *           di sistema mbind e getcpu)
+ * @author Michele Zoncheddu 545227
+ *
+ * Si dichiara che il contenuto di questo file e'
+ *   in ogni sua parte opera originale dell'autore
+ */
+
+static unsigned long shared  = 0; // nodi su cui distribuire le strutture condivise (0 se disabilitato)
+static int           enabled = 0; // 1 se il posizionamento della memoria e' abilitato
+
+/**
+ * @function parseCpus
+ * @brief    legge un elenco di CPU nel formato di cpulist (es. "0-3,8,10-11")
+ *
+ * @param list elenco di CPU
+ * @param set  insieme delle CPU da compilare
+ *
+ * @return -1 se l'elenco non e' valido
+ *          il numero di CPU dell'insieme altrimenti
+ */
+int parseCpus(const char *list, cpu_set_t *set) {
+	const char *p = list;
+	char       *end;
+	long        first, last;
+
+	CPU_ZERO(set);
+	while (*p != '\0' && *p != '\n') {
+		first = strtol(p, &end, 10);
+		if (end == p || first < 0)
+			return -1;
+		last = first;
+		if (*end == '-') { // intervallo
+			p = end + 1;
+			last = strtol(p, &end, 10);
+			if (end == p || last < first)
+				return -1;
+		}
+		if (last >= CPU_SETSIZE)
+			return -1;
+		for (long i = first; i <= last; ++i)
+			CPU_SET(i, set);
+		p = end;
+		if (*p == ',')
+			++p;
+		else if (*p != '\0' && *p != '\n')
+			return -1;
+	}
+	return CPU_COUNT(set);
+}
+
+/**
+ * @function usableCpus
+ * @brief    toglie da un insieme le CPU su cui il processo non puo' essere
+ *             eseguito (assenti o escluse dalla sua affinita')
+ *
+ * @param set insieme delle CPU
+ *
+ * @return il numero di CPU rimaste
+ */
+int usableCpus(cpu_set_t *set) {
+	cpu_set_t allowed;
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) // lascio l'insieme com'e'
+		return CPU_COUNT(set);
+	CPU_AND(set, set, &allowed);
+	return CPU_COUNT(set);
+}
+
+/**
+ * @function pinAttr
+ * @brief    imposta negli attributi di un thread la CPU su cui eseguirlo:
+ *             l'idx-esima dell'insieme (a rotazione)
+ *
+ * @param attr attributi del thread da creare
+ * @param set  insieme delle CPU (se vuoto il thread non viene vincolato)
+ * @param idx  indice del thread
+ *
+ * @return il risultato di pthread_attr_setaffinity_np
+ *         0 se l'insieme e' vuoto
+ */
+int pinAttr(pthread_attr_t *attr, const cpu_set_t *set, int idx) {
+	int       n = CPU_COUNT(set);
+	cpu_set_t one;
+
+	if (n == 0)
+		return 0;
+	idx %= n;
+	for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) // cerco l'idx-esima CPU dell'insieme
+		if (CPU_ISSET(cpu, set) && idx-- == 0) {
+			CPU_ZERO(&one);
+			CPU_SET(cpu, &one);
+			return pthread_attr_setaffinity_np(attr, sizeof(cpu_set_t), &one);
+		}
+	return 0;
+}
+
+/**
+ * @function initNuma
+ * @brief    abilita il posizionamento della memoria: le strutture condivise
+ *             vengono distribuite sui nodi delle CPU dei worker
+ *
+ * @param set insieme delle CPU dei worker (se vuoto, tutti i nodi)
+ *
+ * @return il numero di nodi su cui vengono distribuite le strutture condivise
+ */
+int initNuma(const cpu_set_t *set) {
+	char      path[64], list[4096];
+	cpu_set_t cpus;
+	FILE     *f;
+
+	// le CPU di ogni nodo sono elencate in sysfs, nello stesso formato di parseCpus
+	shared = 0;
+	for (int node = 0; node < NUMA_NODES; ++node) {
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+		if (!(f = fopen(path, "r"))) // i nodi possono non essere contigui
+			continue;
+		if (fgets(list, sizeof(list), f) && parseCpus(list, &cpus) > 0) {
+			if (CPU_COUNT(set) > 0)
+				CPU_AND(&cpus, &cpus, set);
+			if (CPU_COUNT(&cpus) > 0)
+				shared |= 1UL << node;
+		}
+		fclose(f);
+	}
+	enabled = 1;
+	return __builtin_popcountl(shared);
+}
+
+/**
+ * @function allocPages
+ * @brief    alloca una struttura azzerata, allineata alla pagina e in pagine
+ *             intere, che puo' essere posizionata con bindShared o bindLocal
+ *             senza spostare altri dati (si libera con free)
+ *
+ * @param len dimensione della struttura
+ *
+ * @return NULL se non c'e' memoria
+ *         il puntatore alla struttura altrimenti
+ */
+void *allocPages(size_t len) {
+	size_t page = sysconf(_SC_PAGESIZE);
+	void  *p;
+
+	len = len > 0 ? (len + page - 1) & ~(page - 1) : page;
+	if (!(p = aligned_alloc(page, len)))
+		return NULL;
+	return memset(p, 0, len);
+}
+
+/**
+ * @function bindPages
+ * @brief    applica una politica di allocazione alle pagine di una struttura
+ *             allocata con allocPages, spostando quelle gia' allocate; al primo
+ *             errore (es. kernel senza NUMA) il posizionamento viene disabilitato
+ *
+ * @param addr   indirizzo della struttura
+ * @param len    dimensione della struttura
+ * @param policy politica di mbind
+ * @param mask   maschera dei nodi
+ */
+static void bindPages(void *addr, size_t len, int policy, unsigned long mask) {
+	uintptr_t page = sysconf(_SC_PAGESIZE);
+	uintptr_t end  = ((uintptr_t)addr + len + page - 1) & ~(page - 1);
+
+	if (!enabled || mask == 0 || len == 0)
+		return;
+	if ((uintptr_t)addr & (page - 1)) // le pagine sarebbero condivise con altri dati
+		return;
+	if (syscall(__NR_mbind, (uintptr_t)addr, end - (uintptr_t)addr, policy, &mask, NUMA_NODES + 1, MPOL_MF_MOVE) == -1) {
+		perror("mbind"); // il posizionamento non cambia il funzionamento del server
+		enabled = 0;
+	}
+}
+
+/**
+ * @function bindShared
+ * @brief    distribuisce le pagine di una struttura condivisa tra i worker
+ *             sui loro nodi (nessun effetto se initNuma non e' stata chiamata)
+ *
+ * @param addr indirizzo della struttura (allocata con allocPages)
+ * @param len  dimensione della struttura
+ */
+void bindShared(void *addr, size_t len) {
+	bindPages(addr, len, MPOL_INTERLEAVE, shared);
+}
+
+/**
+ * @function bindLocal
+ * @brief    sposta le pagine di una struttura sul nodo del thread chiamante
+ *             (nessun effetto se initNuma non e' stata chiamata)
+ *
+ * @param addr indirizzo della struttura (allocata con allocPages)
+ * @param len  dimensione della struttura
+ */
+void bindLocal(void *addr, size_t len) {
+	unsigned cpu, node;
+	if (!enabled || syscall(SYS_getcpu, &cpu, &node, NULL) == -1 || node >= NUMA_NODES)
+		return;
+	bindPages(addr, len, MPOL_PREFERRED, 1UL << node);
+}
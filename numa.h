@@ -0,0 +1,104 @@
+#ifndef NUMA_H_
+#define NUMA_H_
+
+#include <stddef.h>
+#include <sched.h>
+#include <pthread.h>
+
+/**
+ * @file   numa.h
+ * @brief  Contiene le funzioni per il posizionamento dei thread sulle CPU
+ *           e della memoria sui nodi NUMA (senza libnuma, con le chiamate
+ *           di sistema mbind e getcpu)
+ * @author Michele Zoncheddu 545227
+ *
+ * Si dichiara che il contenuto di questo file e'
+ *   in ogni sua parte opera originale dell'autore
+ *
+ * cpu_set_t richiede _GNU_SOURCE, da definire prima di ogni include
+ */
+
+#define NUMA_NODES 64 // numero massimo di nodi NUMA gestiti (bit di una maschera)
+
+/**
+ * @function parseCpus
+ * @brief    legge un elenco di CPU nel formato di cpulist (es. "0-3,8,10-11")
+ *
+ * @param list elenco di CPU
+ * @param set  insieme delle CPU da compilare
+ *
+ * @return -1 se l'elenco non e' valido
+ *          il numero di CPU dell'insieme altrimenti
+ */
+int parseCpus(const char *list, cpu_set_t *set);
+
+/**
+ * @function usableCpus
+ * @brief    toglie da un insieme le CPU su cui il processo non puo' essere
+ *             eseguito (assenti o escluse dalla sua affinita')
+ *
+ * @param set insieme delle CPU
+ *
+ * @return il numero di CPU rimaste
+ */
+int usableCpus(cpu_set_t *set);
+
+/**
+ * @function pinAttr
+ * @brief    imposta negli attributi di un thread la CPU su cui eseguirlo:
+ *             l'idx-esima dell'insieme (a rotazione)
+ *
+ * @param attr attributi del thread da creare
+ * @param set  insieme delle CPU (se vuoto il thread non viene vincolato)
+ * @param idx  indice del thread
+ *
+ * @return il risultato di pthread_attr_setaffinity_np
+ *         0 se l'insieme e' vuoto
+ */
+int pinAttr(pthread_attr_t *attr, const cpu_set_t *set, int idx);
+
+/**
+ * @function initNuma
+ * @brief    abilita il posizionamento della memoria: le strutture condivise
+ *             vengono distribuite sui nodi delle CPU dei worker
+ *
+ * @param set insieme delle CPU dei worker (se vuoto, tutti i nodi)
+ *
+ * @return il numero di nodi su cui vengono distribuite le strutture condivise
+ */
+int initNuma(const cpu_set_t *set);
+
+/**
+ * @function allocPages
+ * @brief    alloca una struttura azzerata, allineata alla pagina e in pagine
+ *             intere, che puo' essere posizionata con bindShared o bindLocal
+ *             senza spostare altri dati (si libera con free)
+ *
+ * @param len dimensione della struttura
+ *
+ * @return NULL se non c'e' memoria
+ *         il puntatore alla struttura altrimenti
+ */
+void *allocPages(size_t len);
+
+/**
+ * @function bindShared
+ * @brief    distribuisce le pagine di una struttura condivisa tra i worker
+ *             sui loro nodi (nessun effetto se initNuma non e' stata chiamata)
+ *
+ * @param addr indirizzo della struttura (allocata con allocPages)
+ * @param len  dimensione della struttura
+ */
+void bindShared(void *addr, size_t len);
+
+/**
+ * @function bindLocal
+ * @brief    sposta le pagine di una struttura sul nodo del thread chiamante
+ *             (nessun effetto se initNuma non e' stata chiamata)
+ *
+ * @param addr indirizzo della struttura (allocata con allocPages)
+ * @param len  dimensione della struttura
+ */
+void bindLocal(void *addr, size_t len);
+
+#endif // NUMA_H_
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE 1
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -5,10 +6,13 @@
 
 #include <util.h>
 #include <connections.h>
+#include <conn.h>
 #include <users.h>
 #include <groups.h>
 #include <stats.h>
 #include <online.h>
+#include <numa.h>
+#include <names.h>
 
 /**
  * @file   online.c
@@ -33,9 +37,11 @@ void initOnline() {
 	int r;
 
 	// inizializzo la struttura online
-	MALLOC(online, malloc(MaxOnlineUsers * sizeof(online_t)), "online initHash");
-	for (int i = 0; i < MaxOnlineUsers; ++i)
+	MALLOC(online, allocPages(MaxOnlineUsers * sizeof(online_t)), "online initHash");
+	for (int i = 0; i < MaxOnlineUsers; ++i) {
+		online[i].id = -1;
 		online[i].fd = -1;
+	}
 	
 	// inizializzo le mutex della struttura online
 	for (int i = 0; i < MaxOnlineUsers; ++i) {
@@ -43,24 +49,33 @@ void initOnline() {
 		if (r != 0)
 			exit(EXIT_FAILURE);
 	}
+
+	// posizioni condivise tra i worker, distribuite sui loro nodi (nessun effetto senza NumaLocal)
+	bindShared(online, MaxOnlineUsers * sizeof(online_t));
 }
 
 /**
  * @function addOnline
- * @brief    aggiunge un utente e il proprio fd alla lista online
+ * @brief    aggiunge un utente e il proprio fd alla lista online,
+ *             legando l'utente alla connessione (vedi getSession)
  * 
  * @param nick il nome dell'utente
  * @param fd   il fd dell'utente
  * 
  * @return -1 se non e' possibile aggiungere altri utenti online
+ *           o la connessione e' gia' legata ad un utente
  *         la posizione nell'array online, altrimenti
  */
 int addOnline(char *nick, int fd) {
-	int i = 0;
+	conn_t *c = getConn(fd);
+	int     i = 0;
+
+	if (!c || __atomic_load_n(&c->user, __ATOMIC_RELAXED) != -1) // un solo utente per connessione
+		return -1;
 
 	// cerco uno spazio libero
 	pthread_mutex_lock(&online_mutex);
-	while (online[i].fd != -1)
+	while (i < MaxOnlineUsers && online[i].fd != -1)
 		i++;
 
 	if (i == MaxOnlineUsers) { // array pieno
@@ -68,10 +83,14 @@ int addOnline(char *nick, int fd) {
 		return -1;
 	}
 
-	// aggiungo fd e nick dell'utente alla struttura online
+	// aggiungo fd e id del nick dell'utente (gia' registrato) alla struttura online
+	//   (con la lock della posizione, che getSession acquisisce per controllarla)
+	pthread_mutex_lock(&online[i].mutex);
 	online[i].fd = fd;
-	strncpy(online[i].nick, nick, MAX_NAME_LENGTH + 1);
+	online[i].id = nameId(nick);
+	pthread_mutex_unlock(&online[i].mutex);
 	chattyStats.nonline++;
+	__atomic_store_n(&c->user, i, __ATOMIC_RELAXED);
 	pthread_mutex_unlock(&online_mutex);
 	return i;
 }
@@ -86,19 +105,12 @@ int addOnline(char *nick, int fd) {
  *         la posizione altrimenti
  */
 int getOnline(char *nick) {
-	int i = 0;
+	int i;
 
-	// cerco un fd valido dell'utente
 	pthread_mutex_lock(&online_mutex);
-	while (i < MaxOnlineUsers && (online[i].fd == -1 || strncmp(online[i].nick, nick, MAX_NAME_LENGTH + 1) != 0))
-		i++;
-	
-	if (i == MaxOnlineUsers) { // utente non online
-		pthread_mutex_unlock(&online_mutex);
-		return -1;
-	}
+	i = getOnlineUnlocked(nick);
 	pthread_mutex_unlock(&online_mutex);
-	return i; // posizione dell'utente
+	return i;
 }
 
 /**
@@ -112,10 +124,13 @@ int getOnline(char *nick) {
  *         la posizione altrimenti
  */
 int getOnlineUnlocked(char *nick) {
-	int i = 0;
+	int i = 0, id;
+
+	if ((id = nameId(nick)) == -1) // nome mai registrato
+		return -1;
 
 	// cerco un fd valido dell'utente
-	while (i < MaxOnlineUsers && (online[i].fd == -1 || strncmp(online[i].nick, nick, MAX_NAME_LENGTH + 1) != 0))
+	while (i < MaxOnlineUsers && (online[i].fd == -1 || online[i].id != id))
 		i++;
 	
 	if (i == MaxOnlineUsers) // utente non online
@@ -123,6 +138,35 @@ int getOnlineUnlocked(char *nick) {
 	return i; // posizione dell'utente
 }
 
+/**
+ * @function getSession
+ * @brief    restituisce la posizione dell'utente legato alla connessione,
+ *             senza cercarlo e senza acquisire online_mutex. La posizione
+ *             puo' essere liberata mentre la connessione e' servita (la
+ *             UNREGISTER_OP dello stesso nick da un'altra connessione, vedi
+ *             deleteOnline) e poi riusata: viene ricontrollata con la sua lock
+ * 
+ * @param fd   il fd della connessione
+ * @param nick il nome dichiarato dal mittente
+ * 
+ * @return -1 se alla connessione non e' legato l'utente nick
+ *         la posizione nell'array online altrimenti
+ */
+int getSession(int fd, char *nick) {
+	conn_t *c = getConn(fd);
+	int     i, pos;
+
+	if (!c || (i = __atomic_load_n(&c->user, __ATOMIC_RELAXED)) == -1)
+		return -1;
+
+	// la posizione e' ancora di questa connessione e dell'utente nick
+	pthread_mutex_lock(&online[i].mutex);
+	pos = online[i].fd == fd && online[i].id != -1
+	      && strncmp(nameOf(online[i].id), nick, MAX_NAME_LENGTH + 1) == 0 ? i : -1;
+	pthread_mutex_unlock(&online[i].mutex);
+	return pos;
+}
+
 /**
  * @function removeOnline
  * @brief    rimuove un utente e il proprio fd dalla lista online
@@ -130,18 +174,14 @@ int getOnlineUnlocked(char *nick) {
  * @param fd il fd dell'utente da rimuovere
  */
 void removeOnline(int fd) {
-	int i = 0;
-
-	// cerco il fd dell'utente
-	pthread_mutex_lock(&online_mutex);
-	while (i < MaxOnlineUsers && online[i].fd != fd)
-		i++;
+	conn_t *c = getConn(fd);
+	int     i;
 
-	if (i == MaxOnlineUsers) { // fd non trovato, non faccio nulla
-		pthread_mutex_unlock(&online_mutex);
+	if (!c || (i = __atomic_load_n(&c->user, __ATOMIC_RELAXED)) == -1) // nessun utente collegato, non faccio nulla
 		return;
-	}
+	__atomic_store_n(&c->user, -1, __ATOMIC_RELAXED);
 
+	pthread_mutex_lock(&online_mutex);
 	// mutua esclusione di precisione per via delle operazioni Atomic
 	pthread_mutex_lock(&online[i].mutex);
 	online[i].fd = -1; // invalido il fd
@@ -157,38 +197,48 @@ void removeOnline(int fd) {
  * @param nick il nome dell'utente
  */
 void deleteOnline(char *nick) {
+	conn_t *c;
+	int     id = nameId(nick);
+
 	// cancello ogni traccia del nick dagli utenti online
 	pthread_mutex_lock(&online_mutex);
 	for (int i = 0; i < MaxOnlineUsers; ++i)
-		if (strncmp(online[i].nick, nick, MAX_NAME_LENGTH + 1) == 0) {
-			for (int j = 0; j < MAX_NAME_LENGTH; ++j)
-				online[i].nick[j] = '\0';
+		if (id != -1 && online[i].id == id) {
+			// un worker puo' servire l'altra connessione: getSession ricontrolla la posizione con la sua lock
+			pthread_mutex_lock(&online[i].mutex);
+			online[i].id = -1;
+			if (online[i].fd == -1) {
+				pthread_mutex_unlock(&online[i].mutex);
+				continue;
+			}
+			if ((c = getConn(online[i].fd)) != NULL) // la connessione resta aperta, ma senza utente
+				__atomic_store_n(&c->user, -1, __ATOMIC_RELAXED);
 			online[i].fd = -1;
+			pthread_mutex_unlock(&online[i].mutex);
+			chattyStats.nonline--;
 		}
-	pthread_mutex_lock(&online_mutex);
+	pthread_mutex_unlock(&online_mutex);
 }
 
 /**
  * @function getOnlineList
- * @brief    crea la lista di utenti online
+ * @brief    crea la lista degli id degli utenti online
  * 
  * @param list la lista che dovra' essere scritta
  * 
  * @return il numero di utenti online
  */
-int getOnlineList(char ***list) {
-	int k = 0;
-	char **local_list;
+int getOnlineList(int **list) {
+	int  k = 0;
+	int *local_list;
 
 	pthread_mutex_lock(&online_mutex);
-	MALLOC(local_list, calloc(chattyStats.nonline, sizeof(char*)), "local_list getOnlineList");
-	for (int i = 0; i < chattyStats.nonline; ++i)
-		MALLOC(local_list[i], calloc(1, MAX_NAME_LENGTH + 1), "local_list getOnlineList");
+	MALLOC(local_list, calloc(chattyStats.nonline, sizeof(int)), "local_list getOnlineList");
 
 	// copio la lista di utenti online
 	for (int i = 0; i < MaxOnlineUsers; ++i)
 		if (online[i].fd != -1)
-			strncpy(local_list[k++], online[i].nick, MAX_NAME_LENGTH + 1);
+			local_list[k++] = online[i].id;
 	
 	*list = local_list;
 	pthread_mutex_unlock(&online_mutex);
@@ -199,9 +249,10 @@ int getOnlineList(char ***list) {
  * @function sendOnlineList
  * @brief    invia la lista di utenti online ad un certo fd
  * 
+ * @param fd   il fd del destinatario
  * @param nick il nome del destinatario
  */
-void sendOnlineList(char *nick) {
+void sendOnlineList(int fd, char *nick) {
 	message_t  reply;
 	char      *list;
 	int        k = 0;
@@ -211,25 +262,25 @@ void sendOnlineList(char *nick) {
 	// copio gli utenti online
 	for (int i = 0; i < MaxOnlineUsers; ++i)
 		if (online[i].fd != -1) {
-			strncpy((list + k * (MAX_NAME_LENGTH + 1)), online[i].nick, MAX_NAME_LENGTH + 1);
+			strncpy((list + k * (MAX_NAME_LENGTH + 1)), nameOf(online[i].id), MAX_NAME_LENGTH + 1);
 			k++;
 		}
 	pthread_mutex_unlock(&online_mutex);
 	setHeader(&(reply.hdr), OP_OK, "server");
-	setData(&(reply.data), nick, list, chattyStats.nonline * (MAX_NAME_LENGTH + 1));
-	sendMessageAtomic(reply);
+	setData(&(reply.data), nick, list, k * (MAX_NAME_LENGTH + 1));
+	queueMsg(fd, &reply); // risposta sulla connessione del richiedente
 	free(list);
 }
 
 /**
  * @function sendOpAtomic
- * @brief    invia un header con l'operazione
- *             specificata, atomicamente
+ * @brief    invia un header con l'operazione specificata, atomicamente
+ *             (accodato sulla connessione del destinatario, senza bloccarsi)
  * 
  * @param nick il nome del destinatario
  * @param op   l'operazione
  * 
- * @return > 0 se il destinatario e' online
+ * @return > 0 se il destinatario e' online e il messaggio e' stato accodato
  *          -1 altrimenti
  */
 int sendOpAtomic(char *nick, op_t op) {
@@ -238,7 +289,7 @@ int sendOpAtomic(char *nick, op_t op) {
 	if ((pos = getOnlineUnlocked(nick)) != -1) { // destinatario online
 		pthread_mutex_lock(&online[pos].mutex);
 		pthread_mutex_unlock(&online_mutex);
-		n = sendOp(online[pos].fd, op); // qua ho solo il lock sullo specifico client
+		n = queueOp(online[pos].fd, op); // qua ho solo il lock sullo specifico client
 		pthread_mutex_unlock(&online[pos].mutex);
 		return n;
 	}
@@ -247,21 +298,23 @@ int sendOpAtomic(char *nick, op_t op) {
 }
 
 /**
- * @function sendMessageAtomic
- * @brief    invia un messaggio in modo atomico
+ * @function queueAtomic
+ * @brief    accoda un messaggio sulla connessione del destinatario,
+ *             con la lock del suo slot per non mescolarlo ad altri
  * 
- * @param msg il messaggio da inviare
+ * @param msg    puntatore al messaggio da inviare (della history, vedi queueHistory)
+ * @param notify 1 se il messaggio e' una notifica (vedi queueNotify)
  * 
- * @return > 0 se il destinatario e' online
+ * @return > 0 se il destinatario e' online e il messaggio e' stato accodato
  *          -1 altrimenti
  */
-int sendMessageAtomic(message_t msg) {
+static int queueAtomic(message_t *msg, int notify) {
 	int pos, n;
 	pthread_mutex_lock(&online_mutex);
-	if ((pos = getOnlineUnlocked(msg.data.hdr.receiver)) != -1) { // destinatario online
+	if ((pos = getOnlineUnlocked(msg->data.hdr.receiver)) != -1) { // destinatario online
 		pthread_mutex_lock(&online[pos].mutex);
 		pthread_mutex_unlock(&online_mutex);
-		n = sendMsg(online[pos].fd, &msg);
+		n = notify ? queueNotify(online[pos].fd, msg) : queueHistory(online[pos].fd, msg);
 		pthread_mutex_unlock(&online[pos].mutex);
 		return n;
 	}
@@ -269,6 +322,34 @@ int sendMessageAtomic(message_t msg) {
 	return -1;
 }
 
+/**
+ * @function sendMessageAtomic
+ * @brief    invia un messaggio in modo atomico
+ *             (accodato sulla connessione del destinatario, senza bloccarsi)
+ * 
+ * @param msg il messaggio da inviare, della history (vedi queueHistory)
+ * 
+ * @return > 0 se il destinatario e' online e il messaggio e' stato accodato
+ *          -1 altrimenti
+ */
+int sendMessageAtomic(message_t msg) {
+	return queueAtomic(&msg, 0);
+}
+
+/**
+ * @function notifyAtomic
+ * @brief    come sendMessageAtomic, per le notifiche di nuovi messaggi:
+ *             l'invio puo' essere ritardato per raggrupparle (NotifyLinger)
+ * 
+ * @param msg il messaggio da inviare
+ * 
+ * @return > 0 se il destinatario e' online e il messaggio e' stato accodato
+ *          -1 altrimenti
+ */
+int notifyAtomic(message_t msg) {
+	return queueAtomic(&msg, 1);
+}
+
 /**
  * @function freeOnline
  * @brief    elimina le strutture per gli utenti online
@@ -19,12 +19,12 @@
  * @struct online_t
  * @brief  dati di un utente online
  * 
- * @var nick  nome dell'utente
+ * @var id    id del nome dell'utente (vedi names.h)
  * @var fd    fd della connessione legata all'utente
  * @var mutex lock per l'invio atomico di messsaggi all'utente
  */
 typedef struct {
-	char nick[MAX_NAME_LENGTH + 1];
+	int  id;
 	int  fd;
 	pthread_mutex_t mutex;
 } online_t;
@@ -37,12 +37,14 @@ void initOnline();
 
 /**
  * @function addOnline
- * @brief    aggiunge un utente e il proprio fd alla lista online
+ * @brief    aggiunge un utente e il proprio fd alla lista online,
+ *             legando l'utente alla connessione (vedi getSession)
  * 
  * @param nick il nome dell'utente
  * @param fd   il fd dell'utente
  * 
  * @return -1 se non e' possibile aggiungere altri utenti online
+ *           o la connessione e' gia' legata ad un utente
  *         la posizione nell'array online, altrimenti
  */
 int addOnline(char *nick, int fd);
@@ -70,6 +72,22 @@ int getOnline(char *nick);
  */
 int getOnlineUnlocked(char *nick);
 
+/**
+ * @function getSession
+ * @brief    restituisce la posizione dell'utente legato alla connessione,
+ *             senza cercarlo e senza acquisire online_mutex. La posizione
+ *             puo' essere liberata mentre la connessione e' servita (la
+ *             UNREGISTER_OP dello stesso nick da un'altra connessione, vedi
+ *             deleteOnline) e poi riusata: viene ricontrollata con la sua lock
+ * 
+ * @param fd   il fd della connessione
+ * @param nick il nome dichiarato dal mittente
+ * 
+ * @return -1 se alla connessione non e' legato l'utente nick
+ *         la posizione nell'array online altrimenti
+ */
+int getSession(int fd, char *nick);
+
 /**
  * @function removeOnline
  * @brief    rimuove un utente e il proprio fd dalla lista online
@@ -88,31 +106,32 @@ void deleteOnline(char *nick);
 
 /**
  * @function getOnlineList
- * @brief    crea la lista di utenti online
+ * @brief    crea la lista degli id degli utenti online
  * 
  * @param list la lista che dovra' essere scritta
  * 
  * @return il numero di utenti online
  */
-int getOnlineList(char ***list);
+int getOnlineList(int **list);
 
 /**
  * @function sendOnlineList
  * @brief    invia la lista di utenti online ad un certo fd
  * 
+ * @param fd   il fd del destinatario
  * @param nick il nome del destinatario
  */
-void sendOnlineList(char *nick);
+void sendOnlineList(int fd, char *nick);
 
 /**
  * @function sendOpAtomic
- * @brief    invia un header con l'operazione
- *             specificata, atomicamente
+ * @brief    invia un header con l'operazione specificata, atomicamente
+ *             (accodato sulla connessione del destinatario, senza bloccarsi)
  * 
  * @param nick il nome del destinatario
  * @param op   l'operazione
  * 
- * @return > 0 se il destinatario e' online
+ * @return > 0 se il destinatario e' online e il messaggio e' stato accodato
  *          -1 altrimenti
  */
 int sendOpAtomic(char *nick, op_t op);
@@ -120,14 +139,27 @@ int sendOpAtomic(char *nick, op_t op);
 /**
  * @function sendMessageAtomic
  * @brief    invia un messaggio in modo atomico
+ *             (accodato sulla connessione del destinatario, senza bloccarsi)
  * 
- * @param msg il messaggio da inviare
+ * @param msg il messaggio da inviare, della history (vedi queueHistory)
  * 
- * @return > 0 se il destinatario e' online
+ * @return > 0 se il destinatario e' online e il messaggio e' stato accodato
  *          -1 altrimenti
  */
 int sendMessageAtomic(message_t msg);
 
+/**
+ * @function notifyAtomic
+ * @brief    come sendMessageAtomic, per le notifiche di nuovi messaggi:
+ *             l'invio puo' essere ritardato per raggrupparle (NotifyLinger)
+ * 
+ * @param msg il messaggio da inviare
+ * 
+ * @return > 0 se il destinatario e' online e il messaggio e' stato accodato
+ *          -1 altrimenti
+ */
+int notifyAtomic(message_t msg);
+
 /**
  * @function freeOnline
  * @brief    elimina le strutture per gli utenti online
@@ -17,6 +17,9 @@
 #include <groups.h>
 #include <message.h>
 #include <connections.h>
+#include <conn.h>
+#include <bufpool.h>
+#include <names.h>
 
 /**
  * @file   operations.c
@@ -57,21 +60,29 @@ off_t fsize(const char *filename) {
  * @param msg   messaggio di richiesta
  */
 void registerOp(hash_t users, int fd, message_t msg) {
+	int res;
+
 	// registro l'utente
-	if (signUp(users, msg.hdr.sender, 0) == -1) {
-		sendOp(fd, OP_NICK_ALREADY);
+	if ((res = signUp(users, msg.hdr.sender, 0)) == -2) {
+		queueOp(fd, OP_FAIL);
+		chattyStats.nerrors++;
+		printf("SERVER - ERRORE: raggiunto il limite di %d nomi registrati, impossibile registrare %s\n", NAMES_MAX, msg.hdr.sender);
+		return;
+	}
+	if (res == -1) {
+		queueOp(fd, OP_NICK_ALREADY);
 		chattyStats.nerrors++;
 		printf("SERVER - ERRORE: nome %s gia' registrato\n", msg.hdr.sender);
 		return;
 	}
 	printf("SERVER: %s registrato\n", msg.hdr.sender);
 	if (addOnline(msg.hdr.sender, fd) == -1) { // troppi utenti online
-		sendOp(fd, OP_FAIL);
+		queueOp(fd, OP_FAIL);
 		chattyStats.nerrors++;
 		printf("SERVER - ERRORE: troppi utenti online, impossibile connettere %s\n", msg.hdr.sender);
 		return;
 	}
-	sendOnlineList(msg.hdr.sender); // invio la lista di utenti online
+	sendOnlineList(fd, msg.hdr.sender); // invio la lista di utenti online
 }
 
 /**
@@ -83,73 +94,155 @@ void registerOp(hash_t users, int fd, message_t msg) {
  * @param msg   messaggio di richiesta
  */
 void connectOp(hash_t users, int fd, message_t msg) {
-	if (getOnline(msg.hdr.sender) != -1) { // utente gia' online
-		sendOpAtomic(msg.hdr.sender, OP_FAIL);
+	if (getOnline(msg.hdr.sender) != -1) { // utente gia' online (anche su un'altra connessione)
+		queueOp(fd, OP_FAIL);
 		chattyStats.nerrors++;
 		printf("SERVER - ERRORE: %s gia' collegato\n", msg.hdr.sender);
 		return;
 	}
 	if (isRegistered(users, msg.hdr.sender) != 1) { // utente non registrato o nome di gruppo
-		sendOp(fd, OP_NICK_UNKNOWN);
+		queueOp(fd, OP_NICK_UNKNOWN);
 		chattyStats.nerrors++;
 		printf("SERVER - ERRORE: impossibile connettere %s\n", msg.hdr.sender);
 		return;
 	}
 	if (addOnline(msg.hdr.sender, fd) == -1) { // impossibile aggiungere l'utente alla lista online
-		sendOp(fd, OP_FAIL);
+		queueOp(fd, OP_FAIL);
 		chattyStats.nerrors++;
 		printf("SERVER - ERRORE: troppi utenti online, impossibile connettere %s\n", msg.hdr.sender);
 		return;
 	}
 	printf("SERVER: %s connesso\n", msg.hdr.sender);
-	sendOnlineList(msg.hdr.sender); // invio la lista di utenti online				
+	sendOnlineList(fd, msg.hdr.sender); // invio la lista di utenti online				
 }
 
 /**
- * @function postTxtOp
- * @brief    implementa l'operazione richiesta con POSTTXT_OP
+ * @function deliverTxt
+ * @brief    salva e prova a consegnare il messaggio testuale di un
+ *             mittente online ad un nickname o groupname
  * 
  * @param users tabella degli utenti
- * @param fd    fd del richiedente
- * @param msg   messaggio di richiesta
+ * @param msg   messaggio da consegnare (i dati passano alla history)
+ * 
+ * @return OP_OK se il messaggio e' stato accettato
+ *         il codice di errore altrimenti
  */
-void postTxtOp(hash_t users, int fd, message_t msg) {
-	int res; // vale 1 se il destinatario e' un utente, 2 se e' un gruppo
-	if (getOnline(msg.hdr.sender) == -1) { // mittente non online
-		sendOp(fd, OP_FAIL);
-		chattyStats.nerrors++;
-		printf("SERVER - ERRORE: %s deve collegarsi per poter inviare un messaggio\n", msg.hdr.sender);
-		return;
-	}
-	res = 1;
+static op_t deliverTxt(hash_t users, message_t msg) {
+	int res = 1; // vale 1 se il destinatario e' un utente, 2 se e' un gruppo
 	if (getOnline(msg.data.hdr.receiver) == -1) { // destinatario non online
 		if (!(res = isRegistered(users, msg.data.hdr.receiver))) { // destinatario non registrato
-			sendOp(fd, OP_NICK_UNKNOWN);
 			chattyStats.nerrors++;
 			printf("SERVER - ERRORE: utent o gruppo %s non registrato\n", msg.data.hdr.receiver);
-			return;
+			bufFree(msg.data.buf);
+			return OP_NICK_UNKNOWN;
 		}
 	}
 	if (msg.data.hdr.len > conf.MaxMsgSize) { // messaggio troppo lungo
-		sendOpAtomic(msg.hdr.sender, OP_MSG_TOOLONG);
 		chattyStats.nerrors++;
 		printf("SERVER - ERRORE: messaggio troppo lungo\n");
-		return;
+		bufFree(msg.data.buf);
+		return OP_MSG_TOOLONG;
 	}
 	msg.hdr.op = TXT_MESSAGE;
 	if (res == 1) // il destinatario e' un utente
 		sendMessage(users, msg); // salvo il messaggio e provo ad inviarlo
 	else { // il destinatario e' un gruppo
 		res = sendMessageToGroup(users, msg);
-		free(msg.data.buf);
+		bufFree(msg.data.buf);
 	}
 	if (res == -1) { // l'utente non appartiene al gruppo
-		sendOpAtomic(msg.hdr.sender, OP_NICK_UNKNOWN);
 		chattyStats.nerrors++;
 		printf("SERVER - ERRORE: l'utente non appartiene al gruppo\n");
+		return OP_NICK_UNKNOWN;
+	}
+	return OP_OK;
+}
+
+/**
+ * @function postTxtOp
+ * @brief    implementa l'operazione richiesta con POSTTXT_OP
+ * 
+ * @param users tabella degli utenti
+ * @param fd    fd del richiedente
+ * @param msg   messaggio di richiesta
+ */
+void postTxtOp(hash_t users, int fd, message_t msg) {
+	if (getSession(fd, msg.hdr.sender) == -1) { // mittente non online
+		queueOp(fd, OP_FAIL);
+		chattyStats.nerrors++;
+		printf("SERVER - ERRORE: %s deve collegarsi per poter inviare un messaggio\n", msg.hdr.sender);
+		bufFree(msg.data.buf);
+		return;
+	}
+	queueOp(fd, deliverTxt(users, msg)); // invio l'esito al mittente
+}
+
+/**
+ * @function postBatchOp
+ * @brief    implementa l'operazione richiesta con POSTBATCH_OP: consegna
+ *             i messaggi del lotto e risponde una sola volta, con OP_OK
+ *             seguito da un byte di esito per ogni messaggio
+ * 
+ * @param users tabella degli utenti
+ * @param fd    fd del richiedente
+ * @param msg   messaggio di richiesta
+ */
+void postBatchOp(hash_t users, int fd, message_t msg) {
+	message_t          entry; // messaggio del lotto
+	message_t          reply; // risposta aggregata
+	message_data_hdr_t hdr;
+	char              *res;   // esiti dei messaggi
+	unsigned int       off, n = 0;
+	int                h;
+
+	if (getSession(fd, msg.hdr.sender) == -1) { // mittente non online
+		queueOp(fd, OP_FAIL);
+		chattyStats.nerrors++;
+		printf("SERVER - ERRORE: %s deve collegarsi per poter inviare un messaggio\n", msg.hdr.sender);
+		bufFree(msg.data.buf);
 		return;
 	}
-	sendOpAtomic(msg.hdr.sender, OP_OK); // invio l'ack al mittente
+	if (!msg.data.buf) { // lotto vuoto o scartato in ricezione perche' troppo lungo
+		queueOp(fd, msg.data.hdr.len > 0 ? OP_MSG_TOOLONG : OP_FAIL);
+		chattyStats.nerrors++;
+		printf("SERVER - ERRORE: lotto di messaggi non valido\n");
+		return;
+	}
+
+	// controllo il lotto prima di consegnare qualcosa: o tutto o niente
+	for (off = 0; off < msg.data.hdr.len; off += h + hdr.len, ++n) {
+		if (n == BATCH_MAXMSGS) { // un lotto non puo' occupare un worker piu' di una richiesta qualsiasi
+			queueOp(fd, OP_FAIL);
+			chattyStats.nerrors++;
+			printf("SERVER - ERRORE: lotto con piu' di %d messaggi\n", BATCH_MAXMSGS);
+			bufFree(msg.data.buf);
+			return;
+		}
+		h = unpackDataHdr(msg.data.buf + off, msg.data.hdr.len - off, &hdr, BATCH_PROTO);
+		if (h <= 0 || hdr.len == 0 || hdr.len > msg.data.hdr.len - off - h) { // messaggio malformato
+			queueOp(fd, OP_FAIL);
+			chattyStats.nerrors++;
+			printf("SERVER - ERRORE: lotto di messaggi non valido\n");
+			bufFree(msg.data.buf);
+			return;
+		}
+	}
+
+	res = bufAlloc(n);
+	entry.hdr = msg.hdr;
+	for (off = 0, n = 0; off < msg.data.hdr.len; off += h + entry.data.hdr.len, ++n) {
+		h = unpackDataHdr(msg.data.buf + off, msg.data.hdr.len - off, &(entry.data.hdr), BATCH_PROTO);
+		// la history conserva i dati di ogni messaggio separatamente
+		entry.data.buf = bufAlloc(entry.data.hdr.len);
+		memcpy(entry.data.buf, msg.data.buf + off + h, entry.data.hdr.len);
+		res[n] = deliverTxt(users, entry);
+	}
+	bufFree(msg.data.buf);
+
+	setHeader(&(reply.hdr), OP_OK, "server");
+	setData(&(reply.data), msg.hdr.sender, res, n);
+	queueMsg(fd, &reply); // invio gli esiti al mittente
+	bufFree(res);
 }
 
 /**
@@ -161,23 +254,23 @@ void postTxtOp(hash_t users, int fd, message_t msg) {
  * @param msg   messaggio di richiesta
  */
 void postTxtAllOp(hash_t users, int fd, message_t msg) {
-	if (getOnline(msg.hdr.sender) == -1) { // mittente non online
-		sendOp(fd, OP_FAIL);
+	if (getSession(fd, msg.hdr.sender) == -1) { // mittente non online
+		queueOp(fd, OP_FAIL);
 		chattyStats.nerrors++;
 		printf("SERVER - ERRORE: %s deve collegarsi per poter inviare un messaggio\n", msg.hdr.sender);
 		return;
 	}
 	if (msg.data.hdr.len > conf.MaxMsgSize) { // messaggio troppo lungo
-		sendOpAtomic(msg.hdr.sender, OP_MSG_TOOLONG);
+		queueOp(fd, OP_MSG_TOOLONG);
 		chattyStats.nerrors++;
-		free(msg.data.buf);
+		bufFree(msg.data.buf);
 		printf("SERVER - ERRORE: messaggio troppo lungo\n");
 		return;
 	}
 	msg.hdr.op = TXT_MESSAGE;
 	sendMessageAll(users, msg); // salvo il messaggio e lo invio in broadcast
-	sendOpAtomic(msg.hdr.sender, OP_OK); // invio l'ack al mittente
-	free(msg.data.buf);
+	queueOp(fd, OP_OK); // invio l'ack al mittente
+	bufFree(msg.data.buf);
 }
 
 /**
@@ -187,65 +280,62 @@ void postTxtAllOp(hash_t users, int fd, message_t msg) {
  * @param users tabella degli utenti
  * @param fd    fd del richiedente
  * @param msg   messaggio di richiesta
+ * @param file  contenuto del file, ricevuto insieme alla richiesta
  */
-void postFileOp(hash_t users, int fd, message_t msg) {
+void postFileOp(hash_t users, int fd, message_t msg, message_data_t file) {
 	int fd_file; // fd del file da salvare
 	int res; // vale 1 se il destinatario e' un utente, 2 se e' un gruppo
 
-	if (getOnline(msg.hdr.sender) == -1) { // mittente non online
-		sendOp(fd, OP_FAIL);
+	if (getSession(fd, msg.hdr.sender) == -1) { // mittente non online
+		queueOp(fd, OP_FAIL);
 		chattyStats.nerrors++;
 		printf("SERVER - ERRORE: %s deve collegarsi per poter inviare un file\n", msg.hdr.sender);
+		bufFree(file.buf);
 		return;
 	}
 	res = 1;
 	if (getOnline(msg.data.hdr.receiver) == -1) { // destinatario non online
 		if (!(res = isRegistered(users, msg.data.hdr.receiver))) { // destinatario non registrato
-			sendOp(fd, OP_NICK_UNKNOWN);
+			queueOp(fd, OP_NICK_UNKNOWN);
 			chattyStats.nerrors++;
 			printf("SERVER - ERRORE: destinatario inesistente\n");
+			bufFree(file.buf);
 			return;
 		}
 	}
 	if (msg.data.hdr.len > conf.MaxMsgSize) { // messaggio troppo lungo
-		sendOpAtomic(msg.hdr.sender, OP_MSG_TOOLONG);
+		queueOp(fd, OP_MSG_TOOLONG);
 		chattyStats.nerrors++;
 		printf("SERVER - ERRORE: messaggio troppo lungo\n");
+		bufFree(file.buf);
 		return;
 	}
 	msg.hdr.op = FILE_MESSAGE;
 
 	SYSCALL(notused, chdir(DirName), "chdir"); // mi posiziono nella cartella dei file
-	message_data_t file;
-	
-	// leggo il file
-	if (readData(fd, &file) <= 0) {
-		sendOpAtomic(msg.hdr.sender, OP_FAIL);
-		chattyStats.nerrors++;
-		printf("SERVER - ERRORE: leggendo il file\n");
-		return;
-	}
 
+	// il contenuto oltre la dimensione massima e' stato scartato in ricezione
 	if (file.hdr.len > conf.MaxFileSize * 1024) { // file troppo grande
-		sendOpAtomic(msg.hdr.sender, OP_MSG_TOOLONG);
+		queueOp(fd, OP_MSG_TOOLONG);
 		chattyStats.nerrors++;
 		printf("SERVER - ERRORE: file troppo grande\n");
+		bufFree(file.buf);
 		return;
 	}
 
 	SYSCALL(fd_file, open(basename(msg.data.buf), O_CREAT | O_TRUNC | O_RDWR, 0777), "open"); // creo il file
 	SYSCALL(notused, writen(fd_file, file.buf, file.hdr.len), "writen"); // scrivo il file
-	free(file.buf);
+	bufFree(file.buf);
 
-	sendOpAtomic(msg.hdr.sender, OP_OK); // invio l'ack al mittente
+	queueOp(fd, OP_OK); // invio l'ack al mittente
 	if (res == 1) // il destinatario e' un utente
 		sendMessage(users, msg); // salvo il messaggio e provo ad inviarlo
 	else { // il destinatario e' un gruppo
 		res = sendMessageToGroup(users, msg);
-		free(msg.data.buf);
+		bufFree(msg.data.buf);
 	}
 	if (res == -1) { // l'utente non appartiene al gruppo
-		sendOpAtomic(msg.hdr.sender, OP_NICK_UNKNOWN);
+		queueOp(fd, OP_NICK_UNKNOWN);
 		chattyStats.nerrors++;
 		printf("SERVER - ERRORE: l'utente non appartiene al gruppo\n");
 		return;
@@ -267,19 +357,25 @@ void getFileOp(hash_t users, int fd, message_t req) {
 	char *buf;     // buffer nel quale salvare il file
 	message_t msg; // wrapper per il file
 
-	if (getOnline(req.hdr.sender) == -1) { // richiedente non online
-		sendOp(fd, OP_FAIL);
+	if (getSession(fd, req.hdr.sender) == -1) { // richiedente non online
+		queueOp(fd, OP_FAIL);
 		chattyStats.nerrors++;
 		printf("SERVER - ERRORE: %s deve collegarsi per poter scaricare un file\n", req.hdr.sender);
 		return;
 	}
 
+	if (!req.data.buf) { // nome oltre MaxMsgSize, scartato in ricezione: nessun file puo' averlo
+		queueOp(fd, OP_NO_SUCH_FILE);
+		chattyStats.nerrors++;
+		return;
+	}
+
 	char *base = basename(req.data.buf);
 	SYSCALL(notused, chdir(DirName), "chdir"); // mi posiziono nella cartella dei file
 	fd_file = open(base, O_RDONLY); // provo ad aprire il file
 
 	if (fd_file == -1) { // il file non esiste
-		sendOpAtomic(req.hdr.sender, OP_NO_SUCH_FILE);
+		queueOp(fd, OP_NO_SUCH_FILE);
 		chattyStats.nerrors++;
 		return;
 	}
@@ -293,12 +389,12 @@ void getFileOp(hash_t users, int fd, message_t req) {
 	setData(&(msg.data), req.hdr.sender, buf, size);
 
 	// invio il messaggio con il file
-	if (sendMessageAtomic(msg) > 0) {
+	if (queueMsg(fd, &msg) > 0) {
 		chattyStats.nfiledelivered++;
 		chattyStats.nfilenotdelivered--;
 	}
 	free(buf);
-	free(req.data.buf);
+	bufFree(req.data.buf);
 }
 
 /**
@@ -312,14 +408,14 @@ void getFileOp(hash_t users, int fd, message_t req) {
 void unregisterOp(hash_t users, int fd, message_t msg) {
 	int res; // vale 1 se devo cancellare un utente, 2 se un gruppo
 
-	if (getOnline(msg.hdr.sender) == -1) { // richiedente non online
-		sendOp(fd, OP_FAIL);
+	if (getSession(fd, msg.hdr.sender) == -1) { // richiedente non online
+		queueOp(fd, OP_FAIL);
 		chattyStats.nerrors++;
 		printf("SERVER - ERRORE: %s deve collegarsi\n", msg.hdr.sender);
 		return;
 	}
 	if (!(res = isRegistered(users, msg.data.hdr.receiver))) {
-		sendOp(fd, OP_NICK_UNKNOWN);
+		queueOp(fd, OP_NICK_UNKNOWN);
 		chattyStats.nerrors++;
 		printf("SERVER - ERRORE: utente o gruppo inesistente\n");
 		return;
@@ -331,11 +427,11 @@ void unregisterOp(hash_t users, int fd, message_t msg) {
 	else { // devo cancellare un gruppo
 		if ((res = deleteGroup(msg.data.hdr.receiver, msg.hdr.sender)) < 1) {
 			if (res == -1) {
-				sendOp(fd, OP_FAIL);
+				queueOp(fd, OP_FAIL);
 				printf("SERVER - ERRORE: solo il creatore del gruppo puo' cancellarlo\n");
 			}
 			else {
-				sendOp(fd, OP_NICK_UNKNOWN);
+				queueOp(fd, OP_NICK_UNKNOWN);
 				printf("SERVER - ERRORE: gruppo inesistente\n");
 			}
 			chattyStats.nerrors++;
@@ -343,7 +439,7 @@ void unregisterOp(hash_t users, int fd, message_t msg) {
 		}
 		printf("SERVER: gruppo %s cancellato\n", msg.data.hdr.receiver);
 	}
-	sendOp(fd, OP_OK); // invio l'ack al mittente
+	queueOp(fd, OP_OK); // invio l'ack al mittente
 }
 
 /**
@@ -355,28 +451,36 @@ void unregisterOp(hash_t users, int fd, message_t msg) {
  * @param msg   messaggio di richiesta
  */
 void createGroupOp(hash_t users, int fd, message_t msg) {
-	if (getOnline(msg.hdr.sender) == -1) { // mittente non online
-		sendOp(fd, OP_FAIL);
+	int res;
+
+	if (getSession(fd, msg.hdr.sender) == -1) { // mittente non online
+		queueOp(fd, OP_FAIL);
 		chattyStats.nerrors++;
 		printf("SERVER - ERRORE: %s deve collegarsi\n", msg.hdr.sender);
 		return;
 	}
 	
 	// creo il gruppo
-	if (signUp(users, msg.data.hdr.receiver, 1) == -1) {
-		sendOpAtomic(msg.hdr.sender, OP_NICK_ALREADY);
+	if ((res = signUp(users, msg.data.hdr.receiver, 1)) == -2) {
+		queueOp(fd, OP_FAIL);
+		chattyStats.nerrors++;
+		printf("SERVER - ERRORE: raggiunto il limite di %d nomi registrati, impossibile creare il gruppo %s\n", NAMES_MAX, msg.data.hdr.receiver);
+		return;
+	}
+	if (res == -1) {
+		queueOp(fd, OP_NICK_ALREADY);
 		chattyStats.nerrors++;
 		printf("SERVER - ERRORE: gruppo %s gia' registrato\n", msg.data.hdr.receiver);
 		return;
 	}
 	if (createGroup(msg.data.hdr.receiver, msg.hdr.sender) == -1) {
-		sendOpAtomic(msg.hdr.sender, OP_FAIL);
+		queueOp(fd, OP_FAIL);
 		chattyStats.nerrors++;
 		printf("SERVER - ERRORE: troppi gruppi presenti, impossibile crearne altri\n");
 		return;
 	}
 	// mando l'ack
-	sendOpAtomic(msg.hdr.sender, OP_OK);
+	queueOp(fd, OP_OK);
 }
 
 /**
@@ -390,14 +494,14 @@ void createGroupOp(hash_t users, int fd, message_t msg) {
 void addGroupOp(hash_t users, int fd, message_t msg) {
 	int res; // risultato dell'operazione di inserimento nel gruppo
 
-	if (getOnline(msg.hdr.sender) == -1) { // richiedente non online
-		sendOp(fd, OP_FAIL);
+	if (getSession(fd, msg.hdr.sender) == -1) { // richiedente non online
+		queueOp(fd, OP_FAIL);
 		chattyStats.nerrors++;
 		printf("SERVER - ERRORE: %s deve collegarsi\n", msg.hdr.sender);
 		return;
 	}
 	if (isRegistered(users, msg.data.hdr.receiver) != 2) {
-		sendOp(fd, OP_NICK_UNKNOWN);
+		queueOp(fd, OP_NICK_UNKNOWN);
 		chattyStats.nerrors++;
 		printf("SERVER - ERRORE: gruppo %s inesistente\n", msg.data.hdr.receiver);
 		return;
@@ -405,19 +509,19 @@ void addGroupOp(hash_t users, int fd, message_t msg) {
 	// provo ad aggiungerlo al gruppo
 	if ((res = addToGroup(msg.data.hdr.receiver, msg.hdr.sender)) < 1)  {
 		if (res == -1) {
-			sendOpAtomic(msg.hdr.sender, OP_NICK_ALREADY);
+			queueOp(fd, OP_NICK_ALREADY);
 			printf("SERVER - ERRORE: utente gia' presente all'interno del gruppo\n");
 		}
 		else { // il gruppo potrebbe essere stato cancellato un istante prima
 				//   della chiamata di addToGroup
-			sendOpAtomic(msg.hdr.sender, OP_NICK_UNKNOWN);
+			queueOp(fd, OP_NICK_UNKNOWN);
 			printf("SERVER - ERRORE: gruppo inesistente\n");
 		}
 		chattyStats.nerrors++;
 		return;
 	}
 	// mando l'ack
-	sendOpAtomic(msg.hdr.sender, OP_OK);
+	queueOp(fd, OP_OK);
 }
 
 /**
@@ -431,8 +535,8 @@ void addGroupOp(hash_t users, int fd, message_t msg) {
 void delGroupOp(hash_t users, int fd, message_t msg) {
 	int res; // risultato dell'operazione di eliminazione dal gruppo
 
-	if (getOnline(msg.hdr.sender) == -1) { // richiedente non online
-		sendOp(fd, OP_FAIL);
+	if (getSession(fd, msg.hdr.sender) == -1) { // richiedente non online
+		queueOp(fd, OP_FAIL);
 		chattyStats.nerrors++;
 		printf("SERVER - ERRORE: %s deve collegarsi\n", msg.hdr.sender);
 		return;
@@ -440,7 +544,7 @@ void delGroupOp(hash_t users, int fd, message_t msg) {
 
 	// controllo che il gruppo esista
 	if (isRegistered(users, msg.data.hdr.receiver) != 2) {
-		sendOpAtomic(msg.hdr.sender, OP_NICK_UNKNOWN);
+		queueOp(fd, OP_NICK_UNKNOWN);
 		chattyStats.nerrors++;
 		printf("SERVER - ERRORE: gruppo inesistente\n");
 		return;
@@ -448,7 +552,7 @@ void delGroupOp(hash_t users, int fd, message_t msg) {
 
 	// provo a rimuovere l'utente dal gruppo
 	if ((res = removeFromGroup(msg.data.hdr.receiver, msg.hdr.sender)) < 1) {
-		sendOpAtomic(msg.hdr.sender, OP_NICK_UNKNOWN);
+		queueOp(fd, OP_NICK_UNKNOWN);
 		chattyStats.nerrors++;
 		if (res == -1)
 			printf("SERVER - ERRORE: non sei all'interno del gruppo\n");
@@ -457,5 +561,27 @@ void delGroupOp(hash_t users, int fd, message_t msg) {
 			printf("SERVER - ERRORE: gruppo inesistente\n");
 		return;
 	}
-	sendOpAtomic(msg.hdr.sender, OP_OK); // invio l'ack al mittente
+	queueOp(fd, OP_OK); // invio l'ack al mittente
+}
+
+/**
+ * @function helloOp
+ * @brief    implementa l'operazione richiesta con HELLO_OP: la conferma
+ *             viaggia nella versione corrente del protocollo, i messaggi
+ *             successivi nella nuova (il parser delle richieste e' gia' passato)
+ * 
+ * @param fd  fd del richiedente
+ * @param msg messaggio di richiesta
+ */
+void helloOp(int fd, message_t msg) {
+	int version = helloVersion(&msg);
+
+	if (version == 0) { // versione non supportata, si resta in quella corrente
+		queueOp(fd, OP_FAIL);
+		chattyStats.nerrors++;
+		printf("SERVER - ERRORE: versione del protocollo non supportata\n");
+	}
+	else
+		upgradeConn(fd, version);
+	bufFree(msg.data.buf);
 }
@@ -54,6 +54,18 @@ void connectOp(hash_t users, int fd, message_t msg);
  */
 void postTxtOp(hash_t users, int fd, message_t msg);
 
+/**
+ * @function postBatchOp
+ * @brief    implementa l'operazione richiesta con POSTBATCH_OP: consegna
+ *             i messaggi del lotto e risponde una sola volta, con OP_OK
+ *             seguito da un byte di esito per ogni messaggio
+ * 
+ * @param users tabella degli utenti
+ * @param fd    fd del richiedente
+ * @param msg   messaggio di richiesta
+ */
+void postBatchOp(hash_t users, int fd, message_t msg);
+
 /**
  * @function postTxtAllOp
  * @brief    implementa l'operazione richiesta con POSTTXTALL_OP
@@ -71,8 +83,9 @@ void postTxtAllOp(hash_t users, int fd, message_t msg);
  * @param users tabella degli utenti
  * @param fd    fd del richiedente
  * @param msg   messaggio di richiesta
+ * @param file  contenuto del file, ricevuto insieme alla richiesta
  */
-void postFileOp(hash_t users, int fd, message_t msg);
+void postFileOp(hash_t users, int fd, message_t msg, message_data_t file);
 
 /**
  * @function getFileOp
@@ -124,4 +137,15 @@ void addGroupOp(hash_t users, int fd, message_t msg);
  */
 void delGroupOp(hash_t users, int fd, message_t msg);
 
+/**
+ * @function helloOp
+ * @brief    implementa l'operazione richiesta con HELLO_OP: la conferma
+ *             viaggia nella versione corrente del protocollo, i messaggi
+ *             successivi nella nuova (il parser delle richieste e' gia' passato)
+ * 
+ * @param fd  fd del richiedente
+ * @param msg messaggio di richiesta
+ */
+void helloOp(int fd, message_t msg);
+
 #endif // OPERATIONS_H
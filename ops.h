@@ -46,6 +46,8 @@ typedef enum {
     /* 
      * aggiungere qui altre operazioni che si vogliono implementare 
      */
+    HELLO_OP         = 13,  // richiesta di cambio della versione del protocollo (1 byte di dati)
+    POSTBATCH_OP     = 14,  // richiesta di invio di piu' messaggi testuali con una sola risposta
 
     /* --------------------------------- */
     /*    messaggi inviati dal server    */
@@ -1,102 +1,272 @@
+#define _GNU_SOURCE 1
 #include <stdio.h>
 #include <stdlib.h>
-#include <pthread.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include <util.h>
+#include <config.h>
 #include <queue.h>
+#include <numa.h>
 
 /**
  * @file   queue.c
- * @brief  Contiene le funzioni che implementano una coda
- *           utilizzabile concorrentemente
+ * @brief  Contiene le funzioni che implementano una coda circolare
+ *           limitata, utilizzabile concorrentemente senza lock
+ *           da piu' produttori e piu' consumatori
  * @author Michele Zoncheddu 545227
  * 
  * Si dichiara che il contenuto di questo file e'
  *   in ogni sua parte opera originale dell'autore
+ *
+ * Ogni posizione ha un numero di sequenza: vale i quando la posizione i
+ *   e' libera per il produttore e i + 1 quando contiene un elemento per
+ *   il consumatore. Produttori e consumatori si contendono solo il
+ *   proprio indice con una compare-and-swap.
+ *
+ * Le code locali dei worker (wsqueue_t) sono code di questo tipo: il
+ *   proprietario e i worker che rubano lavoro sono tutti consumatori,
+ *   mentre la sospensione avviene su un unico futex condiviso (uno per
+ *   worker se il furto e' disabilitato).
  */
 
-// lock per l'utilizzo della coda
-static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+// peso di ogni corsia di priorita': estrazioni consecutive prima di passare alla successiva
+static const int weights[LANES] = LANE_WEIGHTS;
 
 /**
- * variabile di condizione per la sospensione fino
- * all'inserimento di un elemento nella coda vuota
+ * @function futexWait
+ * @brief    sospende il thread finche' *addr vale val (o fino ad un risveglio)
+ * 
+ * @param addr indirizzo del futex
+ * @param val  valore atteso
+ * @param ts   attesa massima (NULL per attendere indefinitamente)
+ * 
+ * @return -1 se l'attesa e' scaduta (o interrotta)
+ *          0 altrimenti
  */
-static pthread_cond_t full  = PTHREAD_COND_INITIALIZER;
+static inline int futexWait(int *addr, int val, const struct timespec *ts) {
+	return syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, ts, NULL, 0);
+}
+
+/**
+ * @function futexWaitUntil
+ * @brief    come futexWait, ma con un istante limite assoluto (CLOCK_MONOTONIC)
+ *             invece di un'attesa relativa
+ * 
+ * @param addr     indirizzo del futex
+ * @param val      valore atteso
+ * @param deadline istante limite (NULL per attendere indefinitamente)
+ * 
+ * @return -1 se l'istante limite e' passato (o l'attesa e' interrotta)
+ *          0 altrimenti
+ */
+static inline int futexWaitUntil(int *addr, int val, const struct timespec *deadline) {
+	return syscall(SYS_futex, addr, FUTEX_WAIT_BITSET_PRIVATE, val, deadline, NULL, FUTEX_BITSET_MATCH_ANY);
+}
+
+/**
+ * @function futexWake
+ * @brief    sveglia al piu' n thread sospesi sul futex
+ * 
+ * @param addr indirizzo del futex
+ * @param n    numero massimo di thread da svegliare
+ */
+static inline void futexWake(int *addr, int n) {
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
 
 /**
  * @function initQueue
  * @brief    inizializza la coda
  * 
+ * @param size numero minimo di elementi contenuti
+ *               (arrotondato alla potenza di 2 successiva)
+ * 
  * @return la coda inizializzata
  */
-queue_t *initQueue() {
-	queue_t *q = malloc(sizeof(queue_t));
-	if (!q)
-		return NULL;
+queue_t *initQueue(size_t size) {
+	size_t n = 2;
+	queue_t *q;
 
-	q->head = q->tail = NULL;
-	q->qlen = 0;
+	while (n < size)
+		n <<= 1;
+	// un solo blocco in pagine proprie, che wsBindLocal sposta sul nodo del worker
+	if (!(q = allocPages(sizeof(queue_t) + n * sizeof(cell_t))))
+		return NULL;
+	q->cells = (cell_t*)(q + 1);
+	for (size_t i = 0; i < n; ++i)
+		q->cells[i].seq = i;
+	q->mask = n - 1;
 	return q;
 }
 
 /**
- * @function enqueue
- * @brief    inserisce un elemento all'interno della coda
+ * @function tryDequeueBatch
+ * @brief    prova ad estrarre fino a max elementi consecutivi,
+ *             prenotandoli con una sola compare-and-swap, senza sospendersi
+ * 
+ * @param q    puntatore alla coda
+ * @param data array degli elementi estratti
+ * @param max  numero massimo di elementi da estrarre (> 0)
+ * 
+ * @return il numero di elementi estratti (0 se la coda e' vuota)
+ */
+int tryDequeueBatch(queue_t *q, void **data, int max) {
+	size_t pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED), seq;
+	long   diff;
+	int    k;
+
+	while (1) {
+		// conto le posizioni piene consecutive a partire dalla testa
+		for (k = 0; k < max; ++k) {
+			seq  = __atomic_load_n(&q->cells[(pos + k) & q->mask].seq, __ATOMIC_ACQUIRE);
+			diff = (long)seq - (long)(pos + k + 1);
+			if (diff != 0)
+				break;
+		}
+		if (k > 0) { // provo a prenotarle tutte insieme
+			if (__atomic_compare_exchange_n(&q->head, &pos, pos + k, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else if (diff < 0) // coda vuota
+			return 0;
+		else // un altro consumatore mi ha preceduto
+			pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+	}
+	for (int i = 0; i < k; ++i) {
+		cell_t *cell = &q->cells[(pos + i) & q->mask];
+		data[i] = cell->data;
+		// libero la posizione per il giro successivo dei produttori
+		__atomic_store_n(&cell->seq, pos + i + q->mask + 1, __ATOMIC_RELEASE);
+	}
+	return k;
+}
+
+/**
+ * @function tryDequeue
+ * @brief    prova ad estrarre un elemento senza sospendersi
  * 
  * @param q    puntatore alla coda
- * @param data puntatore ai dati da inserire nel nodo
+ * @param data puntatore all'elemento estratto
  * 
- * @return -1 se non e' stato possibile creare un nuovo nodo
+ * @return 0 se la coda e' vuota
+ *         1 altrimenti
+ */
+int tryDequeue(queue_t *q, void **data) {
+	return tryDequeueBatch(q, data, 1);
+}
+
+/**
+ * @function enqueueBatch
+ * @brief    inserisce n elementi in posizioni consecutive,
+ *             prenotandole con una sola compare-and-swap
+ * 
+ * @param q    puntatore alla coda
+ * @param data array degli elementi da inserire
+ * @param n    numero di elementi (al piu' la capacita' della coda)
+ * 
+ * @return -1 se la coda non ha n posizioni libere (nessun elemento inserito)
  *          1 altrimenti
  */
-int enqueue(queue_t *q, void *data) {
-	node_t *new = malloc(sizeof(node_t));
-	if (!new)
-		return -1;
+int enqueueBatch(queue_t *q, void **data, int n) {
+	size_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED), seq;
+	long   diff;
+	int    k;
+
+	while (1) {
+		// controllo che le n posizioni a partire dalla fine siano libere
+		for (k = 0; k < n; ++k) {
+			seq  = __atomic_load_n(&q->cells[(pos + k) & q->mask].seq, __ATOMIC_ACQUIRE);
+			diff = (long)seq - (long)(pos + k);
+			if (diff != 0)
+				break;
+		}
+		if (k == n) { // provo a prenotarle tutte insieme
+			if (__atomic_compare_exchange_n(&q->tail, &pos, pos + n, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else if (diff < 0) // posizioni libere insufficienti
+			return -1;
+		else // un altro produttore mi ha preceduto
+			pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+	}
+	for (int i = 0; i < n; ++i) {
+		cell_t *cell = &q->cells[(pos + i) & q->mask];
+		cell->data = data[i];
+		__atomic_store_n(&cell->seq, pos + i + 1, __ATOMIC_RELEASE);
+	}
 
-	new->data = data;
-	new->next = NULL;
-	pthread_mutex_lock(&mutex);
-	if (q->qlen == 0)
-		q->head = q->tail = new;
-	else {
-		q->tail->next = new;
-		q->tail = new;
+	// sveglio i consumatori solo se qualcuno si e' sospeso
+	//   (la barriera ordina la pubblicazione rispetto alla lettura di waiters)
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&q->waiters, __ATOMIC_RELAXED) > 0) {
+		__atomic_add_fetch(&q->event, 1, __ATOMIC_SEQ_CST);
+		futexWake(&q->event, n);
 	}
-	q->qlen++;
-	pthread_cond_signal(&full);
-	pthread_mutex_unlock(&mutex);
 	return 1;
 }
 
+/**
+ * @function enqueue
+ * @brief    inserisce un elemento all'interno della coda
+ * 
+ * @param q    puntatore alla coda
+ * @param data elemento da inserire
+ * 
+ * @return -1 se la coda e' piena
+ *          1 altrimenti
+ */
+int enqueue(queue_t *q, void *data) {
+	return enqueueBatch(q, &data, 1);
+}
+
 /**
  * @function dequeue
- * @brief    estrae un elemento dalla coda
+ * @brief    estrae un elemento dalla coda, sospendendosi se e' vuota
  * 
  * @param q puntatore alla coda
  * 
- * @return puntatore ai dati dell'elemento estratto
+ * @return l'elemento estratto
  */
 void *dequeue(queue_t *q) {
 	void *data;
-	pthread_mutex_lock(&mutex);
-	while (q->qlen == 0)
-		pthread_cond_wait(&full, &mutex);
-	if (q->qlen == 1) {
-		data = q->head->data;
-		free(q->head);
-		q->head = q->tail = NULL;
-	}
-	else {
-		node_t *tmp = q->head;
-		data = q->head->data;
-		q->head = q->head->next;
-		free(tmp);
+	int   ev;
+
+	while (1) {
+		// attesa attiva breve, per non sospendersi sotto carico
+		for (int i = 0; i < QUEUE_SPINS; ++i)
+			if (tryDequeue(q, &data))
+				return data;
+
+		// mi dichiaro in attesa e ricontrollo prima di sospendermi:
+		//   un inserimento successivo vede waiters e cambia event
+		__atomic_add_fetch(&q->waiters, 1, __ATOMIC_SEQ_CST);
+		ev = __atomic_load_n(&q->event, __ATOMIC_SEQ_CST);
+		if (tryDequeue(q, &data)) {
+			__atomic_sub_fetch(&q->waiters, 1, __ATOMIC_SEQ_CST);
+			return data;
+		}
+		futexWait(&q->event, ev, NULL);
+		__atomic_sub_fetch(&q->waiters, 1, __ATOMIC_SEQ_CST);
 	}
-	q->qlen--;
-	pthread_mutex_unlock(&mutex);
-	return data;
+}
+
+/**
+ * @function queueLength
+ * @brief    restituisce il numero (approssimato) di elementi in coda
+ * 
+ * @param q puntatore alla coda
+ * 
+ * @return il numero di elementi
+ */
+size_t queueLength(queue_t *q) {
+	size_t head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+	size_t tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+	return tail > head ? tail - head : 0;
 }
 
 /**
@@ -106,18 +276,310 @@ void *dequeue(queue_t *q) {
  * @param q puntatore alla coda
  */
 void freeQueue(queue_t *q) {
-	if (q->qlen == 0) 
-		free(q);
-	else {
-		node_t *elem, *tmp;
-		elem = q->head;
-		while (elem) {
-			tmp = elem;
-			elem = elem->next;
-			free(tmp->data);
-			free(tmp);
-			q->qlen--;
+	// gli elementi sono memorizzati per valore, non c'e' nulla da liberare
+	free(q); // le posizioni sono nello stesso blocco
+}
+
+/**
+ * @function initWsQueue
+ * @brief    inizializza le code locali dei worker
+ * 
+ * @param n     numero di worker
+ * @param size  numero minimo di elementi di ogni coda locale
+ * @param steal 1 per abilitare il furto del lavoro, 0 se ogni elemento
+ *                deve essere estratto dal worker destinatario
+ * 
+ * @return le code inizializzate
+ */
+wsqueue_t *initWsQueue(int n, size_t size, int steal) {
+	void *p;
+	wsqueue_t *w = calloc(1, sizeof(wsqueue_t));
+	if (!w)
+		return NULL;
+	w->n      = n;
+	w->active = n;
+	w->steal  = steal;
+	if (!(w->local = calloc(n * LANES, sizeof(queue_t*)))) {
+		freeWsQueue(w);
+		return NULL;
+	}
+	// punti di sospensione e stato dello scheduling allineati alla linea di cache
+	if (posix_memalign(&p, CACHE_LINE, n * sizeof(park_t)) != 0) {
+		freeWsQueue(w);
+		return NULL;
+	}
+	w->park = memset(p, 0, n * sizeof(park_t));
+	if (posix_memalign(&p, CACHE_LINE, n * sizeof(sched_t)) != 0) {
+		freeWsQueue(w);
+		return NULL;
+	}
+	w->sched = memset(p, 0, n * sizeof(sched_t));
+	for (int i = 0; i < n; ++i)
+		w->sched[i].credit = weights[0];
+	for (int i = 0; i < n * LANES; ++i)
+		if (!(w->local[i] = initQueue(size))) {
+			freeWsQueue(w);
+			return NULL;
 		}
-		free(q);
+	return w;
+}
+
+/**
+ * @function parkOf
+ * @brief    restituisce il punto di sospensione di un worker
+ * 
+ * @param w  puntatore alle code
+ * @param id indice del worker
+ * 
+ * @return il punto di sospensione condiviso se il furto e' abilitato,
+ *         quello del worker altrimenti
+ */
+static inline park_t *parkOf(wsqueue_t *w, int id) {
+	return w->steal ? &w->park[0] : &w->park[id];
+}
+
+/**
+ * @function wsTarget
+ * @brief    restituisce il worker attivo a cui corrisponde un indice
+ * 
+ * @param w      puntatore alle code
+ * @param target indice richiesto
+ * 
+ * @return l'indice del worker destinatario
+ */
+int wsTarget(wsqueue_t *w, int target) {
+	return target % __atomic_load_n(&w->active, __ATOMIC_RELAXED); // solo tra i worker attivi
+}
+
+/**
+ * @function wsEnqueueBatch
+ * @brief    inserisce n elementi nella coda locale di un worker per la
+ *             corsia indicata e sveglia fino a n worker sospesi, se presenti
+ * 
+ * @param w      puntatore alle code
+ * @param target indice del worker destinatario
+ * @param lane   corsia di priorita' (0 <= lane < LANES)
+ * @param data   array degli elementi da inserire
+ * @param n      numero di elementi
+ * 
+ * @return -1 se la coda e' piena
+ *          1 altrimenti
+ */
+int wsEnqueueBatch(wsqueue_t *w, int target, int lane, void **data, int n) {
+	park_t *p;
+
+	target = wsTarget(w, target);
+	if (enqueueBatch(w->local[target * LANES + lane], data, n) == -1)
+		return -1;
+
+	// con il furto il worker svegliato puo' non essere il destinatario:
+	//   in quel caso ruba l'elemento
+	p = parkOf(w, target);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&p->waiters, __ATOMIC_RELAXED) > 0) {
+		__atomic_add_fetch(&p->event, 1, __ATOMIC_SEQ_CST);
+		futexWake(&p->event, n);
+	}
+	return 1;
+}
+
+/**
+ * @function wsEnqueue
+ * @brief    inserisce un elemento nella coda locale di un worker
+ *             per la corsia indicata e sveglia un worker sospeso, se presente
+ * 
+ * @param w      puntatore alle code
+ * @param target indice del worker destinatario
+ * @param lane   corsia di priorita' (0 <= lane < LANES)
+ * @param data   elemento da inserire
+ * 
+ * @return -1 se la coda e' piena
+ *          1 altrimenti
+ */
+int wsEnqueue(wsqueue_t *w, int target, int lane, void *data) {
+	return wsEnqueueBatch(w, target, lane, &data, 1);
+}
+
+/**
+ * @function tryLanes
+ * @brief    prova ad estrarre fino a max elementi da una corsia di un worker,
+ *             servendo ogni corsia per al piu' il suo peso di estrazioni
+ *             consecutive prima di passare alla successiva
+ * 
+ * @param w     puntatore alle code
+ * @param id    indice del worker che estrae
+ * @param owner indice del worker proprietario delle corsie
+ * @param data  array degli elementi estratti
+ * @param max   numero massimo di elementi da estrarre
+ * 
+ * @return il numero di elementi estratti (0 se tutte le corsie sono vuote)
+ */
+static int tryLanes(wsqueue_t *w, int id, int owner, void **data, int max) {
+	sched_t  *s     = &w->sched[id];
+	queue_t **lanes = &w->local[owner * LANES];
+	int       k;
+
+	// un giro completo, piu' la corsia di partenza con il peso ripristinato
+	for (int i = 0; i <= LANES; ++i) {
+		if (s->credit > 0 && (k = tryDequeueBatch(lanes[s->lane], data, s->credit < max ? s->credit : max)) > 0) {
+			s->credit -= k;
+			return k;
+		}
+		s->lane   = (s->lane + 1) % LANES; // corsia vuota o peso esaurito
+		s->credit = weights[s->lane];
 	}
+	return 0;
+}
+
+/**
+ * @function trySteal
+ * @brief    prova ad estrarre fino a max elementi dalla coda locale
+ *             o, a turno, un elemento da quelle degli altri worker (se abilitato)
+ * 
+ * @param w    puntatore alle code
+ * @param id   indice del worker
+ * @param data array degli elementi estratti
+ * @param max  numero massimo di elementi da estrarre dalla coda locale
+ * 
+ * @return il numero di elementi estratti (0 se tutte le code sono vuote)
+ */
+static int trySteal(wsqueue_t *w, int id, void **data, int max) {
+	int n = w->steal ? w->n : 1, k;
+	if ((k = tryLanes(w, id, id, data, max)) > 0)
+		return k;
+	for (int i = 1; i < n; ++i) // rubo un elemento alla volta, il resto e' del proprietario
+		if (tryLanes(w, id, (id + i) % w->n, data, 1))
+			return 1;
+	return 0;
+}
+
+/**
+ * @function wsTimedDequeue
+ * @brief    estrae fino a max elementi dalla coda locale del worker o, se e'
+ *             vuota e il furto e' abilitato, un elemento da quelle degli altri
+ *             worker, sospendendosi se sono tutte vuote per al piu' ms millisecondi
+ *             in tutto
+ * 
+ * @param w    puntatore alle code
+ * @param id   indice del worker
+ * @param ms   attesa massima in millisecondi (< 0 per attendere indefinitamente)
+ * @param data array degli elementi estratti
+ * @param max  numero massimo di elementi da estrarre
+ * 
+ * @return il numero di elementi estratti (0 se l'attesa e' scaduta)
+ */
+int wsTimedDequeue(wsqueue_t *w, int id, long ms, void **data, int max) {
+	park_t *p = parkOf(w, id);
+	int     ev, r, k;
+	long    ns;
+	struct timespec deadline;
+
+	// un solo istante limite per tutta l'attesa: i risvegli senza elementi
+	//   (ad esempio rubati da un altro worker) non la fanno ripartire
+	if (ms >= 0) {
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		ns               = deadline.tv_nsec + (ms % 1000) * 1000000L;
+		deadline.tv_sec += ms / 1000 + ns / 1000000000L;
+		deadline.tv_nsec = ns % 1000000000L;
+	}
+	while (1) {
+		// estraggo piu' elementi solo se non ci sono worker sospesi che potrebbero servirli
+		if (w->steal && __atomic_load_n(&p->waiters, __ATOMIC_RELAXED) > 0)
+			max = 1;
+		for (int i = 0; i < QUEUE_SPINS; ++i)
+			if ((k = trySteal(w, id, data, max)) > 0)
+				return k;
+
+		// stesso protocollo di dequeue, ma su tutte le code visibili al worker
+		__atomic_add_fetch(&p->waiters, 1, __ATOMIC_SEQ_CST);
+		ev = __atomic_load_n(&p->event, __ATOMIC_SEQ_CST);
+		if ((k = trySteal(w, id, data, 1)) > 0) {
+			__atomic_sub_fetch(&p->waiters, 1, __ATOMIC_SEQ_CST);
+			return k;
+		}
+		r = futexWaitUntil(&p->event, ev, ms < 0 ? NULL : &deadline);
+		__atomic_sub_fetch(&p->waiters, 1, __ATOMIC_SEQ_CST);
+		if (r == -1 && errno == ETIMEDOUT)
+			return trySteal(w, id, data, 1); // ultimo tentativo prima di arrendermi
+	}
+}
+
+/**
+ * @function wsDequeue
+ * @brief    estrae un elemento dalla coda locale del worker o, se e' vuota
+ *             e il furto e' abilitato, da quelle degli altri worker,
+ *             sospendendosi se sono tutte vuote
+ * 
+ * @param w  puntatore alle code
+ * @param id indice del worker
+ * 
+ * @return l'elemento estratto
+ */
+void *wsDequeue(wsqueue_t *w, int id) {
+	void *data;
+	wsTimedDequeue(w, id, -1, &data, 1);
+	return data;
+}
+
+/**
+ * @function wsLength
+ * @brief    restituisce il numero (approssimato) di elementi
+ *             nelle corsie di un worker
+ * 
+ * @param w  puntatore alle code
+ * @param id indice del worker
+ * 
+ * @return il numero di elementi
+ */
+size_t wsLength(wsqueue_t *w, int id) {
+	size_t len = 0;
+	for (int i = 0; i < LANES; ++i)
+		len += queueLength(w->local[id * LANES + i]);
+	return len;
+}
+
+/**
+ * @function wsResize
+ * @brief    cambia il numero di worker attivi, tra le cui code vengono
+ *             distribuiti gli elementi (gli elementi gia' presenti nelle code
+ *             dei worker non piu' attivi vengono rubati dagli altri)
+ * 
+ * @param w      puntatore alle code
+ * @param active numero di worker attivi (1 <= active <= n)
+ */
+void wsResize(wsqueue_t *w, int active) {
+	__atomic_store_n(&w->active, active, __ATOMIC_RELAXED);
+}
+
+/**
+ * @function wsBindLocal
+ * @brief    sposta le corsie di un worker sul nodo NUMA del thread chiamante
+ *             (il worker stesso, nessun effetto senza NumaLocal)
+ * 
+ * @param w  puntatore alle code
+ * @param id indice del worker
+ */
+void wsBindLocal(wsqueue_t *w, int id) {
+	queue_t *q;
+	for (int i = 0; i < LANES; ++i) {
+		q = w->local[id * LANES + i];
+		bindLocal(q, sizeof(queue_t) + (q->mask + 1) * sizeof(cell_t));
+	}
+}
+
+/**
+ * @function freeWsQueue
+ * @brief    libera le code locali dei worker
+ * 
+ * @param w puntatore alle code
+ */
+void freeWsQueue(wsqueue_t *w) {
+	if (w->local)
+		for (int i = 0; i < w->n * LANES; ++i)
+			if (w->local[i])
+				freeQueue(w->local[i]);
+	free(w->local);
+	free(w->park);
+	free(w->sched);
+	free(w);
 }
@@ -1,72 +1,196 @@
 #ifndef QUEUE_H_
 #define QUEUE_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 /**
  * @file   queue.h
- * @brief  Contiene le funzioni che implementano una coda
- *           utilizzabile concorrentemente
+ * @brief  Contiene le funzioni che implementano una coda circolare
+ *           limitata, utilizzabile concorrentemente senza lock
+ *           da piu' produttori e piu' consumatori
  * @author Michele Zoncheddu 545227
  * 
  * Si dichiara che il contenuto di questo file e'
  *   in ogni sua parte opera originale dell'autore
  */
 
+#define CACHE_LINE 64 // dimensione di una linea di cache
+
+// conversione tra interi (es. fd) ed elementi della coda, senza allocazioni:
+//   l'elemento dell'intero 0 non coincide con END (NULL)
+#define INT_TO_ITEM(i) ((void*)(intptr_t)((i) + 1))
+#define ITEM_TO_INT(p) ((int)((intptr_t)(p) - 1))
+
 /**
- * @struct node
- * @brief  nodo della lista
+ * @struct cell_t
+ * @brief  posizione della coda
  * 
- * @var data puntatore ai dati del nodo
- * @var next puntatore al prossimo nodo della lista
+ * @var seq  numero di sequenza, indica se la posizione e' libera
+ *             o piena per il giro corrente
+ * @var data elemento memorizzato
  */
-typedef struct node {
-	void        *data;
-	struct node *next;
-} node_t;
+typedef struct {
+	size_t  seq;
+	void   *data;
+} cell_t;
 
 /**
  * @struct queue
- * @brief  dati della coda
+ * @brief  dati della coda (indici su linee di cache separate)
  * 
- * @var head puntatore alla testa della coda
- * @var tail puntatore alla fine della coda
- * @var quel lunghezza della coda
+ * @var cells   array delle posizioni
+ * @var mask    maschera per gli indici (dimensione - 1)
+ * @var tail    prossima posizione da scrivere (produttori)
+ * @var head    prossima posizione da leggere (consumatori)
+ * @var event   contatore degli inserimenti notificati, usato come futex
+ * @var waiters numero di consumatori sospesi (o in procinto di farlo)
  */
 typedef struct queue {
-	node_t        *head;
-	node_t        *tail;
-	unsigned long  qlen;
+	cell_t   *cells;
+	size_t    mask;
+	char      pad0[CACHE_LINE];
+	size_t    tail;
+	char      pad1[CACHE_LINE - sizeof(size_t)];
+	size_t    head;
+	char      pad2[CACHE_LINE - sizeof(size_t)];
+	int       event;
+	int       waiters;
 } queue_t;
+/**
+ * @struct park_t
+ * @brief  punto di sospensione dei worker senza lavoro,
+ *           su una propria linea di cache
+ * 
+ * @var event   contatore degli inserimenti notificati, usato come futex
+ * @var waiters numero di worker sospesi (o in procinto di farlo)
+ */
+typedef struct {
+	int  event;
+	int  waiters;
+	char pad[CACHE_LINE - 2 * sizeof(int)];
+} park_t;
+
+/**
+ * @struct sched_t
+ * @brief  stato dello scheduling pesato tra le corsie di un worker,
+ *           su una propria linea di cache (usato solo dal worker)
+ * 
+ * @var lane   corsia corrente
+ * @var credit estrazioni rimaste alla corsia corrente prima di passare alla successiva
+ */
+typedef struct {
+	int  lane;
+	int  credit;
+	char pad[CACHE_LINE - 2 * sizeof(int)];
+} sched_t;
+
+/**
+ * @struct wsqueue_t
+ * @brief  insieme di code locali, una per worker e per corsia di priorita',
+ *           con furto del lavoro: un worker senza lavoro estrae dalle code
+ *           degli altri. Le corsie sono servite a turno, ognuna per al piu'
+ *           il proprio peso di estrazioni consecutive (LANE_WEIGHTS)
+ * 
+ * @var local coda locale di ogni worker per ogni corsia (local[worker * LANES + corsia])
+ * @var n      numero di worker
+ * @var active numero di worker attivi (indici 0..active-1), tra le cui code
+ *               sono distribuiti gli elementi
+ * @var steal 1 se i worker senza lavoro estraggono dalle code degli altri
+ * @var park  punti di sospensione: uno condiviso con il furto, uno per worker senza
+ * @var sched stato dello scheduling di ogni worker
+ */
+typedef struct {
+	queue_t **local;
+	int       n;
+	int       active;
+	int       steal;
+	park_t   *park;
+	sched_t  *sched;
+} wsqueue_t;
 
 /**
  * @function initQueue
  * @brief    inizializza la coda
  * 
+ * @param size numero minimo di elementi contenuti
+ *               (arrotondato alla potenza di 2 successiva)
+ * 
  * @return la coda inizializzata
  */
-queue_t *initQueue();
+queue_t *initQueue(size_t size);
 
 /**
  * @function enqueue
  * @brief    inserisce un elemento all'interno della coda
  * 
  * @param q    puntatore alla coda
- * @param data puntatore ai dati da inserire nel nodo
+ * @param data elemento da inserire
  * 
- * @return -1 se non e' stato possibile creare un nuovo nodo
+ * @return -1 se la coda e' piena
  *          1 altrimenti
  */
 int enqueue(queue_t *q, void *data);
 
+/**
+ * @function enqueueBatch
+ * @brief    inserisce n elementi in posizioni consecutive,
+ *             prenotandole con una sola compare-and-swap
+ * 
+ * @param q    puntatore alla coda
+ * @param data array degli elementi da inserire
+ * @param n    numero di elementi (al piu' la capacita' della coda)
+ * 
+ * @return -1 se la coda non ha n posizioni libere (nessun elemento inserito)
+ *          1 altrimenti
+ */
+int enqueueBatch(queue_t *q, void **data, int n);
+
+/**
+ * @function tryDequeueBatch
+ * @brief    prova ad estrarre fino a max elementi consecutivi,
+ *             prenotandoli con una sola compare-and-swap, senza sospendersi
+ * 
+ * @param q    puntatore alla coda
+ * @param data array degli elementi estratti
+ * @param max  numero massimo di elementi da estrarre (> 0)
+ * 
+ * @return il numero di elementi estratti (0 se la coda e' vuota)
+ */
+int tryDequeueBatch(queue_t *q, void **data, int max);
+
+/**
+ * @function tryDequeue
+ * @brief    prova ad estrarre un elemento senza sospendersi
+ * 
+ * @param q    puntatore alla coda
+ * @param data puntatore all'elemento estratto
+ * 
+ * @return 0 se la coda e' vuota
+ *         1 altrimenti
+ */
+int tryDequeue(queue_t *q, void **data);
+
 /**
  * @function dequeue
- * @brief    estrae un elemento dalla coda
+ * @brief    estrae un elemento dalla coda, sospendendosi se e' vuota
  * 
  * @param q puntatore alla coda
  * 
- * @return puntatore ai dati dell'elemento estratto
+ * @return l'elemento estratto
  */
 void *dequeue(queue_t *q);
 
+/**
+ * @function queueLength
+ * @brief    restituisce il numero (approssimato) di elementi in coda
+ * 
+ * @param q puntatore alla coda
+ * 
+ * @return il numero di elementi
+ */
+size_t queueLength(queue_t *q);
+
 /**
  * @function freeQueue
  * @brief    libera la coda
@@ -74,5 +198,130 @@ void *dequeue(queue_t *q);
  * @param q puntatore alla coda
  */
 void freeQueue(queue_t *q);
+/**
+ * @function initWsQueue
+ * @brief    inizializza le code locali dei worker
+ * 
+ * @param n     numero di worker
+ * @param size  numero minimo di elementi di ogni coda locale
+ * @param steal 1 per abilitare il furto del lavoro, 0 se ogni elemento
+ *                deve essere estratto dal worker destinatario
+ * 
+ * @return le code inizializzate
+ */
+wsqueue_t *initWsQueue(int n, size_t size, int steal);
+
+/**
+ * @function wsTarget
+ * @brief    restituisce il worker attivo a cui corrisponde un indice
+ * 
+ * @param w      puntatore alle code
+ * @param target indice richiesto
+ * 
+ * @return l'indice del worker destinatario
+ */
+int wsTarget(wsqueue_t *w, int target);
+
+/**
+ * @function wsEnqueueBatch
+ * @brief    inserisce n elementi nella coda locale di un worker per la
+ *             corsia indicata e sveglia fino a n worker sospesi, se presenti
+ * 
+ * @param w      puntatore alle code
+ * @param target indice del worker destinatario
+ * @param lane   corsia di priorita' (0 <= lane < LANES)
+ * @param data   array degli elementi da inserire
+ * @param n      numero di elementi
+ * 
+ * @return -1 se la coda e' piena
+ *          1 altrimenti
+ */
+int wsEnqueueBatch(wsqueue_t *w, int target, int lane, void **data, int n);
+
+/**
+ * @function wsEnqueue
+ * @brief    inserisce un elemento nella coda locale di un worker
+ *             per la corsia indicata e sveglia un worker sospeso, se presente
+ * 
+ * @param w      puntatore alle code
+ * @param target indice del worker destinatario
+ * @param lane   corsia di priorita' (0 <= lane < LANES)
+ * @param data   elemento da inserire
+ * 
+ * @return -1 se la coda e' piena
+ *          1 altrimenti
+ */
+int wsEnqueue(wsqueue_t *w, int target, int lane, void *data);
+
+/**
+ * @function wsTimedDequeue
+ * @brief    estrae fino a max elementi dalla coda locale del worker o, se e'
+ *             vuota e il furto e' abilitato, un elemento da quelle degli altri
+ *             worker, sospendendosi se sono tutte vuote per al piu' ms millisecondi
+ *             in tutto
+ * 
+ * @param w    puntatore alle code
+ * @param id   indice del worker
+ * @param ms   attesa massima in millisecondi (< 0 per attendere indefinitamente)
+ * @param data array degli elementi estratti
+ * @param max  numero massimo di elementi da estrarre
+ * 
+ * @return il numero di elementi estratti (0 se l'attesa e' scaduta)
+ */
+int wsTimedDequeue(wsqueue_t *w, int id, long ms, void **data, int max);
+
+/**
+ * @function wsDequeue
+ * @brief    estrae un elemento dalla coda locale del worker o, se e' vuota
+ *             e il furto e' abilitato, da quelle degli altri worker,
+ *             sospendendosi se sono tutte vuote
+ * 
+ * @param w  puntatore alle code
+ * @param id indice del worker
+ * 
+ * @return l'elemento estratto
+ */
+void *wsDequeue(wsqueue_t *w, int id);
+
+/**
+ * @function wsLength
+ * @brief    restituisce il numero (approssimato) di elementi
+ *             nelle corsie di un worker
+ * 
+ * @param w  puntatore alle code
+ * @param id indice del worker
+ * 
+ * @return il numero di elementi
+ */
+size_t wsLength(wsqueue_t *w, int id);
+
+/**
+ * @function wsResize
+ * @brief    cambia il numero di worker attivi, tra le cui code vengono
+ *             distribuiti gli elementi (gli elementi gia' presenti nelle code
+ *             dei worker non piu' attivi vengono rubati dagli altri)
+ * 
+ * @param w      puntatore alle code
+ * @param active numero di worker attivi (1 <= active <= n)
+ */
+void wsResize(wsqueue_t *w, int active);
+
+/**
+ * @function wsBindLocal
+ * @brief    sposta le corsie di un worker sul nodo NUMA del thread chiamante
+ *             (il worker stesso, nessun effetto senza NumaLocal)
+ * 
+ * @param w  puntatore alle code
+ * @param id indice del worker
+ */
+void wsBindLocal(wsqueue_t *w, int id);
+
+/**
+ * @function freeWsQueue
+ * @brief    libera le code locali dei worker
+ * 
+ * @param w puntatore alle code
+ */
+void freeWsQueue(wsqueue_t *w);
 
 #endif // QUEUE_H_
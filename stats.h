@@ -10,6 +10,7 @@
 #define MEMBOX_STATS_
 
 #include <stdio.h>
+#include <stdint.h>
 #include <time.h>
 
 /**
@@ -46,6 +47,100 @@ typedef struct {
 
 /* aggiungere qui altre funzioni di utilita' per le statistiche */
 
+#define HIST_BUCKETS 24 // classi di un istogramma: la i-esima conta le durate < 2^i microsecondi
+
+/**
+ * @struct histogram_t
+ * @brief  istogramma di durate in scala logaritmica (l'ultima classe
+ *           conta anche tutte le durate maggiori)
+ *
+ * @var count numero di durate di ogni classe
+ */
+typedef struct {
+    unsigned long count[HIST_BUCKETS];
+} histogram_t;
+
+/**
+ * @function histAdd
+ * @brief    registra una durata (un solo thread scrive ogni istogramma,
+ *             gli altri possono leggerlo con histMerge)
+ *
+ * @param h    puntatore all'istogramma
+ * @param usec durata in microsecondi
+ */
+static inline void histAdd(histogram_t *h, uint64_t usec) {
+    int i = usec ? 64 - __builtin_clzll(usec) : 0;
+    if (i >= HIST_BUCKETS)
+        i = HIST_BUCKETS - 1;
+    __atomic_store_n(&h->count[i], __atomic_load_n(&h->count[i], __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @function histMerge
+ * @brief    somma un istogramma ad un altro
+ *
+ * @param dst puntatore all'istogramma di destinazione
+ * @param src puntatore all'istogramma da sommare (anche mentre viene aggiornato)
+ *
+ * @return il numero di durate sommate
+ */
+static inline unsigned long histMerge(histogram_t *dst, histogram_t *src) {
+    unsigned long n = 0, c;
+    for (int i = 0; i < HIST_BUCKETS; ++i) {
+        c = __atomic_load_n(&src->count[i], __ATOMIC_RELAXED);
+        dst->count[i] += c;
+        n += c;
+    }
+    return n;
+}
+
+/**
+ * @function histPercentile
+ * @brief    restituisce il limite superiore della classe che contiene
+ *             il percentile richiesto
+ *
+ * @param h puntatore all'istogramma
+ * @param p percentile (da 1 a 100)
+ *
+ * @return il limite in microsecondi (0 se l'istogramma e' vuoto)
+ */
+static inline unsigned long histPercentile(histogram_t *h, int p) {
+    unsigned long n = 0, seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; ++i)
+        n += h->count[i];
+    for (int i = 0; i < HIST_BUCKETS && n > 0; ++i)
+        if ((seen += h->count[i]) * 100 >= n * p)
+            return 1UL << i;
+    return 0;
+}
+
+/**
+ * @function printHist
+ * @brief    stampa una riga di commento con i percentili di un istogramma
+ *
+ * @param fout  descrittore del file aperto in scrittura
+ * @param op    operazione a cui si riferisce l'istogramma
+ * @param label nome della durata misurata
+ * @param h     puntatore all'istogramma
+ *
+ * @return 0 in caso di successo, -1 in caso di fallimento
+ */
+static inline int printHist(FILE *fout, int op, const char *label, histogram_t *h) {
+    unsigned long n = 0;
+    for (int i = 0; i < HIST_BUCKETS; ++i)
+        n += h->count[i];
+    if (n == 0)
+        return 0;
+    if (fprintf(fout, "# op %2d %-8s n %lu p50 <%luus p90 <%luus p99 <%luus max <%luus\n",
+        op, label, n,
+        histPercentile(h, 50),
+        histPercentile(h, 90),
+        histPercentile(h, 99),
+        histPercentile(h, 100)
+        ) < 0) return -1;
+    return 0;
+}
+
 
 /**
  * @function printStats
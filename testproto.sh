@@ -0,0 +1,100 @@
+#!/bin/bash
+
+if [[ $# != 1 ]]; then
+    echo "usa $0 unix_path"
+    exit 1
+fi
+
+# registro un po' di nickname
+./client -l $1 -c pippo &
+./client -l $1 -c pluto &
+./client -l $1 -c minni &
+./client -l $1 -c quo &
+./client -l $1 -c clarabella &
+./client -l $1 -c paperino &
+wait
+
+# versione 2 del protocollo (header compatti): testo, file e lista degli utenti online
+./client -l $1 -V 2 -k pippo -S "Ciao pluto":pluto -S "ciao a tutti": -s ./libchatty.a:pluto -L
+if [[ $? != 0 ]]; then
+    exit 1
+fi
+# pluto recupera la history e scarica il file in versione 2
+./client -l $1 -V 2 -k pluto -p
+if [[ $? != 0 ]]; then
+    exit 1
+fi
+
+# versione 3 (dati lunghi compressi): messaggi lunghi e file comprimibili
+L=$(printf 'ciao pluto, %.0s' {1..40})
+./client -l $1 -V 3 -k pippo -S "$L":pluto -S "$L": -s DATA/chatty.conf1:pluto -s chatty.c:pluto
+if [[ $? != 0 ]]; then
+    exit 1
+fi
+# la history viene riletta in versione 3 e in versione 1: gli stessi dati, compressi o no
+./client -l $1 -V 3 -k pluto -p
+if [[ $? != 0 ]]; then
+    exit 1
+fi
+./client -l $1 -k pluto -p
+if [[ $? != 0 ]]; then
+    exit 1
+fi
+
+# lotti di messaggi: un lotto di BATCH_MAXMSGS (64) messaggi viene consegnato,
+#   uno piu' lungo viene rifiutato per intero con OP_FAIL
+OP_FAIL=25
+lotto=()
+for ((i=1;i<=64;++i)); do
+    lotto+=(-S "lotto$i":paperino)
+done
+./client -l $1 -k pippo -b 64 "${lotto[@]}"
+if [[ $? != 0 ]]; then
+    exit 1
+fi
+./client -l $1 -k pippo -b 65 "${lotto[@]}" -S "troppi":paperino
+e=$?
+if [[ $((256-e)) != $OP_FAIL ]]; then
+    echo "Errore non corrispondente $e"
+    exit 1
+fi
+# nessun messaggio del lotto rifiutato e' stato consegnato
+if ./client -l $1 -k paperino -p | grep -q "troppi"; then
+    echo "Lotto rifiutato consegnato"
+    exit 1
+fi
+
+for ((i=0;i<8;++i)); do
+
+    # client di versioni diverse che si scambiano messaggi contemporaneamente
+    ./client -l $1 -t 200 -V 2 -k quo -L -p -S "aaaaaaaaaaaaaaaaaaaaaaaaaaa":pluto -S "bbbbbbbbbbbbbbbbb": -S "ccccccccccccccccc":minni -s chatty:clarabella &
+    ./client -l $1 -t 100 -V 2 -k clarabella -S "bbbbbbbbbbbbbbbbbbbbbbbbbbbbb": -s chatty:minni -S "ccccccccccccccccc": -S "ddddddddddddddddddddd":quo -p &
+    ./client -l $1 -t 500 -V 3 -k pippo -L -s chatty.o:quo -s client:quo -s libchatty.a:quo -S "$L":minni -p &
+    ./client -l $1 -t 200 -V 3 -k pluto -s DATA/chatty.conf1:pippo -S "$L":pippo -S "$L":quo -p &
+    ./client -l $1 -t 200 -V 3 -B -k paperino -S "aaaaaaaaaaaaaaaaaaaaaaaaaaa":minni -S "bbbbbbbbbbbbbbbbb":pluto -S "ccccccccccccccccc": -S "ddddddddddddddddddddd":quo -s client:minni -S "$L":clarabella -S "$L":pluto -p &
+    ./client -l $1 -t 300 -k minni -S "eeeeeeeeeeeeeeeeeeeee":quo -S "fffffffffffffffff":clarabella -s ./libchatty.a:quo -p &
+
+    wait
+done
+
+# un messaggio lungo verso un gruppo e a tutti (i gruppi non ricevono i messaggi a tutti):
+#   i dati condivisi vengono compressi una volta per tutti
+./client -l $1 -V 3 -k pippo -g gruppo3
+if [[ $? != 0 ]]; then
+    exit 1
+fi
+./client -l $1 -k pluto -a gruppo3
+if [[ $? != 0 ]]; then
+    exit 1
+fi
+./client -l $1 -V 3 -k minni -a gruppo3 -S "$L":gruppo3 -S "$L":
+if [[ $? != 0 ]]; then
+    exit 1
+fi
+./client -l $1 -V 3 -k pluto -p
+if [[ $? != 0 ]]; then
+    exit 1
+fi
+
+echo "Test OK!"
+exit 0
@@ -0,0 +1,193 @@
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <config.h>
+#include <uring.h>
+
+/**
+ * @file   uring.c
+ * @brief  Contiene le funzioni che implementano un'interfaccia minimale
+ *           verso io_uring, usata come backend opzionale del listener
+ *           (compilato solo con USE_IO_URING, vedi Makefile)
+ * @author Michele Zoncheddu 545227
+ *
+ * Si dichiara che il contenuto di questo file e'
+ *   in ogni sua parte opera originale dell'autore
+ */
+
+#if defined(USE_IO_URING)
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/time_types.h>
+
+/**
+ * @function initUring
+ * @brief    crea un'istanza io_uring e mappa le sue code
+ *
+ * @param r       puntatore all'anello da inizializzare
+ * @param entries numero di posizioni della coda di sottomissione
+ *
+ * @return -1 se io_uring non e' disponibile (errno settato)
+ *          0 altrimenti
+ */
+int initUring(uring_t *r, unsigned entries) {
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	memset(r, 0, sizeof(uring_t));
+
+	int e = pthread_mutex_init(&r->mutex, NULL);
+	if (e != 0) {
+		errno = e;
+		return -1;
+	}
+	if ((r->fd = syscall(__NR_io_uring_setup, entries, &p)) == -1) {
+		e = errno;
+		pthread_mutex_destroy(&r->mutex);
+		errno = e;
+		return -1;
+	}
+
+	// mappo le due code e l'array delle sqe
+	r->sq_size   = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cq_size   = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sq_ptr = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	r->cq_ptr = mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+	r->sqes   = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (r->sq_ptr == MAP_FAILED || r->cq_ptr == MAP_FAILED || r->sqes == MAP_FAILED) {
+		int err = errno;
+		if (r->sq_ptr != MAP_FAILED) munmap(r->sq_ptr, r->sq_size);
+		if (r->cq_ptr != MAP_FAILED) munmap(r->cq_ptr, r->cq_size);
+		if (r->sqes != MAP_FAILED)   munmap(r->sqes, r->sqes_size);
+		close(r->fd);
+		pthread_mutex_destroy(&r->mutex);
+		errno = err;
+		return -1;
+	}
+
+	r->sq_head  = (unsigned*)((char*)r->sq_ptr + p.sq_off.head);
+	r->sq_tail  = (unsigned*)((char*)r->sq_ptr + p.sq_off.tail);
+	r->sq_mask  = (unsigned*)((char*)r->sq_ptr + p.sq_off.ring_mask);
+	r->sq_array = (unsigned*)((char*)r->sq_ptr + p.sq_off.array);
+	r->entries  = p.sq_entries;
+	r->cq_head  = (unsigned*)((char*)r->cq_ptr + p.cq_off.head);
+	r->cq_tail  = (unsigned*)((char*)r->cq_ptr + p.cq_off.tail);
+	r->cq_mask  = (unsigned*)((char*)r->cq_ptr + p.cq_off.ring_mask);
+	r->cqes     = (struct io_uring_cqe*)((char*)r->cq_ptr + p.cq_off.cqes);
+
+	return 0;
+}
+
+/**
+ * @function getSqe
+ * @brief    riserva e azzera una sqe, che viene pubblicata alla prossima
+ *             submitUring (va chiamata, e la sqe compilata, con r->mutex acquisita)
+ *
+ * @param r puntatore all'anello
+ *
+ * @return NULL se la coda di sottomissione e' piena
+ *         il puntatore alla sqe altrimenti
+ */
+struct io_uring_sqe *getSqe(uring_t *r) {
+	unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+	unsigned tail = *r->sq_tail + r->pending; // comprese le sqe non ancora pubblicate
+	if (tail - head >= r->entries) // coda piena
+		return NULL;
+
+	unsigned idx = tail & *r->sq_mask;
+	struct io_uring_sqe *sqe = &r->sqes[idx];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	r->sq_array[idx] = idx;
+	r->pending++;
+	return sqe;
+}
+
+/**
+ * @function submitUring
+ * @brief    sottomette in un'unica chiamata tutte le sqe pubblicate
+ *             ed eventualmente attende dei completamenti
+ *
+ * @param r       puntatore all'anello
+ * @param wait    numero di completamenti da attendere (0 per non attendere)
+ * @param timeout attesa massima in millisecondi (< 0 per attendere indefinitamente)
+ *
+ * @return -1 in caso di errore (errno settato, ETIME se scade il timeout)
+ *         il numero di sqe sottomesse altrimenti
+ */
+int submitUring(uring_t *r, unsigned wait, int timeout) {
+	unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+	struct __kernel_timespec ts;
+	struct io_uring_getevents_arg arg;
+	void  *argp = NULL;
+	size_t argsz = 0;
+	unsigned n;
+
+	// pubblico al kernel le sqe gia' compilate: la somma dei to_submit e' pari
+	//   alle sqe pubblicate, quindi ognuna viene sottomessa una sola volta
+	//   anche se piu' thread chiamano submitUring sullo stesso anello
+	pthread_mutex_lock(&r->mutex);
+	n = r->pending;
+	__atomic_store_n(r->sq_tail, *r->sq_tail + n, __ATOMIC_RELEASE);
+	r->pending = 0;
+	pthread_mutex_unlock(&r->mutex);
+
+	if (wait && timeout >= 0) {
+		memset(&arg, 0, sizeof(arg));
+		ts.tv_sec  = timeout / 1000;
+		ts.tv_nsec = (timeout % 1000) * 1000000L;
+		arg.ts     = (unsigned long)&ts;
+		argp       = &arg;
+		argsz      = sizeof(arg);
+		flags     |= IORING_ENTER_EXT_ARG;
+	}
+	return syscall(__NR_io_uring_enter, r->fd, n, wait, flags, argp, argsz);
+}
+
+/**
+ * @function peekCqe
+ * @brief    restituisce il primo completamento non ancora consumato
+ *             (solo il listener proprietario consuma i completamenti)
+ *
+ * @param r puntatore all'anello
+ *
+ * @return NULL se non ci sono completamenti
+ *         il puntatore alla cqe altrimenti
+ */
+struct io_uring_cqe *peekCqe(uring_t *r) {
+	unsigned head = *r->cq_head;
+	if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) // nessun completamento
+		return NULL;
+	return &r->cqes[head & *r->cq_mask];
+}
+
+/**
+ * @function seenCqe
+ * @brief    consuma il completamento restituito da peekCqe
+ *
+ * @param r puntatore all'anello
+ */
+void seenCqe(uring_t *r) {
+	__atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @function freeUring
+ * @brief    chiude l'istanza io_uring e libera le mappature
+ *
+ * @param r puntatore all'anello
+ */
+void freeUring(uring_t *r) {
+	munmap(r->sqes, r->sqes_size);
+	munmap(r->cq_ptr, r->cq_size);
+	munmap(r->sq_ptr, r->sq_size);
+	close(r->fd);
+	pthread_mutex_destroy(&r->mutex);
+}
+
+#endif // USE_IO_URING
@@ -0,0 +1,133 @@
+#ifndef URING_H_
+#define URING_H_
+
+/**
+ * @file   uring.h
+ * @brief  Contiene le funzioni che implementano un'interfaccia minimale
+ *           verso io_uring, usata come backend opzionale del listener
+ *           (compilato solo con USE_IO_URING, vedi Makefile)
+ * @author Michele Zoncheddu 545227
+ *
+ * Si dichiara che il contenuto di questo file e'
+ *   in ogni sua parte opera originale dell'autore
+ */
+
+#if defined(USE_IO_URING)
+
+#include <pthread.h>
+#include <linux/io_uring.h>
+
+/**
+ * @struct uring_t
+ * @brief  anello di sottomissione e di completamento di io_uring
+ *
+ * @var fd        fd dell'istanza io_uring
+ * @var sq_head   testa della coda di sottomissione (scritta dal kernel)
+ * @var sq_tail   fine della coda di sottomissione
+ * @var sq_mask   maschera per gli indici della coda di sottomissione
+ * @var sq_array  array di indici delle sqe
+ * @var sqes      array delle richieste (sqe)
+ * @var entries   numero di posizioni della coda di sottomissione
+ * @var pending   numero di sqe compilate ma non ancora pubblicate
+ * @var cq_head   testa della coda di completamento
+ * @var cq_tail   fine della coda di completamento (scritta dal kernel)
+ * @var cq_mask   maschera per gli indici della coda di completamento
+ * @var cqes      array dei completamenti (cqe)
+ * @var sq_ptr    mappatura della coda di sottomissione
+ * @var sq_size   dimensione della mappatura sq_ptr
+ * @var cq_ptr    mappatura della coda di completamento
+ * @var cq_size   dimensione della mappatura cq_ptr
+ * @var sqes_size dimensione della mappatura sqes
+ * @var mutex     lock per la coda di sottomissione,
+ *                  condivisa tra il listener e i worker
+ */
+typedef struct {
+	int                  fd;
+	unsigned            *sq_head;
+	unsigned            *sq_tail;
+	unsigned            *sq_mask;
+	unsigned            *sq_array;
+	struct io_uring_sqe *sqes;
+	unsigned             entries;
+	unsigned             pending;
+	unsigned            *cq_head;
+	unsigned            *cq_tail;
+	unsigned            *cq_mask;
+	struct io_uring_cqe *cqes;
+	void                *sq_ptr;
+	size_t               sq_size;
+	void                *cq_ptr;
+	size_t               cq_size;
+	size_t               sqes_size;
+	pthread_mutex_t      mutex;
+} uring_t;
+
+/**
+ * @function initUring
+ * @brief    crea un'istanza io_uring e mappa le sue code
+ *
+ * @param r       puntatore all'anello da inizializzare
+ * @param entries numero di posizioni della coda di sottomissione
+ *
+ * @return -1 se io_uring non e' disponibile (errno settato)
+ *          0 altrimenti
+ */
+int initUring(uring_t *r, unsigned entries);
+
+/**
+ * @function getSqe
+ * @brief    riserva e azzera una sqe, che viene pubblicata alla prossima
+ *             submitUring (va chiamata, e la sqe compilata, con r->mutex acquisita)
+ *
+ * @param r puntatore all'anello
+ *
+ * @return NULL se la coda di sottomissione e' piena
+ *         il puntatore alla sqe altrimenti
+ */
+struct io_uring_sqe *getSqe(uring_t *r);
+
+/**
+ * @function submitUring
+ * @brief    sottomette in un'unica chiamata tutte le sqe pubblicate
+ *             ed eventualmente attende dei completamenti
+ *
+ * @param r       puntatore all'anello
+ * @param wait    numero di completamenti da attendere (0 per non attendere)
+ * @param timeout attesa massima in millisecondi (< 0 per attendere indefinitamente)
+ *
+ * @return -1 in caso di errore (errno settato, ETIME se scade il timeout)
+ *         il numero di sqe sottomesse altrimenti
+ */
+int submitUring(uring_t *r, unsigned wait, int timeout);
+
+/**
+ * @function peekCqe
+ * @brief    restituisce il primo completamento non ancora consumato
+ *             (solo il listener proprietario consuma i completamenti)
+ *
+ * @param r puntatore all'anello
+ *
+ * @return NULL se non ci sono completamenti
+ *         il puntatore alla cqe altrimenti
+ */
+struct io_uring_cqe *peekCqe(uring_t *r);
+
+/**
+ * @function seenCqe
+ * @brief    consuma il completamento restituito da peekCqe
+ *
+ * @param r puntatore all'anello
+ */
+void seenCqe(uring_t *r);
+
+/**
+ * @function freeUring
+ * @brief    chiude l'istanza io_uring e libera le mappature
+ *
+ * @param r puntatore all'anello
+ */
+void freeUring(uring_t *r);
+
+#endif // USE_IO_URING
+
+#endif // URING_H_
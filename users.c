@@ -1,3 +1,4 @@
+#define _GNU_SOURCE 1
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -5,10 +6,14 @@
 
 #include <util.h>
 #include <connections.h>
+#include <conn.h>
 #include <users.h>
 #include <groups.h>
 #include <stats.h>
 #include <online.h>
+#include <numa.h>
+#include <bufpool.h>
+#include <names.h>
 
 /**
  * @file   users.c
@@ -42,25 +47,31 @@ hash_t initUsers(int n) {
 
 	/**
 	 * Per distribuire in modo uniforme le lock nella tabella hash,
-	 * calcolo la dimensione come mcm tra il parametro n e il numero di threads worker,
-	 * moltiplicando tutto per 2, per avere un fattore di carico massimo di 0.5,
-	 * con la quale la tabella hash funziona in modo ottimale.
+	 * calcolo la dimensione come il doppio di n (fattore di carico massimo di 0.5,
+	 * con la quale la tabella hash funziona in modo ottimale), arrotondato al
+	 * multiplo di HASH_STRIPES successivo. Il numero di lock non dipende dal
+	 * numero di worker, che puo' variare durante l'esecuzione.
 	 */
-	size = 2 * ((n * conf.ThreadsInPool) / mcd(n, conf.ThreadsInPool)); // size = 2 * mcm(n, ThreadsInPool)
-	mutsize = size / conf.ThreadsInPool;
-	hash_t table = calloc(size, sizeof(user_t*));
+	size = ((2L * n + HASH_STRIPES - 1) / HASH_STRIPES) * HASH_STRIPES;
+	mutsize = size / HASH_STRIPES;
+	hash_t table = allocPages(size * sizeof(user_t*)); // posizionata con bindShared
 	if (!table)
 		return NULL;
 
 	// inizializzo le mutex della tabella hash
-	MALLOC(hash_mutex, malloc(conf.ThreadsInPool * sizeof(pthread_mutex_t)), "hash_mutex initHash");
-	for (int i = 0; i < conf.ThreadsInPool; ++i) {
+	MALLOC(hash_mutex, allocPages(HASH_STRIPES * sizeof(pthread_mutex_t)), "hash_mutex initHash");
+	for (int i = 0; i < HASH_STRIPES; ++i) {
 		r = pthread_mutex_init(&hash_mutex[i], NULL);
 		if (r != 0) {
 			free(table);
 			return NULL;
 		}
 	}
+
+	// ogni worker accede a tutte le celle e a tutte le lock: le distribuisco
+	//   sui nodi dei worker (nessun effetto senza NumaLocal)
+	bindShared(table, size * sizeof(user_t*));
+	bindShared(hash_mutex, HASH_STRIPES * sizeof(pthread_mutex_t));
 	return table;
 }
 
@@ -73,15 +84,19 @@ hash_t initUsers(int n) {
  * @param isGroup indica se devo regustrare un gruppo o un utente
  * 
  * @return -1 se l'utente o il gruppo e' gia' registrato
+ *         -2 se la tabella dei nomi e' piena (NAMES_MAX nomi)
  *          0 altrimenti
  */
 int signUp(hash_t table, char *key, int isGroup) {
 	history_t *h;
 	user_t    *new;
+	int        id;
 
 	// se e' gia' registrato
 	if (isRegistered(table, key))
 		return -1;
+	if ((id = internName(key)) == -1) // nessun id disponibile
+		return -2;
 
 	int pos = hash(key);
 	MALLOC(new, malloc(sizeof(user_t)), "new signUp");
@@ -95,7 +110,7 @@ int signUp(hash_t table, char *key, int isGroup) {
 		h = NULL;
 
 	// inizializzo i dati
-	strncpy(new->nick, key, MAX_NAME_LENGTH + 1);
+	new->id      = id;
 	new->history = h;
 	if (!isGroup) {
 		h->start = -1;
@@ -128,12 +143,12 @@ int signUp(hash_t table, char *key, int isGroup) {
  */
 void unregisterUser(hash_t table, char *key) {
 	user_t *elem, *tmp;
-	int pos = hash(key);
+	int pos = hash(key), id = nameId(key);
 
 	pthread_mutex_lock(&hash_mutex[pos / mutsize]);
 	elem = table[pos];
 	// se devo cancellare la testa della lista di trabocco
-	if (strncmp(elem->nick, key, MAX_NAME_LENGTH + 1) == 0) {
+	if (elem->id == id) {
 		freeHistory(elem->history);
 		tmp = elem;
 		table[pos] = elem->next;
@@ -145,7 +160,7 @@ void unregisterUser(hash_t table, char *key) {
 
 	// cerco la struttura da eliminare
 	tmp = elem->next;
-	while (tmp && strncmp(tmp->nick, key, MAX_NAME_LENGTH + 1) != 0)
+	while (tmp && tmp->id != id)
 		tmp = tmp->next;
 	if (!tmp) { // utente non trovato
 		pthread_mutex_unlock(&hash_mutex[pos / mutsize]);
@@ -175,12 +190,16 @@ void unregisterUser(hash_t table, char *key) {
  *         2 se e' un gruppo
  */
 int isRegistered(hash_t table, char *key) {
-	int pos = hash(key), res;
+	int pos, res, id;
+
+	if ((id = nameId(key)) == -1) // nome mai registrato
+		return 0;
 
 	// cerco il nick
+	pos = hash(key);
 	pthread_mutex_lock(&hash_mutex[pos / mutsize]);
 	user_t *elem = table[pos];
-	while (elem && strncmp(elem->nick, key, MAX_NAME_LENGTH + 1) != 0)
+	while (elem && elem->id != id)
 		elem = elem->next;
 	if (elem == NULL) { // nick non trovato
 		pthread_mutex_unlock(&hash_mutex[pos / mutsize]);
@@ -203,20 +222,22 @@ int isRegistered(hash_t table, char *key) {
  * @param msg   il messaggio da inviare
  */
 void sendMessage(hash_t table, message_t msg) {
-	int pos = hash(msg.data.hdr.receiver), res;
+	int     pos = hash(msg.data.hdr.receiver), res, id = nameId(msg.data.hdr.receiver);
+	user_t *elem;
 
-	// cerco il destinatario (non posso non trovarlo)
+	// cerco il destinatario (non posso non trovarlo), senza modificare la lista di trabocco
 	pthread_mutex_lock(&hash_mutex[pos / mutsize]);
-	while (table[pos] && strncmp(table[pos]->nick, msg.data.hdr.receiver, MAX_NAME_LENGTH + 1) != 0)
-		table[pos] = table[pos]->next;
+	elem = table[pos];
+	while (elem && elem->id != id)
+		elem = elem->next;
 
 	// inserisco il messaggio nella history
-	history_t *h = table[pos]->history; // prelevo la history del destinatario
+	history_t *h = elem->history; // prelevo la history del destinatario
 	if (h->start == -1) { // history non piena
 		h->msgs[h->end] = msg;
 
 		// provo ad inviare il messaggio
-		res = sendMessageAtomic(msg);
+		res = notifyAtomic(msg);
 		if (res > 0) { // messaggio inviato
 			h->sent[h->end] = 1;
 			if (msg.hdr.op == TXT_MESSAGE)
@@ -238,11 +259,11 @@ void sendMessage(hash_t table, message_t msg) {
 	}
 	else { // start == end, history piena
 		if (h->msgs[h->end].data.buf)
-			free(h->msgs[h->end].data.buf);
+			bufFree(h->msgs[h->end].data.buf);
 		h->msgs[h->end] = msg;
 
 		// provo ad inviare il messaggio
-		res = sendMessageAtomic(msg);
+		res = notifyAtomic(msg);
 		if (res > 0) { // messaggio inviato
 			h->sent[h->end] = 1;
 			if (msg.hdr.op == TXT_MESSAGE)
@@ -260,7 +281,7 @@ void sendMessage(hash_t table, message_t msg) {
 		h->end = (h->end + 1) % conf.MaxHistMsgs;
 		h->start = h->end;
 	}
-	table[pos]->history = h; // salvo le modifiche
+	elem->history = h; // salvo le modifiche
 	pthread_mutex_unlock(&hash_mutex[pos / mutsize]);
 }
 
@@ -274,8 +295,8 @@ void sendMessage(hash_t table, message_t msg) {
  * @param msg   il messaggio da inviare
  */
 void sendMessageAll(hash_t table, message_t msg) {
-	int res, nonline;
-	char **list = NULL;
+	int  res, nonline, id = nameId(msg.hdr.sender);
+	int *list = NULL;
 
 	// memorizzo gli utenti online
 	nonline = getOnlineList(&list);
@@ -283,90 +304,72 @@ void sendMessageAll(hash_t table, message_t msg) {
 	// inserisco il messaggio nella history di tutti gli utenti
 	for (int i = 0; i < size; ++i) {
 		pthread_mutex_lock(&hash_mutex[i / mutsize]);
-		if (table[i] == NULL) { // elemento vuoto
-			pthread_mutex_unlock(&hash_mutex[i / mutsize]);
-			continue;
-		}
-		// se incontro "me stesso" e la lista continua, vado avanti
-		if (table[i]->next && strncmp(table[i]->nick, msg.hdr.sender, MAX_NAME_LENGTH + 1) == 0) {
-			table[i] = table[i]->next;
-			pthread_mutex_unlock(&hash_mutex[i / mutsize]);
-			i--; // il for rimane sullo stesso indice i
-			continue;
-		}
-		history_t *h    = table[i]->history; // prelevo la history dell'utente
-		message_t  hmsg = h->msgs[h->end];   // variabile temporanea per ridurre la verbosita'
-		if (h->start == -1) { // history non piena
-			hmsg = msg;
-			// copio i dati del messaggio
-			strncpy(hmsg.data.hdr.receiver, table[i]->nick, MAX_NAME_LENGTH + 1);
-			MALLOC(hmsg.data.buf, malloc(hmsg.data.hdr.len), "hmsg.data.buf sendMessageAll");
-			strncpy(hmsg.data.buf, msg.data.buf, msg.data.hdr.len);
-			h->msgs[h->end] = hmsg; // salvo le modifiche
-
-			// se il destinatario è online, provo ad inviare il messaggio
-			if (isIn(table[i]->nick, list, nonline)) {
-				res = sendMessageAtomic(hmsg);
-				if (res > 0) { // messaggio inviato
-					h->sent[h->end] = 1;
-					chattyStats.ndelivered++;
+		// scorro la lista di trabocco senza modificarla
+		for (user_t *elem = table[i]; elem; elem = elem->next) {
+			if (elem->id == id || !elem->history) // salto "me stesso" e i gruppi
+				continue;
+			history_t *h    = elem->history;   // prelevo la history dell'utente
+			message_t  hmsg = h->msgs[h->end]; // variabile temporanea per ridurre la verbosita'
+			if (h->start == -1) { // history non piena
+				hmsg = msg;
+				// i dati del messaggio sono condivisi tra le history dei destinatari
+				strncpy(hmsg.data.hdr.receiver, nameOf(elem->id), MAX_NAME_LENGTH + 1);
+				hmsg.data.buf = bufShare(msg.data.buf);
+				h->msgs[h->end] = hmsg; // salvo le modifiche
+
+				// se il destinatario è online, provo ad inviare il messaggio
+				if (isIn(elem->id, list, nonline)) {
+					res = notifyAtomic(hmsg);
+					if (res > 0) { // messaggio inviato
+						h->sent[h->end] = 1;
+						chattyStats.ndelivered++;
+					}
+					else { // messaggio non inviato
+						h->sent[h->end] = 0;
+						chattyStats.nnotdelivered++;
+					}
 				}
-				else { // messaggio non inviato
+				else { // destinatario non online
 					h->sent[h->end] = 0;
 					chattyStats.nnotdelivered++;
 				}
+				h->end = (h->end + 1) % conf.MaxHistMsgs;
+				if (h->end == 0)
+					h->start = 0;
+				h->size++;
 			}
-			else { // destinatario non online
-				h->sent[h->end] = 0;
-				chattyStats.nnotdelivered++;
-			}
-			h->end = (h->end + 1) % conf.MaxHistMsgs;
-			if (h->end == 0)
-				h->start = 0;
-			h->size++;
-		}
-		else { // start == end, history piena
-			if (hmsg.data.buf)
-				free(hmsg.data.buf);
-			hmsg = msg;
-			strncpy(hmsg.data.hdr.receiver, table[i]->nick, MAX_NAME_LENGTH + 1);
-			MALLOC(hmsg.data.buf, malloc(hmsg.data.hdr.len), "hmsg.data.buf sendMessageAll");
-			strncpy(hmsg.data.buf, msg.data.buf, msg.data.hdr.len); // copio i dati del messaggio
-			h->msgs[h->end] = hmsg; // salvo le modifiche
-
-			// se il destinatario è online, provo ad inviare il messaggio
-			if (isIn(table[i]->nick, list, nonline)) {
-				res = sendMessageAtomic(hmsg);
-				if (res > 0) { // messaggio inviato
-					h->sent[h->end] = 1;
-					chattyStats.ndelivered++;
+			else { // start == end, history piena
+				if (hmsg.data.buf)
+					bufFree(hmsg.data.buf);
+				hmsg = msg;
+				strncpy(hmsg.data.hdr.receiver, nameOf(elem->id), MAX_NAME_LENGTH + 1);
+				hmsg.data.buf = bufShare(msg.data.buf); // condivido i dati del messaggio
+				h->msgs[h->end] = hmsg; // salvo le modifiche
+
+				// se il destinatario è online, provo ad inviare il messaggio
+				if (isIn(elem->id, list, nonline)) {
+					res = notifyAtomic(hmsg);
+					if (res > 0) { // messaggio inviato
+						h->sent[h->end] = 1;
+						chattyStats.ndelivered++;
+					}
+					else { // messaggio non inviato
+						h->sent[h->end] = 0;
+						chattyStats.nnotdelivered++;
+					}
 				}
-				else { // messaggio non inviato
+				else { // destinatario non online
 					h->sent[h->end] = 0;
 					chattyStats.nnotdelivered++;
 				}
+				h->end = (h->end + 1) % conf.MaxHistMsgs;
+				h->start = h->end;
 			}
-			else { // destinatario non online
-				h->sent[h->end] = 0;
-				chattyStats.nnotdelivered++;
+			elem->history = h; // salvo le modifiche
 			}
-			h->end = (h->end + 1) % conf.MaxHistMsgs;
-			h->start = h->end;
-		}
-		table[i]->history = h; // salvo le modifiche
-		// se la lista di trabocco continua...
-		if (table[i]->next) {
-			table[i] = table[i]->next;
-			pthread_mutex_unlock(&hash_mutex[i / mutsize]);
-			i--; // il for rimane sullo stesso indice i
-		}
-		else
 			pthread_mutex_unlock(&hash_mutex[i / mutsize]);
 	}
-	// dealloco la lista di utenti online
-	for (int i = 0; i < nonline; ++i)
-		free(list[i]);
-	free(list);
+	free(list); // dealloco la lista di utenti online
 }
 
 /**
@@ -381,43 +384,44 @@ void sendMessageAll(hash_t table, message_t msg) {
  *          0 altrimenti
  */
 int sendMessageToGroup(hash_t table, message_t msg) {
-	int res, list_len, pos, k = 0;
-	char  **list = NULL;
+	int     res, list_len, pos, k = 0, id = nameId(msg.hdr.sender);
+	int    *list = NULL;
 	user_t *elem;
 
 	// ottengo la lista dei membri del gruppo
 	list_len = getMembers(msg.data.hdr.receiver, &list);
 
 	// verifico che il mittente appartenga al gruppo
-	while (k < list_len && strncmp(list[k], msg.hdr.sender, MAX_NAME_LENGTH + 1) != 0)
+	while (k < list_len && list[k] != id)
 		k++;
 	if (k == list_len) { // il mittente non appartiene al gruppo
-		for (int i = 0; i < list_len; ++i)
-			free(list[i]);
 		free(list);
 		return -1;
 	}
 
 	// inserisco il messaggio nella history degli utenti del gruppo
 	for (int i = 0; i < list_len; ++i) {
-		pos = hash(list[i]);
-		pthread_mutex_lock(&hash_mutex[i / mutsize]);
+		pos = hash(nameOf(list[i]));
+		pthread_mutex_lock(&hash_mutex[pos / mutsize]);
 		elem = table[pos];
 		// cerco l'utente
 		while (elem) {
+			if (elem->id != list[i]) { // altro nome nella stessa lista di trabocco
+				elem = elem->next;
+				continue;
+			}
 			// se e' diverso dal mittente
 			history_t *h    = elem->history;   // prelevo la history dell'utente
 			message_t  hmsg = h->msgs[h->end]; // variabile temporanea per ridurre la verbosita'
 			if (h->start == -1) { // history non piena
 				hmsg = msg;
-				// copio i dati del messaggio
-				strncpy(hmsg.data.hdr.receiver, elem->nick, MAX_NAME_LENGTH + 1);
-				MALLOC(hmsg.data.buf, malloc(hmsg.data.hdr.len), "hmsg.data.buf sendMessageAll");
-				strncpy(hmsg.data.buf, msg.data.buf, msg.data.hdr.len);
+				// i dati del messaggio sono condivisi tra le history dei membri
+				strncpy(hmsg.data.hdr.receiver, nameOf(elem->id), MAX_NAME_LENGTH + 1);
+				hmsg.data.buf = bufShare(msg.data.buf);
 				h->msgs[h->end] = hmsg; // salvo le modifiche
 
 				// provo ad inviare il messaggio
-				res = sendMessageAtomic(hmsg);
+				res = notifyAtomic(hmsg);
 				if (res > 0) { // messaggio inviato
 					h->sent[h->end] = 1;
 					if (hmsg.hdr.op == TXT_MESSAGE)
@@ -439,15 +443,14 @@ int sendMessageToGroup(hash_t table, message_t msg) {
 			}
 			else { // start == end, history piena
 				if (hmsg.data.buf)
-					free(hmsg.data.buf);
+					bufFree(hmsg.data.buf);
 				hmsg = msg;
-				strncpy(hmsg.data.hdr.receiver, elem->nick, MAX_NAME_LENGTH + 1);
-				MALLOC(hmsg.data.buf, malloc(hmsg.data.hdr.len), "hmsg.data.buf sendMessageAll");
-				strncpy(hmsg.data.buf, msg.data.buf, msg.data.hdr.len); // copio i dati del messaggio
+				strncpy(hmsg.data.hdr.receiver, nameOf(elem->id), MAX_NAME_LENGTH + 1);
+				hmsg.data.buf = bufShare(msg.data.buf); // condivido i dati del messaggio
 				h->msgs[h->end] = hmsg; // salvo le modifiche
 
 				// provo ad inviare il messaggio
-				res = sendMessageAtomic(hmsg);
+				res = notifyAtomic(hmsg);
 				if (res > 0) { // messaggio inviato
 					h->sent[h->end] = 1;
 					if (hmsg.hdr.op == TXT_MESSAGE)
@@ -467,12 +470,9 @@ int sendMessageToGroup(hash_t table, message_t msg) {
 			}
 			elem = elem->next; // in caso di collisioni
 		}
-		pthread_mutex_unlock(&hash_mutex[i / mutsize]);
+		pthread_mutex_unlock(&hash_mutex[pos / mutsize]);
 	}
-	// dealloco la lista di utenti
-	for (int i = 0; i < list_len; ++i)
-		free(list[i]);
-	free(list);
+	free(list); // dealloco la lista di utenti
 	return 0;
 }
 
@@ -485,22 +485,24 @@ int sendMessageToGroup(hash_t table, message_t msg) {
  * @param fd    il fd del destinatario
  */
 void sendHistory(hash_t table, char *key, int fd) {
-	int pos = hash(key);
+	int pos = hash(key), id = nameId(key);
+	user_t *elem;
 	message_data_t data;
 	memset(&data, 0, sizeof(message_data_t));
 	data.buf = calloc(1, sizeof(size_t));
 	strncpy(data.hdr.receiver, key, MAX_NAME_LENGTH + 1);
 
 	pthread_mutex_lock(&hash_mutex[pos / mutsize]);
-	// cerco l'utente (non posso non trovarlo)
-	while (table[pos] && strncmp(table[pos]->nick, key, MAX_NAME_LENGTH + 1) != 0)
-		table[pos] = table[pos]->next;
+	// cerco l'utente (non posso non trovarlo), senza modificare la lista di trabocco
+	elem = table[pos];
+	while (elem && elem->id != id)
+		elem = elem->next;
 
-	history_t *h = table[pos]->history; // prelevo la history dell'utente
+	history_t *h = elem->history; // prelevo la history dell'utente
 	sendOpAtomic(key, OP_OK);
 	*(data.buf) = h->size;
 	data.hdr.len = sizeof(size_t);
-	sendData(fd, &data); // invio il numero di messaggi che inviero'
+	queueData(fd, &data); // invio il numero di messaggi che inviero'
 	free(data.buf);
 
 	if (h->start == h->end) { // history piena
@@ -538,12 +540,12 @@ void freeHistory(history_t *h) {
 	if (h->start == h->end) { // history piena
 		for (int i = h->start; i < h->start + conf.MaxHistMsgs; ++i)
 			if (h->msgs[i % conf.MaxHistMsgs].data.buf)
-				free(h->msgs[i % conf.MaxHistMsgs].data.buf);
+				bufFree(h->msgs[i % conf.MaxHistMsgs].data.buf);
 	}
 	else { // history non piena
 		for (int i = 0; i < h->end; ++i)
 			if (h->msgs[i].data.buf)
-				free(h->msgs[i].data.buf);
+				bufFree(h->msgs[i].data.buf);
 	}
 	free(h->msgs);
 	free(h->sent);
@@ -572,7 +574,7 @@ void freeUsers(hash_t table) {
 	free(table);
 
 	// elimino le mutex
-	for (int i = 0; i < conf.ThreadsInPool; ++i)
+	for (int i = 0; i < HASH_STRIPES; ++i)
 		pthread_mutex_destroy(&hash_mutex[i]);
 	free(hash_mutex);
 }
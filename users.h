@@ -37,12 +37,12 @@ typedef struct {
  * @struct user
  * @brief  dati di un utente registrato
  * 
- * @var nick    nome dell'utente
+ * @var id      id del nome dell'utente (vedi names.h)
  * @var history puntatore alla history dell'utente
  * @var next    puntatore al prossimo utente
  */
 typedef struct user {
-	char         nick[MAX_NAME_LENGTH + 1];
+	int          id;
 	history_t   *history;
 	struct user *next;
 } user_t;
@@ -70,6 +70,7 @@ hash_t initUsers(int n);
  * @param isGroup indica se devo regustrare un gruppo o un utente
  * 
  * @return -1 se l'utente o il gruppo e' gia' registrato
+ *         -2 se la tabella dei nomi e' piena (NAMES_MAX nomi)
  *          0 altrimenti
  */
 int signUp(hash_t table, char *key, int isGroup);
@@ -3,6 +3,7 @@
 
 #include <unistd.h>
 #include <errno.h>
+#include <sys/uio.h>
 
 #include <queue.h>
 #include <users.h>
@@ -82,6 +83,42 @@ static inline int writen(int fd, void *buf, size_t size) {
 	return size;
 }
 
+/**
+ * @function writevn
+ * @brief    scrive esattamente tutti i blocchi, con il minor numero
+ *             di chiamate writev (i blocchi vengono modificati)
+ * 
+ * @param fd  il fd nel quale bisogna scrivere
+ * @param iov i blocchi da inviare
+ * @param cnt il numero di blocchi
+ * 
+ * @return -1 se c'e' stato un errore
+ *        >=0 altrimenti
+ */
+static inline int writevn(int fd, struct iovec *iov, int cnt) {
+	size_t size = 0;
+	ssize_t r;
+	for (int i = 0; i < cnt; ++i)
+		size += iov[i].iov_len;
+	while (cnt > 0) {
+		if ((r = writev(fd, iov, cnt)) == -1) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		if (r == 0) return 0;
+		while (cnt > 0 && (size_t)r >= iov->iov_len) { // blocchi inviati per intero
+			r -= iov->iov_len;
+			++iov;
+			--cnt;
+		}
+		if (cnt > 0) { // blocco inviato in parte
+			iov->iov_base  = (char*)iov->iov_base + r;
+			iov->iov_len  -= r;
+		}
+	}
+	return size;
+}
+
 /**
  * @function mcd
  * @brief    calcola il massimo comun divisore tra due numeri
@@ -104,19 +141,19 @@ static inline int mcd(int a, int b) {
 
 /**
  * @function isIn
- * @brief    verifica la presenza di una stringa
- *             in un array di stringhe
+ * @brief    verifica la presenza di un id
+ *             in un array di id (vedi names.h)
  * 
- * @param key   la stringa da cercare
+ * @param key   l'id da cercare
  * @param array l'array nel quale cercare
  * @param n     la dimensione dell'array
  * 
  * @return 0 se key non e' presente nell'array
  *         1 altrimenti
  */
-static inline int isIn(char *key, char **array, int n) {
+static inline int isIn(int key, int *array, int n) {
 	for (int i = 0; i < n; ++i)
-		if (strncmp(key, array[i], MAX_NAME_LENGTH + 1) == 0)
+		if (array[i] == key)
 			return 1;
 	return 0;
 }